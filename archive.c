@@ -0,0 +1,904 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <snappy-c.h>
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#include <sys/utime.h>
+#ifndef PATH_MAX
+#define PATH_MAX MAX_PATH
+#endif
+#define PATH_DELIMITER '\\'
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <limits.h>
+#include <unistd.h>
+#include <utime.h>
+#define PATH_DELIMITER '/'
+#endif
+#include "snzip.h"
+#include "crc32.h"
+#include "thread.h"
+#ifdef WIN32
+#define stat _stati64
+#define fstat _fstati64
+#define ftello _ftelli64
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
+
+/*
+ * Archive of many files.
+ *
+ * An archive is a framing2 stream whose members are compressed into
+ * their own chunks. A member can be uncompressed by itself and
+ * uncompressing the whole archive as a framing2 stream gives the
+ * concatenation of the members.
+ *
+ * The central directory is stored in one or more skippable chunks
+ * followed by a fixed-size locator chunk at the end of the stream.
+ *
+ * directory chunk (0xf2):
+ *   masked crc32c of the rest (4 bytes)
+ *   entries:
+ *     compressed offset of the member (8 bytes)
+ *     compressed length (8 bytes)
+ *     uncompressed length (8 bytes)
+ *     masked crc32c of the uncompressed data (4 bytes)
+ *     file mode (4 bytes)
+ *     modification time in seconds since the epoch (8 bytes)
+ *     name length (2 bytes)
+ *     name
+ *
+ * locator chunk (0xf3):
+ *   masked crc32c of the rest (4 bytes)
+ *   compressed offset of the first directory chunk (8 bytes)
+ *   number of members (8 bytes)
+ *
+ * All integers are little endian. Compressed offsets are relative to
+ * the stream identifier.
+ */
+#define COMPRESSED_DATA_IDENTIFIER 0x00
+#define UNCOMPRESSED_DATA_IDENTIFIER 0x01
+#define DIRECTORY_IDENTIFIER 0xf2
+#define DIRECTORY_LOCATOR_IDENTIFIER 0xf3
+#define DIRECTORY_ENTRY_LEN 42 /* excluding the name */
+#define DIRECTORY_LOCATOR_LEN 24 /* including the chunk header */
+#define STREAM_HEADER_LEN 10
+#define MAX_NAME_LEN 65535
+#define MAX_DATA_LEN 16777215 /* maximum chunk data length */
+#define MAX_UNCOMPRESSED_DATA_LEN 65536 /* maximum uncompressed data length excluding checksum */
+#define MAX_WHOLE_READ_LEN (1024 * 1024) /* members up to this length are read by one pread */
+
+typedef struct {
+  char *name;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t uncompressed_length;
+  uint32_t crc32c;
+  uint32_t mode;
+  int64_t mtime;
+} member_t;
+
+typedef struct {
+  member_t *members;
+  size_t num_members;
+  size_t max_members;
+} directory_t;
+
+static uint32_t mask_crc32c(uint32_t crc)
+{
+  return ((crc >> 15) | (crc << 17)) + MASK_DELTA;
+}
+
+/* crc32c of data 'a' followed by data 'b' of 'b_len' bytes */
+static uint32_t combine_crc32c(uint32_t a, uint32_t b, size_t b_len)
+{
+  return crc32c_multmodp(crc32c_x8nmodp(b_len), a) ^ b;
+}
+
+static member_t *add_member(directory_t *dir, const char *name, size_t namelen)
+{
+  member_t *m;
+
+  if (namelen > MAX_NAME_LEN) {
+    print_error("Too long file name: %.*s\n", (int)namelen, name);
+    return NULL;
+  }
+  if (dir->num_members == dir->max_members) {
+    size_t max_members = dir->max_members ? dir->max_members * 2 : 1024;
+    member_t *members = realloc(dir->members, max_members * sizeof(member_t));
+    if (members == NULL) {
+      print_error("out of memory\n");
+      return NULL;
+    }
+    dir->members = members;
+    dir->max_members = max_members;
+  }
+  m = &dir->members[dir->num_members];
+  memset(m, 0, sizeof(*m));
+  m->name = malloc(namelen + 1);
+  if (m->name == NULL) {
+    print_error("out of memory\n");
+    return NULL;
+  }
+  memcpy(m->name, name, namelen);
+  m->name[namelen] = '\0';
+  dir->num_members++;
+  return m;
+}
+
+static void free_directory(directory_t *dir)
+{
+  size_t i;
+
+  for (i = 0; i < dir->num_members; i++) {
+    free(dir->members[i].name);
+  }
+  free(dir->members);
+}
+
+static int write_directory(FILE *outfp, const directory_t *dir, uint64_t offset)
+{
+  char *data = malloc(4 + MAX_DATA_LEN);
+  char locator[DIRECTORY_LOCATOR_LEN];
+  size_t i = 0;
+  int err = -1;
+
+  if (data == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  do {
+    size_t data_len = 4;
+    char *p = data + 8;
+
+    while (i < dir->num_members) {
+      const member_t *m = &dir->members[i];
+      size_t namelen = strlen(m->name);
+
+      if (data_len + DIRECTORY_ENTRY_LEN + namelen > MAX_DATA_LEN) {
+        break;
+      }
+      snz_put_le(p, m->offset, 8);
+      snz_put_le(p + 8, m->length, 8);
+      snz_put_le(p + 16, m->uncompressed_length, 8);
+      snz_put_le(p + 24, m->crc32c, 4);
+      snz_put_le(p + 28, m->mode, 4);
+      snz_put_le(p + 32, (uint64_t)m->mtime, 8);
+      snz_put_le(p + 40, namelen, 2);
+      memcpy(p + DIRECTORY_ENTRY_LEN, m->name, namelen);
+      p += DIRECTORY_ENTRY_LEN + namelen;
+      data_len += DIRECTORY_ENTRY_LEN + namelen;
+      i++;
+    }
+    data[0] = DIRECTORY_IDENTIFIER;
+    snz_put_le(data + 1, data_len, 3);
+    snz_put_le(data + 4, masked_crc32c(data + 8, data_len - 4), 4);
+    if (fwrite(data, 4 + data_len, 1, outfp) != 1) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
+      goto cleanup;
+    }
+  } while (i < dir->num_members);
+
+  locator[0] = DIRECTORY_LOCATOR_IDENTIFIER;
+  snz_put_le(locator + 1, DIRECTORY_LOCATOR_LEN - 4, 3);
+  snz_put_le(locator + 8, offset, 8);
+  snz_put_le(locator + 16, dir->num_members, 8);
+  snz_put_le(locator + 4, masked_crc32c(locator + 8, 16), 4);
+  if (fwrite(locator, sizeof(locator), 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  err = 0;
+ cleanup:
+  free(data);
+  return err;
+}
+
+static int read_directory(int fd, directory_t *dir)
+{
+  struct stat sbuf;
+  char locator[DIRECTORY_LOCATOR_LEN];
+  uint64_t locator_offset;
+  uint64_t offset;
+  uint64_t num_members;
+  size_t data_len;
+  char *data = NULL;
+  const char *p;
+  const char *end;
+
+  if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode)) {
+    print_error("Archives must be regular files\n");
+    return -1;
+  }
+  if (sbuf.st_size < STREAM_HEADER_LEN + DIRECTORY_LOCATOR_LEN) {
+    print_error("Invalid archive: too short\n");
+    return -1;
+  }
+  locator_offset = sbuf.st_size - DIRECTORY_LOCATOR_LEN;
+  if (pread_full(fd, locator, sizeof(locator), locator_offset) != 0) {
+    return -1;
+  }
+  if ((unsigned char)locator[0] != DIRECTORY_LOCATOR_IDENTIFIER
+      || snz_get_le(locator + 1, 3) != DIRECTORY_LOCATOR_LEN - 4
+      || snz_get_le(locator + 4, 4) != masked_crc32c(locator + 8, 16)) {
+    print_error("Invalid archive: no central directory\n");
+    return -1;
+  }
+  offset = snz_get_le(locator + 8, 8);
+  num_members = snz_get_le(locator + 16, 8);
+  if (offset < STREAM_HEADER_LEN || offset > locator_offset - 4) {
+    print_error("Invalid archive: wrong central directory offset\n");
+    return -1;
+  }
+  data_len = locator_offset - offset;
+  data = malloc(data_len);
+  if (data == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  if (pread_full(fd, data, data_len, offset) != 0) {
+    goto error;
+  }
+  p = data;
+  end = data + data_len;
+  while (p < end) {
+    size_t chunk_len;
+    const char *q;
+    const char *chunk_end;
+
+    if (end - p < 8 || (unsigned char)p[0] != DIRECTORY_IDENTIFIER) {
+      print_error("Invalid archive: broken central directory\n");
+      goto error;
+    }
+    chunk_len = snz_get_le(p + 1, 3);
+    if (chunk_len < 4 || chunk_len > (size_t)(end - p - 4)) {
+      print_error("Invalid archive: broken central directory\n");
+      goto error;
+    }
+    if (snz_get_le(p + 4, 4) != masked_crc32c(p + 8, chunk_len - 4)) {
+      print_error("Invalid archive: CRC32C error in the central directory\n");
+      goto error;
+    }
+    chunk_end = p + 4 + chunk_len;
+    for (q = p + 8; q < chunk_end; ) {
+      member_t *m;
+      size_t namelen;
+
+      if (chunk_end - q < DIRECTORY_ENTRY_LEN
+          || (namelen = snz_get_le(q + 40, 2)) > (size_t)(chunk_end - q - DIRECTORY_ENTRY_LEN)) {
+        print_error("Invalid archive: broken central directory\n");
+        goto error;
+      }
+      m = add_member(dir, q + DIRECTORY_ENTRY_LEN, namelen);
+      if (m == NULL) {
+        goto error;
+      }
+      m->offset = snz_get_le(q, 8);
+      m->length = snz_get_le(q + 8, 8);
+      m->uncompressed_length = snz_get_le(q + 16, 8);
+      m->crc32c = snz_get_le(q + 24, 4);
+      m->mode = snz_get_le(q + 28, 4);
+      m->mtime = (int64_t)snz_get_le(q + 32, 8);
+      if (m->offset < STREAM_HEADER_LEN || m->offset > offset || m->length > offset - m->offset) {
+        print_error("Invalid archive: wrong offset of %s\n", m->name);
+        goto error;
+      }
+      q += DIRECTORY_ENTRY_LEN + namelen;
+    }
+    p = chunk_end;
+  }
+  if (dir->num_members != num_members) {
+    print_error("Invalid archive: wrong number of members\n");
+    goto error;
+  }
+  free(data);
+  trace("read central directory: %lu members\n", (unsigned long)dir->num_members);
+  return 0;
+ error:
+  free(data);
+  return -1;
+}
+
+static int read_full(int fd, char *buf, size_t count)
+{
+  size_t total = 0;
+
+  while (total < count) {
+    int rv = read(fd, buf + total, count - total);
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (rv == 0) {
+      break;
+    }
+    total += rv;
+  }
+  return (int)total;
+}
+
+/* Reject names which would be written outside of the current directory. */
+static int is_safe_name(const char *name)
+{
+  const char *p = name;
+
+  if (*name == '\0' || *name == '/' || *name == '\\') {
+    return FALSE;
+  }
+#ifdef WIN32
+  if (strchr(name, ':') != NULL) {
+    return FALSE;
+  }
+#endif
+  while (*p != '\0') {
+    size_t len = strcspn(p, "/\\");
+    if (len == 2 && p[0] == '.' && p[1] == '.') {
+      return FALSE;
+    }
+    p += len;
+    if (*p != '\0') {
+      p++;
+    }
+  }
+  return TRUE;
+}
+
+/* compress a member into chunks and add it to the directory */
+static int add_file(FILE *outfp, directory_t *dir, const char *file, const struct stat *outbuf,
+                    char *uncompressed_data, char *compressed_data, uint64_t *offset)
+{
+  const block_writer_t *w = framing2_format.block_writer;
+  const size_t max_compressed_len = snappy_max_compressed_length(MAX_UNCOMPRESSED_DATA_LEN);
+  const char *name = file;
+  struct stat sbuf;
+  member_t *m;
+  uint32_t crc = 0;
+  int fd;
+  int len;
+  int err = -1;
+
+  fd = open(file, O_RDONLY | O_BINARY);
+  if (fd == -1 || fstat(fd, &sbuf) != 0) {
+    print_error("Failed to open %s for read: %s\n", file, strerror(errno));
+    goto cleanup;
+  }
+  if (!S_ISREG(sbuf.st_mode)) {
+    print_error("%s is not a regular file\n", file);
+    goto cleanup;
+  }
+  if (sbuf.st_dev == outbuf->st_dev && sbuf.st_ino == outbuf->st_ino) {
+    print_error("%s is the archive itself\n", file);
+    goto cleanup;
+  }
+  /* store absolute paths as relative ones */
+  while (*name == '/' || *name == PATH_DELIMITER) {
+    name++;
+  }
+  if (!is_safe_name(name)) {
+    print_error("%s: file names containing '..' can't be stored\n", file);
+    goto cleanup;
+  }
+  m = add_member(dir, name, strlen(name));
+  if (m == NULL) {
+    goto cleanup;
+  }
+  m->offset = *offset;
+  m->mode = sbuf.st_mode;
+  m->mtime = sbuf.st_mtime;
+
+  while ((len = read_full(fd, uncompressed_data, MAX_UNCOMPRESSED_DATA_LEN)) > 0) {
+    snappy_block_t blk;
+    size_t compressed_len = max_compressed_len;
+    uint32_t chunk_crc = ~calculate_crc32c(~0, (const unsigned char *)uncompressed_data, len);
+
+    snappy_compress(uncompressed_data, len, compressed_data, &compressed_len);
+    blk.uncompressed_len = len;
+    blk.has_crc = TRUE;
+    blk.crc32c = mask_crc32c(chunk_crc);
+    if (compressed_len >= len - (len / 8)) {
+      blk.data = uncompressed_data;
+      blk.len = len;
+      blk.compressed = FALSE;
+    } else {
+      blk.data = compressed_data;
+      blk.len = compressed_len;
+      blk.compressed = TRUE;
+    }
+    if (w->write(outfp, NULL, &blk) != 0) {
+      goto cleanup;
+    }
+    *offset += 8 + blk.len;
+    crc = combine_crc32c(crc, chunk_crc, len);
+    m->uncompressed_length += len;
+  }
+  if (len < 0) {
+    print_error("Failed to read %s: %s\n", file, strerror(errno));
+    goto cleanup;
+  }
+  m->length = *offset - m->offset;
+  m->crc32c = mask_crc32c(crc);
+  err = 0;
+ cleanup:
+  if (fd != -1) {
+    close(fd);
+  }
+  return err;
+}
+
+int archive_create(const char *archive, int num_files, char **files)
+{
+  const block_writer_t *w = framing2_format.block_writer;
+  directory_t dir = {0, };
+  struct stat outbuf;
+  FILE *outfp;
+  char *uncompressed_data = malloc(MAX_UNCOMPRESSED_DATA_LEN);
+  char *compressed_data = malloc(snappy_max_compressed_length(MAX_UNCOMPRESSED_DATA_LEN));
+  uint64_t offset = STREAM_HEADER_LEN;
+  uint64_t total = 0;
+  int i;
+  int err = 1;
+
+  outfp = fopen(archive, "wb");
+  if (outfp == NULL) {
+    print_error("Failed to open %s for write: %s\n", archive, strerror(errno));
+    goto cleanup;
+  }
+  if (uncompressed_data == NULL || compressed_data == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+  if (fstat(fileno(outfp), &outbuf) != 0) {
+    print_error("Failed to stat %s: %s\n", archive, strerror(errno));
+    goto cleanup;
+  }
+  if (w->begin(outfp, MAX_UNCOMPRESSED_DATA_LEN, NULL) != 0) {
+    goto cleanup;
+  }
+  for (i = 0; i < num_files; i++) {
+    if (add_file(outfp, &dir, files[i], &outbuf, uncompressed_data, compressed_data, &offset) != 0) {
+      goto cleanup;
+    }
+    total += dir.members[dir.num_members - 1].uncompressed_length;
+  }
+  if (write_directory(outfp, &dir, offset) != 0) {
+    goto cleanup;
+  }
+  trace("%lu members: %llu bytes -> %llu bytes\n", (unsigned long)dir.num_members,
+        (unsigned long long)total, (unsigned long long)offset);
+  err = 0;
+ cleanup:
+  if (outfp != NULL) {
+    if (fclose(outfp) != 0 && !err) {
+      print_error("Failed to write %s: %s\n", archive, strerror(errno));
+      err = 1;
+    }
+    if (err) {
+      unlink(archive);
+    }
+  }
+  free(uncompressed_data);
+  free(compressed_data);
+  free_directory(&dir);
+  return err;
+}
+
+int archive_list(const char *archive)
+{
+  directory_t dir = {0, };
+  uint64_t compressed = 0;
+  uint64_t uncompressed = 0;
+  size_t i;
+  int fd;
+  int err = 1;
+
+  fd = open(archive, O_RDONLY | O_BINARY);
+  if (fd == -1) {
+    print_error("Failed to open %s for read: %s\n", archive, strerror(errno));
+    return 1;
+  }
+  if (read_directory(fd, &dir) != 0) {
+    goto cleanup;
+  }
+  printf("%12s %12s  %s\n", "compressed", "uncompressed", "name");
+  for (i = 0; i < dir.num_members; i++) {
+    const member_t *m = &dir.members[i];
+    printf("%12llu %12llu  %s\n", (unsigned long long)m->length,
+           (unsigned long long)m->uncompressed_length, m->name);
+    compressed += m->length;
+    uncompressed += m->uncompressed_length;
+  }
+  printf("%12llu %12llu  (%lu members)\n", (unsigned long long)compressed,
+         (unsigned long long)uncompressed, (unsigned long)dir.num_members);
+  err = 0;
+ cleanup:
+  close(fd);
+  free_directory(&dir);
+  return err;
+}
+
+typedef struct {
+  const char *archive;
+  const directory_t *dir;
+  size_t *selected; /* indexes of members to be extracted */
+  size_t num_selected;
+  int to_stdout;
+  size_t next;
+  int failed;
+#ifdef SNZ_HAVE_THREAD
+  snz_mutex_t mutex;
+#endif
+} extractor_t;
+
+typedef struct {
+  int fd; /* archive */
+  char *buf;
+  size_t buflen;
+  char *uncompressed_data;
+} extract_buffer_t;
+
+static int reserve_buffer(extract_buffer_t *eb, size_t len)
+{
+  if (eb->buflen < len) {
+    char *buf = realloc(eb->buf, len);
+    if (buf == NULL) {
+      print_error("out of memory\n");
+      return -1;
+    }
+    eb->buf = buf;
+    eb->buflen = len;
+  }
+  return 0;
+}
+
+/* uncompress chunks in 'p' and write them to 'outfd' */
+static int extract_chunks(extract_buffer_t *eb, const member_t *m, const char *p, size_t len,
+                          int outfd, uint32_t *crc, uint64_t *uncompressed_length)
+{
+  const char *end = p + len;
+
+  while (p < end) {
+    int id;
+    size_t data_len;
+    const char *data;
+    size_t uncompressed_len;
+    uint32_t chunk_crc;
+
+    if (end - p < 4) {
+      goto broken;
+    }
+    id = (unsigned char)p[0];
+    data_len = snz_get_le(p + 1, 3);
+    if (data_len > (size_t)(end - p - 4)) {
+      goto broken;
+    }
+    switch (id) {
+    case COMPRESSED_DATA_IDENTIFIER:
+      if (data_len < 4) {
+        goto broken;
+      }
+      uncompressed_len = MAX_UNCOMPRESSED_DATA_LEN;
+      if (snappy_uncompress(p + 8, data_len - 4, eb->uncompressed_data, &uncompressed_len)) {
+        print_error("Invalid data in %s: snappy_uncompress failed\n", m->name);
+        return -1;
+      }
+      data = eb->uncompressed_data;
+      break;
+    case UNCOMPRESSED_DATA_IDENTIFIER:
+      if (data_len < 4) {
+        goto broken;
+      }
+      data = p + 8;
+      uncompressed_len = data_len - 4;
+      break;
+    default:
+      if (id < 0x80) {
+        print_error("Unsupported chunk identifier 0x%02x in %s\n", id, m->name);
+        return -1;
+      }
+      /* skippable chunk */
+      p += 4 + data_len;
+      continue;
+    }
+    chunk_crc = ~calculate_crc32c(~0, (const unsigned char *)data, uncompressed_len);
+    if (mask_crc32c(chunk_crc) != snz_get_le(p + 4, 4)) {
+      print_error("CRC32C error in %s\n", m->name);
+      return -1;
+    }
+    if (write_full(outfd, data, uncompressed_len) < 0) {
+      print_error("Failed to write %s: %s\n", m->name, strerror(errno));
+      return -1;
+    }
+    *crc = combine_crc32c(*crc, chunk_crc, uncompressed_len);
+    *uncompressed_length += uncompressed_len;
+    p += 4 + data_len;
+  }
+  return 0;
+ broken:
+  print_error("Invalid chunk in %s\n", m->name);
+  return -1;
+}
+
+static int extract_member(extract_buffer_t *eb, const member_t *m, int outfd)
+{
+  uint64_t offset = m->offset;
+  uint64_t end = m->offset + m->length;
+  uint64_t uncompressed_length = 0;
+  uint32_t crc = 0;
+
+  if (m->length <= MAX_WHOLE_READ_LEN) {
+    if (reserve_buffer(eb, m->length) != 0
+        || pread_full(eb->fd, eb->buf, m->length, offset) != 0
+        || extract_chunks(eb, m, eb->buf, m->length, outfd, &crc, &uncompressed_length) != 0) {
+      return -1;
+    }
+  } else {
+    /* read large members chunk by chunk */
+    while (offset < end) {
+      char header[4];
+      size_t chunk_len;
+
+      if (end - offset < 4 || pread_full(eb->fd, header, 4, offset) != 0) {
+        print_error("Invalid chunk in %s\n", m->name);
+        return -1;
+      }
+      chunk_len = 4 + snz_get_le(header + 1, 3);
+      if (chunk_len > end - offset) {
+        print_error("Invalid chunk in %s\n", m->name);
+        return -1;
+      }
+      if (reserve_buffer(eb, chunk_len) != 0
+          || pread_full(eb->fd, eb->buf, chunk_len, offset) != 0
+          || extract_chunks(eb, m, eb->buf, chunk_len, outfd, &crc, &uncompressed_length) != 0) {
+        return -1;
+      }
+      offset += chunk_len;
+    }
+  }
+  if (uncompressed_length != m->uncompressed_length || mask_crc32c(crc) != m->crc32c) {
+    print_error("CRC32C error in %s\n", m->name);
+    return -1;
+  }
+  return 0;
+}
+
+static void make_parent_directories(const char *name)
+{
+  char path[PATH_MAX];
+  char *p;
+
+  if (strlen(name) >= sizeof(path)) {
+    return;
+  }
+  strcpy(path, name);
+  for (p = path + 1; *p != '\0'; p++) {
+    if (*p == '/' || *p == PATH_DELIMITER) {
+      char c = *p;
+      *p = '\0';
+      mkdir(path, 0777);
+      *p = c;
+    }
+  }
+}
+
+static int extract_file(extract_buffer_t *eb, const member_t *m)
+{
+  struct utimbuf times;
+  int outfd;
+
+  if (!is_safe_name(m->name)) {
+    print_error("%s: unsafe file name\n", m->name);
+    return -1;
+  }
+  outfd = open(m->name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, m->mode & 0777);
+  if (outfd == -1 && errno == ENOENT) {
+    make_parent_directories(m->name);
+    outfd = open(m->name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, m->mode & 0777);
+  }
+  if (outfd == -1) {
+    print_error("Failed to open %s for write: %s\n", m->name, strerror(errno));
+    return -1;
+  }
+  if (extract_member(eb, m, outfd) != 0) {
+    close(outfd);
+    unlink(m->name);
+    return -1;
+  }
+  if (close(outfd) != 0) {
+    print_error("Failed to write %s: %s\n", m->name, strerror(errno));
+    unlink(m->name);
+    return -1;
+  }
+  times.actime = m->mtime;
+  times.modtime = m->mtime;
+  utime(m->name, &times);
+  return 0;
+}
+
+static void set_failed(extractor_t *ex)
+{
+#ifdef SNZ_HAVE_THREAD
+  snz_mutex_lock(&ex->mutex);
+#endif
+  ex->failed = TRUE;
+#ifdef SNZ_HAVE_THREAD
+  snz_mutex_unlock(&ex->mutex);
+#endif
+}
+
+/* extract members one by one until all selected members are taken */
+static SNZ_THREAD_FUNC(extractor_main, arg)
+{
+  extractor_t *ex = (extractor_t *)arg;
+  extract_buffer_t eb = {-1, };
+
+  eb.fd = open(ex->archive, O_RDONLY | O_BINARY);
+  eb.uncompressed_data = malloc(MAX_UNCOMPRESSED_DATA_LEN);
+  if (eb.fd == -1 || eb.uncompressed_data == NULL) {
+    print_error("Failed to open %s for read: %s\n", ex->archive, strerror(errno));
+    set_failed(ex);
+    goto cleanup;
+  }
+  for (;;) {
+    const member_t *m;
+    int rv;
+
+#ifdef SNZ_HAVE_THREAD
+    snz_mutex_lock(&ex->mutex);
+#endif
+    m = (ex->next < ex->num_selected && !ex->failed) ? &ex->dir->members[ex->selected[ex->next++]] : NULL;
+#ifdef SNZ_HAVE_THREAD
+    snz_mutex_unlock(&ex->mutex);
+#endif
+    if (m == NULL) {
+      break;
+    }
+    rv = ex->to_stdout ? extract_member(&eb, m, 1) : extract_file(&eb, m);
+    if (rv != 0) {
+      set_failed(ex);
+    }
+  }
+ cleanup:
+  if (eb.fd != -1) {
+    close(eb.fd);
+  }
+  free(eb.buf);
+  free(eb.uncompressed_data);
+  SNZ_THREAD_RETURN;
+}
+
+int archive_extract(const char *archive, int num_names, char **names, int to_stdout)
+{
+  directory_t dir = {0, };
+  extractor_t ex = {0, };
+  size_t num_threads = 1;
+  size_t i;
+  int fd;
+  int err = 1;
+
+  fd = open(archive, O_RDONLY | O_BINARY);
+  if (fd == -1) {
+    print_error("Failed to open %s for read: %s\n", archive, strerror(errno));
+    return 1;
+  }
+  if (read_directory(fd, &dir) != 0) {
+    goto cleanup;
+  }
+  ex.archive = archive;
+  ex.dir = &dir;
+  ex.to_stdout = to_stdout;
+  ex.selected = malloc((num_names > 0 ? num_names : dir.num_members + 1) * sizeof(size_t));
+  if (ex.selected == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+  if (num_names > 0) {
+    int n;
+    for (n = 0; n < num_names; n++) {
+      for (i = 0; i < dir.num_members; i++) {
+        if (strcmp(dir.members[i].name, names[n]) == 0) {
+          break;
+        }
+      }
+      if (i == dir.num_members) {
+        print_error("%s: not found in %s\n", names[n], archive);
+        goto cleanup;
+      }
+      ex.selected[ex.num_selected++] = i;
+    }
+  } else {
+    for (i = 0; i < dir.num_members; i++) {
+      ex.selected[ex.num_selected++] = i;
+    }
+  }
+
+#ifdef SNZ_HAVE_THREAD
+  /* members are written to standard output in order */
+  if (!to_stdout) {
+    num_threads = num_cpus();
+    if (num_threads > ex.num_selected) {
+      num_threads = ex.num_selected;
+    }
+  }
+  snz_mutex_init(&ex.mutex);
+  if (num_threads > 1) {
+    snz_thread_t *threads = malloc(num_threads * sizeof(snz_thread_t));
+    size_t num_started = 0;
+
+    while (threads != NULL && num_started < num_threads
+           && snz_thread_create(&threads[num_started], extractor_main, &ex) == 0) {
+      num_started++;
+    }
+    if (num_started == 0) {
+      extractor_main(&ex);
+      num_threads = 1;
+    } else {
+      num_threads = num_started;
+    }
+    for (i = 0; i < num_started; i++) {
+      snz_thread_join(threads[i]);
+    }
+    free(threads);
+  } else {
+    extractor_main(&ex);
+  }
+  snz_mutex_destroy(&ex.mutex);
+#else
+  extractor_main(&ex);
+#endif
+  trace("extract %lu members with %lu threads\n", (unsigned long)ex.num_selected, (unsigned long)num_threads);
+  if (ex.failed) {
+    goto cleanup;
+  }
+  err = 0;
+ cleanup:
+  close(fd);
+  free(ex.selected);
+  free_directory(&dir);
+  return err;
+}
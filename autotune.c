@@ -0,0 +1,366 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <snappy-c.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+#if defined HAVE_SYS_VFS_H && defined HAVE_FSTATFS
+#include <sys/vfs.h>
+#endif
+#include "snzip.h"
+#include "crc32.h"
+#ifdef WIN32
+#define fstat _fstati64
+#define stat _stati64
+#endif
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
+#ifndef S_ISFIFO
+#ifdef S_IFIFO
+#define S_ISFIFO(mode) (((mode) & S_IFMT) == S_IFIFO)
+#else
+#define S_ISFIFO(mode) 0
+#endif
+#endif
+
+/*
+ * --autotune chooses the block size and the stdio buffer sizes (-b, -R
+ * and -W) from the environment instead of fixed defaults.
+ *
+ * Buffer sizes: reads and writes of pipes are limited by the pipe
+ * capacity. Local files get at least the default readahead window and
+ * network file systems, whose st_blksize is often the transfer size, at
+ * least 1 MiB so that one request moves as much as possible.
+ *
+ * Block size: larger blocks reduce per-block overhead, but the input,
+ * output and snappy's hash table of a block should stay in the L2 cache.
+ * The block size is the largest power of two fitting there within the
+ * limit of the format. --autotune=calibrate instead compresses the head
+ * of a regular input file with each candidate size and picks the fastest.
+ */
+int autotune_mode;
+
+#define LOCAL_BUFFER_SIZE (128 * 1024) /* default readahead window of Linux */
+#define REMOTE_BUFFER_SIZE (1024 * 1024)
+#define MAX_BUFFER_SIZE (8 * 1024 * 1024)
+#define DEFAULT_PIPE_SIZE (64 * 1024)
+#define SNAPPY_WORKING_SET (64 * 1024) /* hash table and fragment of snappy */
+#define MAX_CANDIDATE_BLOCK_SIZE (4 * 1024 * 1024)
+#define CALIBRATION_SAMPLE_LEN (8 * 1024 * 1024)
+#define CALIBRATION_ROUNDS 3
+
+#if defined HAVE_SYS_VFS_H && defined HAVE_FSTATFS
+static const struct {
+  unsigned long magic;
+  const char *name;
+  int remote;
+} fs_types[] = {
+  {0xEF53, "ext4", FALSE},
+  {0x58465342, "xfs", FALSE},
+  {0x9123683E, "btrfs", FALSE},
+  {0x2FC12FC1, "zfs", FALSE},
+  {0x01021994, "tmpfs", FALSE},
+  {0x794C7630, "overlayfs", FALSE},
+  {0xF2F52010, "f2fs", FALSE},
+  {0x6969, "nfs", TRUE},
+  {0x517B, "smb", TRUE},
+  {0xFF534D42, "cifs", TRUE},
+  {0xFE534D42, "smb2", TRUE},
+  {0x00C36400, "ceph", TRUE},
+  {0x01021997, "9p", TRUE},
+  {0x65735546, "fuse", TRUE},
+  {0, NULL, FALSE},
+};
+#endif
+
+/* name of the file system of 'fd' and whether it is on network */
+static const char *fs_type(int fd, int *remote)
+{
+#if defined HAVE_SYS_VFS_H && defined HAVE_FSTATFS
+  struct statfs sfs;
+  int i;
+
+  if (fstatfs(fd, &sfs) == 0) {
+    for (i = 0; fs_types[i].name != NULL; i++) {
+      if ((unsigned long)(unsigned int)sfs.f_type == fs_types[i].magic) {
+        *remote = fs_types[i].remote;
+        return fs_types[i].name;
+      }
+    }
+  }
+#endif
+  *remote = FALSE;
+  return "unknown fs";
+}
+
+size_t autotune_buffer_size(int fd, const char *name)
+{
+  struct stat sbuf;
+  size_t size;
+
+  if (fstat(fd, &sbuf) != 0) {
+    return 0;
+  }
+  if (S_ISFIFO(sbuf.st_mode)) {
+#ifdef F_GETPIPE_SZ
+    int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+    size = pipe_size > 0 ? pipe_size : DEFAULT_PIPE_SIZE;
+#else
+    size = DEFAULT_PIPE_SIZE;
+#endif
+    trace("autotune: %s is a pipe (%lu bytes)\n", name, (unsigned long)size);
+    return size;
+  }
+  if (S_ISREG(sbuf.st_mode)) {
+    size_t blksize = 4096;
+    int remote;
+    const char *fs = fs_type(fd, &remote);
+
+#ifndef WIN32
+    if (sbuf.st_blksize > 0) {
+      blksize = sbuf.st_blksize;
+    }
+#endif
+    size = remote ? REMOTE_BUFFER_SIZE : LOCAL_BUFFER_SIZE;
+    if (size < blksize) {
+      size = blksize;
+    }
+    size = (size + blksize - 1) / blksize * blksize;
+    if (size > MAX_BUFFER_SIZE) {
+      size = MAX_BUFFER_SIZE;
+    }
+    trace("autotune: %s is a regular file on %s (st_blksize %lu)\n", name, fs, (unsigned long)blksize);
+    return size;
+  }
+  /* terminals and devices */
+  trace("autotune: %s is neither a pipe nor a regular file\n", name);
+  return 0;
+}
+
+/* size in bytes written in the sysfs file such as "1024K" */
+static size_t read_cache_size(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  unsigned long size = 0;
+  char unit = '\0';
+
+  if (fp == NULL) {
+    return 0;
+  }
+  if (fscanf(fp, "%lu%c", &size, &unit) >= 1) {
+    if (unit == 'K') {
+      size *= 1024;
+    } else if (unit == 'M') {
+      size *= 1024 * 1024;
+    }
+  }
+  fclose(fp);
+  return size;
+}
+
+/* sizes of the L2 and L3 caches of the first CPU. zero when unknown. */
+static void cache_sizes(size_t *l2, size_t *l3)
+{
+  int idx;
+
+  *l2 = *l3 = 0;
+  for (idx = 0; idx < 8; idx++) {
+    char path[128];
+    FILE *fp;
+    int level = 0;
+    char type[16] = "";
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", idx);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+      break;
+    }
+    if (fscanf(fp, "%d", &level) != 1) {
+      level = 0;
+    }
+    fclose(fp);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", idx);
+    fp = fopen(path, "r");
+    if (fp != NULL) {
+      if (fscanf(fp, "%15s", type) != 1) {
+        type[0] = '\0';
+      }
+      fclose(fp);
+    }
+    if (strcmp(type, "Instruction") == 0 || (level != 2 && level != 3)) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", idx);
+    *(level == 2 ? l2 : l3) = read_cache_size(path);
+  }
+#if defined _SC_LEVEL2_CACHE_SIZE && defined _SC_LEVEL3_CACHE_SIZE
+  if (*l2 == 0 && *l3 == 0) {
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    *l2 = size > 0 ? size : 0;
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    *l3 = size > 0 ? size : 0;
+  }
+#endif
+}
+
+/* seconds to compress 'len' bytes of 'data' in blocks of 'block_size' */
+static double measure(const block_writer_t *w, const char *data, size_t len, size_t block_size, char *out)
+{
+  double best = 0;
+  int round;
+
+  for (round = 0; round < CALIBRATION_ROUNDS; round++) {
+    double start = current_time();
+    double elapsed;
+    size_t pos;
+
+    for (pos = 0; pos < len; pos += block_size) {
+      size_t n = (len - pos < block_size) ? len - pos : block_size;
+      size_t out_len = snappy_max_compressed_length(block_size);
+
+      snappy_compress(data + pos, n, out, &out_len);
+      if (w->need_crc) {
+        masked_crc32c(data + pos, n);
+      }
+    }
+    elapsed = current_time() - start;
+    if (round == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+/* compress the head of 'fd' in candidate block sizes and return the fastest one */
+static size_t calibrate(const block_writer_t *w, int fd, size_t min_size, size_t max_size)
+{
+  struct stat sbuf;
+  size_t len;
+  char *data = NULL;
+  char *out = NULL;
+  size_t size;
+  size_t best_size = 0;
+  double best_time = 0;
+
+  if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode)) {
+    trace("autotune: calibration needs a regular input file\n");
+    return 0;
+  }
+  len = (sbuf.st_size < CALIBRATION_SAMPLE_LEN) ? (size_t)sbuf.st_size : CALIBRATION_SAMPLE_LEN;
+  if (len < 2 * min_size) {
+    trace("autotune: input is too short to calibrate\n");
+    return 0;
+  }
+  data = malloc(len);
+  out = malloc(snappy_max_compressed_length(max_size));
+  if (data == NULL || out == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+  if (pread_full(fd, data, len, 0) != 0) {
+    goto cleanup;
+  }
+  for (size = min_size; size <= max_size && size * 2 <= len; size *= 2) {
+    double elapsed = measure(w, data, len, size, out);
+
+    trace("autotune: block size %lu: %.1f MB/s\n", (unsigned long)size, len / elapsed / 1e6);
+    /* Prefer smaller blocks unless larger ones are 3% faster. */
+    if (best_size == 0 || elapsed < best_time * 0.97) {
+      best_size = size;
+      best_time = elapsed;
+    }
+  }
+ cleanup:
+  free(data);
+  free(out);
+  return best_size;
+}
+
+size_t autotune_block_size(const stream_format_t *fmt, int infd)
+{
+  const block_writer_t *w = fmt->block_writer;
+  size_t l2, l3;
+  size_t max_size;
+  size_t size;
+
+  if (w == NULL || w->max_uncompressed_len <= w->block_size) {
+    trace("autotune: %s format doesn't allow larger blocks\n", fmt->name);
+    return 0;
+  }
+  max_size = writer_block_size(w, MAX_CANDIDATE_BLOCK_SIZE);
+  if (autotune_mode == AUTOTUNE_CALIBRATE) {
+    size = calibrate(w, infd, w->block_size, max_size);
+    if (size != 0) {
+      return size;
+    }
+  }
+
+  cache_sizes(&l2, &l3);
+  trace("autotune: L2 cache %lu bytes, L3 cache %lu bytes\n", (unsigned long)l2, (unsigned long)l3);
+  if (l2 == 0) {
+    /* a share of the L3 cache by a core */
+    l2 = l3 / 4;
+  }
+  if (l2 == 0) {
+    return w->block_size;
+  }
+  /* uncompressed and compressed data of a block and snappy's working set */
+  size = w->block_size;
+  while (size * 2 <= max_size && (size * 2) * 2 + SNAPPY_WORKING_SET <= l2) {
+    size *= 2;
+  }
+  return size;
+}
+
+void autotune_print(const char *name, size_t block_size, size_t rsize, size_t wsize)
+{
+  fprintf(stderr, "autotune %s:", name);
+  if (block_size != 0) {
+    fprintf(stderr, " -b %lu", (unsigned long)block_size);
+  }
+  if (rsize != 0) {
+    fprintf(stderr, " -R %lu", (unsigned long)rsize);
+  }
+  if (wsize != 0) {
+    fprintf(stderr, " -W %lu", (unsigned long)wsize);
+  }
+  fprintf(stderr, "\n");
+}
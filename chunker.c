@@ -0,0 +1,321 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include "snzip.h"
+
+/*
+ * Block boundaries of compressors.
+ *
+ * Blocks are cut at fixed offsets by default. With --rsyncable, they
+ * end where a gear hash over the last 64 bytes hits a boundary so that
+ * inserting or removing bytes changes only blocks around there.
+ *
+ * The gear hash is updated by 'h = (h << 1) + gear[byte]', a single
+ * lea instruction per byte, and can't be vectorized because of the
+ * dependency chain. Instead, boundaries aren't searched in the first
+ * half of the maximum block size and appear every 1/8 of it on average
+ * after that. Only about one fifth of the input is hashed and blocks
+ * don't get too short. Blocks reach the maximum size with probability
+ * exp(-4) when no boundary is found.
+ *
+ * With --align-records, blocks end at the last record delimiter before
+ * the maximum block size so that each block starts at a record. A
+ * record longer than the maximum block size is split. The delimiter is
+ * searched backward by memrchr(), which is vectorized by glibc.
+ *
+ * With --adaptive-blocks, the block length is changed between 16 KiB
+ * and the maximum block size by hill climbing. Time from returning a
+ * block to the next call, which includes compressing and writing it,
+ * and the compressed length are summed over a window of a few MiB.
+ * A length is better when it is faster by 3%, or as fast within 3% and
+ * compresses better by 1%. The neighbor lengths are tried in one
+ * direction while they get better, then in the other direction when
+ * the first move was worse. The best length is kept for a while and
+ * measured again because data may change.
+ *
+ * Bytes after the boundary are kept at the end of the caller's buffer
+ * and moved to the head on the next call. Callers must not modify the
+ * buffer between calls.
+ */
+#define GEAR_WINDOW 64 /* bytes affecting the hash */
+#define MIN_RSYNCABLE_SIZE 1024
+#define ADAPTIVE_MIN_LEN (16 * 1024)
+#define ADAPTIVE_START_LEN (64 * 1024)
+#define ADAPTIVE_WINDOW (4 * 1024 * 1024) /* bytes to measure a block length at least */
+#define ADAPTIVE_WINDOW_BLOCKS 8 /* blocks to measure a block length at least */
+#define ADAPTIVE_STABLE_WINDOWS 16
+
+int rsyncable;
+const char *record_delimiter;
+size_t record_delimiter_len;
+int adaptive_blocks;
+
+static uint64_t gear[256];
+
+static void init_gear(void)
+{
+  /* splitmix64 with a fixed seed. Don't change it to keep boundaries. */
+  uint64_t x = 0x736e7a6970ull;
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    gear[i] = z ^ (z >> 31);
+  }
+}
+
+void chunker_init(chunker_t *ch)
+{
+  memset(ch, 0, sizeof(*ch));
+  if (rsyncable && gear[0] == 0) {
+    init_gear();
+  }
+}
+
+void chunker_report(const chunker_t *ch)
+{
+  if (rsyncable) {
+    trace("rsyncable: %llu blocks, %llu cut by content\n",
+          (unsigned long long)ch->num_blocks, (unsigned long long)ch->num_cuts);
+  }
+  if (record_delimiter != NULL) {
+    trace("align-records: %llu blocks, %llu cut at delimiters\n",
+          (unsigned long long)ch->num_blocks, (unsigned long long)ch->num_cuts);
+  }
+  if (adaptive_blocks) {
+    trace("adaptive-blocks: %llu blocks, the last block length %lu\n",
+          (unsigned long long)ch->num_blocks, (unsigned long)ch->block_len);
+  }
+}
+
+/* return the end of the first content-defined block in data[0..len) or len */
+static size_t find_boundary(const unsigned char *data, size_t len, size_t size)
+{
+  size_t min_len = size / 2;
+  int bits = 0;
+  uint64_t mask;
+  uint64_t h = 0;
+  size_t i;
+
+  if (len <= min_len) {
+    return len;
+  }
+  /* boundaries appear every 2^bits bytes on average after 'min_len'. */
+  while (((size_t)1 << (bits + 1)) <= size / 8) {
+    bits++;
+  }
+  mask = ~(uint64_t)0 << (64 - bits);
+  for (i = min_len - GEAR_WINDOW; i < min_len; i++) {
+    h = (h << 1) + gear[data[i]];
+  }
+  for (; i < len; i++) {
+    h = (h << 1) + gear[data[i]];
+    if ((h & mask) == 0) {
+      return i + 1;
+    }
+  }
+  return len;
+}
+
+#ifndef HAVE_MEMRCHR
+static void *memrchr(const void *s, int c, size_t n)
+{
+  const unsigned char *p = (const unsigned char *)s + n;
+
+  while (p > (const unsigned char *)s) {
+    if (*--p == (unsigned char)c) {
+      return (void *)p;
+    }
+  }
+  return NULL;
+}
+#endif
+
+/* return the end of the last record delimiter in data[0..len) or len */
+static size_t find_record_end(const char *data, size_t len)
+{
+  const size_t dlen = record_delimiter_len;
+  const char last = record_delimiter[dlen - 1];
+  size_t end = len;
+
+  while (end >= dlen) {
+    /* the last byte of the delimiter at data[dlen - 1] or later */
+    const char *p = memrchr(data + dlen - 1, last, end - (dlen - 1));
+    if (p == NULL) {
+      break;
+    }
+    if (memcmp(p - (dlen - 1), record_delimiter, dlen - 1) == 0) {
+      return p - data + 1;
+    }
+    end = p - data;
+  }
+  return len;
+}
+
+static size_t neighbor_len(const chunker_t *ch, size_t len, int direction)
+{
+  if (direction > 0) {
+    return (len * 2 < ch->max_len) ? len * 2 : ch->max_len;
+  } else {
+    return (len / 2 > ch->min_len) ? len / 2 : ch->min_len;
+  }
+}
+
+static void settle(chunker_t *ch)
+{
+  ch->block_len = ch->best_len;
+  ch->stable = ADAPTIVE_STABLE_WINDOWS;
+  trace("adaptive-blocks: keep %lu-byte blocks\n", (unsigned long)ch->block_len);
+}
+
+/* try the next length from the best one or settle on it */
+static void try_next(chunker_t *ch)
+{
+  size_t next = neighbor_len(ch, ch->best_len, ch->direction);
+
+  if (next == ch->best_len && !ch->turned && !ch->improved) {
+    ch->direction = -ch->direction;
+    ch->turned = TRUE;
+    next = neighbor_len(ch, ch->best_len, ch->direction);
+  }
+  if (next == ch->best_len) {
+    settle(ch);
+    return;
+  }
+  ch->block_len = next;
+  trace("adaptive-blocks: try %lu-byte blocks\n", (unsigned long)ch->block_len);
+}
+
+/* called when a window of the current block length is measured */
+static void adapt_block_len(chunker_t *ch)
+{
+  double cost = ch->window_time / ch->window_in;
+  double ratio = (double)ch->window_out / ch->window_in;
+
+  trace("adaptive-blocks: %lu-byte blocks: %.1f MB/s, ratio %.3f\n",
+        (unsigned long)ch->block_len, cost > 0 ? 1e-6 / cost : 0.0, ratio);
+  ch->window_time = 0;
+  ch->window_in = 0;
+  ch->window_out = 0;
+
+  if (ch->stable > 0) {
+    if (--ch->stable > 0) {
+      return;
+    }
+    /* measure neighbors again */
+    ch->best_len = 0;
+  }
+  if (ch->best_len == 0) {
+    ch->direction = 1;
+    ch->turned = FALSE;
+    ch->improved = FALSE;
+  } else if (cost < ch->best_cost * 0.97 || (cost < ch->best_cost * 1.03 && ratio < ch->best_ratio * 0.99)) {
+    ch->improved = TRUE;
+  } else {
+    if (ch->turned || ch->improved) {
+      settle(ch);
+      return;
+    }
+    ch->direction = -ch->direction;
+    ch->turned = TRUE;
+    try_next(ch);
+    return;
+  }
+  ch->best_len = ch->block_len;
+  ch->best_cost = cost;
+  ch->best_ratio = ratio;
+  try_next(ch);
+}
+
+static size_t read_adaptive_block(chunker_t *ch, char *buf, size_t size, FILE *fp)
+{
+  size_t len;
+
+  if (ch->block_len == 0) {
+    ch->max_len = size;
+    ch->min_len = (size < ADAPTIVE_MIN_LEN) ? size : ADAPTIVE_MIN_LEN;
+    ch->block_len = (size < ADAPTIVE_START_LEN) ? size : ADAPTIVE_START_LEN;
+  } else {
+    ch->window_time += current_time() - ch->start;
+    if (ch->window_in >= ADAPTIVE_WINDOW && ch->window_in >= ADAPTIVE_WINDOW_BLOCKS * ch->block_len) {
+      adapt_block_len(ch);
+    }
+  }
+  len = fread(buf, 1, ch->block_len, fp);
+  if (len > 0) {
+    ch->num_blocks++;
+  }
+  ch->window_in += len;
+  ch->start = current_time();
+  return len;
+}
+
+void chunker_add_output(chunker_t *ch, size_t compressed_len)
+{
+  ch->window_out += compressed_len;
+}
+
+size_t chunker_read(chunker_t *ch, char *buf, size_t size, FILE *fp)
+{
+  size_t len;
+  size_t cut;
+
+  if (adaptive_blocks) {
+    return read_adaptive_block(ch, buf, size, fp);
+  }
+  if (rsyncable ? size < MIN_RSYNCABLE_SIZE : record_delimiter == NULL) {
+    return fread(buf, 1, size, fp);
+  }
+  if (ch->carry_len > 0) {
+    memmove(buf, buf + ch->carry_offset, ch->carry_len);
+  }
+  len = ch->carry_len + fread(buf + ch->carry_len, 1, size - ch->carry_len, fp);
+  if (rsyncable) {
+    cut = find_boundary((const unsigned char *)buf, len, size);
+  } else {
+    /* a short read means the end of file. */
+    cut = (len == size) ? find_record_end(buf, len) : len;
+  }
+  if (cut < len) {
+    ch->num_cuts++;
+  }
+  if (cut > 0) {
+    ch->num_blocks++;
+  }
+  ch->carry_offset = cut;
+  ch->carry_len = len - cut;
+  return cut;
+}
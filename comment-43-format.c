@@ -72,7 +72,7 @@ typedef struct {
  */
 static int read_block(FILE *fp, block_data_t *bd);
 
-static stream_state_t process_block(FILE *fp, stream_state_t state, block_data_t *bd, char *work, size_t work_len);
+static stream_state_t process_block(crc_verifier_t *cv, stream_state_t state, block_data_t *bd, size_t work_len);
 
 static int comment_43_compress(FILE *infp, FILE *outfp, size_t block_size)
 {
@@ -82,12 +82,14 @@ static int comment_43_compress(FILE *infp, FILE *outfp, size_t block_size)
   size_t compressed_data_len;
   char *raw_data = malloc(max_raw_data_len);
   char *compressed_data = malloc(max_compressed_data_len);
+  incompressible_detector_t detector;
   int err = 1;
 
   if (raw_data == NULL || compressed_data == NULL) {
     print_error("out of memory\n");
     goto cleanup;
   }
+  incompressible_detector_init(&detector);
 
   putc(HEADER_TYPE_CODE, outfp);
   putc(MAGIC_LEN, outfp);
@@ -101,9 +103,14 @@ static int comment_43_compress(FILE *infp, FILE *outfp, size_t block_size)
     size_t write_len;
     const char *write_data;
 
-    /* compress the block. */
-    compressed_data_len = max_compressed_data_len;
-    snappy_compress(raw_data, raw_data_len, compressed_data, &compressed_data_len);
+    /* compress the block unless it is detected as incompressible. */
+    if (is_incompressible(&detector, raw_data, raw_data_len)) {
+      compressed_data_len = raw_data_len;
+    } else {
+      compressed_data_len = max_compressed_data_len;
+      snappy_compress(raw_data, raw_data_len, compressed_data, &compressed_data_len);
+    }
+    incompressible_detector_update(&detector, raw_data_len, compressed_data_len);
 
     if (compressed_data_len >= (raw_data_len - (raw_data_len / 8))) {
       /* write uncompressed data */
@@ -137,6 +144,7 @@ static int comment_43_compress(FILE *infp, FILE *outfp, size_t block_size)
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  incompressible_detector_report(&detector);
   putc(END_OF_STREAM_TYPE_CODE, outfp);
   putc(0, outfp);
   putc(0, outfp);
@@ -156,20 +164,28 @@ static int comment_43_uncompress(FILE *infp, FILE *outfp, int skip_magic)
 {
   block_data_t *block_data = malloc(sizeof(block_data_t));
   size_t work_len = snappy_max_compressed_length(UINT16_MAX); /* length of worst case */
-  char *work = malloc(work_len);
+  crc_verifier_t *cv = NULL;
   int err = 1;
   stream_state_t state = skip_magic ? PROCESSING_STATE : INITIAL_STATE;
 
-  if (block_data == NULL || work == NULL) {
+  if (block_data == NULL) {
     print_error("out of memory\n");
     goto cleanup;
   }
+  /* Checksums are verified and uncompressed data are written by
+   * the crc verifier while the next block is uncompressed.
+   */
+  cv = crc_verifier_create(outfp, work_len);
+  if (cv == NULL) {
+    goto cleanup;
+  }
 
   while (state != ERROR_STATE) {
     switch (read_block(infp, block_data)) {
     case EOF:
       if (state == END_OF_STREAM_STATE) {
-        err = 0; /* success */
+        err = crc_verifier_finish(cv) ? 1 : 0;
+        cv = NULL;
         goto cleanup;
       }
       /* FALLTHROUGH */
@@ -181,11 +197,13 @@ static int comment_43_uncompress(FILE *infp, FILE *outfp, int skip_magic)
       }
       goto cleanup;
     }
-    state = process_block(outfp, state, block_data, work, work_len);
+    state = process_block(cv, state, block_data, work_len);
   }
  cleanup:
+  if (cv != NULL) {
+    crc_verifier_finish(cv);
+  }
   free(block_data);
-  free(work);
   return err;
 }
 
@@ -219,9 +237,10 @@ static int read_block(FILE *fp, block_data_t *bd)
   return SUCCESS;
 }
 
-static stream_state_t process_block(FILE *fp, stream_state_t state, block_data_t *bd, char *work, size_t work_len)
+static stream_state_t process_block(crc_verifier_t *cv, stream_state_t state, block_data_t *bd, size_t work_len)
 {
   unsigned int crc32c;
+  char *work;
   size_t outlen;
 
   switch (state) {
@@ -256,18 +275,14 @@ static stream_state_t process_block(FILE *fp, stream_state_t state, block_data_t
       crc32c |= ((unsigned char)bd->data[2] << 16);
       crc32c |= ((unsigned char)bd->data[3] << 24);
 
-      /* uncompress and write */
+      /* uncompress and pass it to the crc verifier */
+      work = crc_verifier_buffer(cv);
       outlen = work_len;
       if (snappy_uncompress(bd->data + 4, bd->data_len - 4, work, &outlen)) {
         print_error("Invalid data: RawUncompress failed\n");
         return ERROR_STATE;
       }
-      if (crc32c != masked_crc32c(work, outlen)) {
-        print_error("Invalid data: CRC32c error\n");
-        return ERROR_STATE;
-      }
-      if (fwrite(work, outlen, 1, fp) != 1) {
-        print_error("Failed to write: %s\n", strerror(errno));
+      if (crc_verifier_submit(cv, work, outlen, crc32c, 0, outlen) != 0) {
         return ERROR_STATE;
       }
       break;
@@ -281,12 +296,10 @@ static stream_state_t process_block(FILE *fp, stream_state_t state, block_data_t
       crc32c |= ((unsigned char)bd->data[2] << 16);
       crc32c |= ((unsigned char)bd->data[3] << 24);
 
-      if (crc32c != masked_crc32c(bd->data + 4, bd->data_len - 4)) {
-        print_error("Invalid data: CRC32c error\n");
-        return ERROR_STATE;
-      }
-      if (fwrite(bd->data + 4, bd->data_len - 4, 1, fp) != 1) {
-        print_error("Failed to write: %s\n", strerror(errno));
+      /* The block data is overwritten by the next block. */
+      work = crc_verifier_buffer(cv);
+      memcpy(work, bd->data + 4, bd->data_len - 4);
+      if (crc_verifier_submit(cv, work, bd->data_len - 4, crc32c, 0, bd->data_len - 4) != 0) {
         return ERROR_STATE;
       }
       break;
@@ -0,0 +1,139 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <snappy-c.h>
+#include "snzip.h"
+#include "crc32.h"
+
+/*
+ * Blocks filling one byte value, such as zero pages in database dumps
+ * and VM images.
+ *
+ * When compressing, the compressed data and the checksum of such a
+ * block are kept as a template and reused while following blocks
+ * have the same byte value and length.
+ *
+ * When uncompressing, a block whose uncompressed data are constant is
+ * kept as a template. Following blocks with the same compressed data
+ * are written by memset() without snappy_uncompress().
+ */
+#define MAX_TEMPLATE_LEN 65536 /* maximum compressed length of templates when uncompressing */
+
+void constant_block_init(constant_block_t *cb)
+{
+  memset(cb, 0, sizeof(*cb));
+  cb->byte = -1;
+}
+
+void constant_block_free(constant_block_t *cb)
+{
+  free(cb->compressed);
+  cb->compressed = NULL;
+}
+
+/* TRUE when all bytes in 'data' are same. memcmp() is vectorized by libc. */
+static int is_constant(const char *data, size_t len)
+{
+  return len > 0 && data[0] == data[len - 1] && memcmp(data, data + 1, len - 1) == 0;
+}
+
+static int reserve_template(constant_block_t *cb, size_t len)
+{
+  if (cb->max_compressed_len < len) {
+    char *buf = realloc(cb->compressed, len);
+    if (buf == NULL) {
+      return -1;
+    }
+    cb->compressed = buf;
+    cb->max_compressed_len = len;
+  }
+  return 0;
+}
+
+const constant_block_t *find_constant_block(constant_block_t *cb, const char *data, size_t len)
+{
+  if (!is_constant(data, len)) {
+    return NULL;
+  }
+  if (cb->byte != (unsigned char)data[0] || cb->len != len) {
+    size_t compressed_len = snappy_max_compressed_length(len);
+
+    if (reserve_template(cb, compressed_len) != 0) {
+      /* compress it as usual */
+      return NULL;
+    }
+    snappy_compress(data, len, cb->compressed, &compressed_len);
+    cb->byte = (unsigned char)data[0];
+    cb->len = len;
+    cb->compressed_len = compressed_len;
+    cb->crc32c = masked_crc32c(data, len);
+  }
+  cb->num_hits++;
+  return cb;
+}
+
+int uncompress_constant_block(constant_block_t *cb, const char *compressed, size_t compressed_len,
+                              char *uncompressed, size_t *uncompressed_len)
+{
+  if (cb->byte == -1 || cb->compressed_len != compressed_len || cb->len > *uncompressed_len
+      || memcmp(cb->compressed, compressed, compressed_len) != 0) {
+    return FALSE;
+  }
+  memset(uncompressed, cb->byte, cb->len);
+  *uncompressed_len = cb->len;
+  cb->num_hits++;
+  return TRUE;
+}
+
+void constant_block_report(const constant_block_t *cb)
+{
+  trace("constant blocks: %llu\n", (unsigned long long)cb->num_hits);
+}
+
+void remember_constant_block(constant_block_t *cb, const char *compressed, size_t compressed_len,
+                             const char *uncompressed, size_t uncompressed_len)
+{
+  if (compressed_len > MAX_TEMPLATE_LEN || !is_constant(uncompressed, uncompressed_len)) {
+    return;
+  }
+  if (reserve_template(cb, compressed_len) != 0) {
+    return;
+  }
+  memcpy(cb->compressed, compressed, compressed_len);
+  cb->byte = (unsigned char)uncompressed[0];
+  cb->len = uncompressed_len;
+  cb->compressed_len = compressed_len;
+  cb->crc32c = masked_crc32c(uncompressed, uncompressed_len);
+}
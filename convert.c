@@ -0,0 +1,214 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <snappy-c.h>
+#include "snzip.h"
+#include "crc32.h"
+
+/*
+ * Convert a compressed file to another format.
+ *
+ * Every format except raw wraps independent snappy compressed blocks.
+ * A block is moved to the target format as it is when it fits in the
+ * target's limits. Otherwise, or when it is stored uncompressed and the
+ * target has no stored blocks, it is uncompressed and compressed again
+ * in pieces fitting in the target.
+ *
+ * A block is also uncompressed without recompression when a checksum
+ * must be calculated for the target or when a checksum in the source
+ * would be dropped. Checksums in the source are verified whenever
+ * blocks are uncompressed so that corrupted data don't get new
+ * checksums and that dropped checksums are checked at least once.
+ */
+typedef struct {
+  const block_writer_t *writer;
+  FILE *outfp;
+  void *state;
+  work_buffer_t wb;
+  uint64_t num_rewrapped;
+  uint64_t num_uncompressed;
+  uint64_t num_recompressed;
+} converter_t;
+
+static int write_block(converter_t *cv, const snappy_block_t *blk)
+{
+  if (cv->writer->write(cv->outfp, cv->state, blk) != 0) {
+    return -1;
+  }
+  if (ferror(cv->outfp)) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* compress uncompressed data in pieces fitting in the target */
+static int recompress(converter_t *cv, const char *data, size_t len)
+{
+  const block_writer_t *w = cv->writer;
+  size_t max_compressed_len = snappy_max_compressed_length(w->max_uncompressed_len);
+  char *compressed_data = malloc(max_compressed_len);
+  int err = -1;
+
+  if (compressed_data == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  while (len > 0) {
+    snappy_block_t blk;
+
+    blk.uncompressed_len = (len < w->max_uncompressed_len) ? len : w->max_uncompressed_len;
+    blk.len = max_compressed_len;
+    snappy_compress(data, blk.uncompressed_len, compressed_data, &blk.len);
+    blk.has_crc = w->need_crc;
+    blk.crc32c = w->need_crc ? masked_crc32c(data, blk.uncompressed_len) : 0;
+    if (w->store && (blk.len >= blk.uncompressed_len - (blk.uncompressed_len / 8) || blk.len > w->max_len)) {
+      blk.data = data;
+      blk.len = blk.uncompressed_len;
+      blk.compressed = FALSE;
+    } else {
+      blk.data = compressed_data;
+      blk.compressed = TRUE;
+    }
+    if (blk.len > w->max_len) {
+      print_error("Too long compressed data %lu\n", (unsigned long)blk.len);
+      goto cleanup;
+    }
+    if (write_block(cv, &blk) != 0) {
+      goto cleanup;
+    }
+    cv->num_recompressed++;
+    data += blk.uncompressed_len;
+    len -= blk.uncompressed_len;
+  }
+  err = 0;
+ cleanup:
+  free(compressed_data);
+  return err;
+}
+
+static int convert_block(void *ctx, const snappy_block_t *blk)
+{
+  converter_t *cv = (converter_t *)ctx;
+  const block_writer_t *w = cv->writer;
+  snappy_block_t out = *blk;
+  const char *uncompressed_data = blk->data;
+  int fits = (blk->uncompressed_len <= w->max_uncompressed_len && blk->len <= w->max_len
+              && (blk->compressed || w->store));
+
+  if (fits && blk->has_crc == w->need_crc) {
+    /* move the block as it is */
+    cv->num_rewrapped++;
+    return write_block(cv, &out);
+  }
+
+  if (blk->compressed) {
+    size_t uncompressed_len = blk->uncompressed_len;
+
+    if (uncompressed_len > cv->wb.uclen) {
+      work_buffer_resize(&cv->wb, 0, uncompressed_len);
+    }
+    if (snappy_uncompress(blk->data, blk->len, cv->wb.uc, &uncompressed_len)
+        || uncompressed_len != blk->uncompressed_len) {
+      print_error("Invalid data: snappy_uncompress failed\n");
+      return -1;
+    }
+    uncompressed_data = cv->wb.uc;
+  }
+  if (blk->has_crc) {
+    unsigned int actual_crc32c = masked_crc32c(uncompressed_data, blk->uncompressed_len);
+    if (actual_crc32c != blk->crc32c) {
+      print_error("CRC32C error! (expected 0x%08x but 0x%08x)\n", blk->crc32c, actual_crc32c);
+      return -1;
+    }
+  }
+  if (!fits) {
+    return recompress(cv, uncompressed_data, blk->uncompressed_len);
+  }
+  out.has_crc = w->need_crc;
+  if (w->need_crc && !blk->has_crc) {
+    out.crc32c = masked_crc32c(uncompressed_data, blk->uncompressed_len);
+  }
+  cv->num_uncompressed++;
+  return write_block(cv, &out);
+}
+
+int convert_stream(stream_format_t *from, stream_format_t *to, FILE *infp, FILE *outfp, int skip_magic)
+{
+  converter_t cv = {0, };
+  int err = 1;
+
+  if (from->read_blocks == NULL) {
+    print_error("--convert isn't supported from %s format\n", from->name);
+    return 1;
+  }
+  if (to->block_writer == NULL || to->block_writer->fixed_size) {
+    print_error("--convert isn't supported to %s format\n", to->name);
+    return 1;
+  }
+  trace("convert %s to %s\n", from->name, to->name);
+  cv.writer = to->block_writer;
+  cv.outfp = outfp;
+  work_buffer_init(&cv.wb, 65536);
+
+  if (cv.writer->begin != NULL && cv.writer->begin(outfp, cv.writer->block_size, &cv.state) != 0) {
+    goto cleanup;
+  }
+  if (from->read_blocks(infp, skip_magic, convert_block, &cv) != 0) {
+    goto cleanup;
+  }
+  if (cv.writer->end != NULL) {
+    void *state = cv.state;
+    cv.state = NULL;
+    if (cv.writer->end(outfp, state, FALSE) != 0) {
+      goto cleanup;
+    }
+  }
+  if (ferror(outfp)) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  trace("%llu blocks rewrapped, %llu blocks uncompressed for checksums, %llu blocks recompressed\n",
+        (unsigned long long)cv.num_rewrapped, (unsigned long long)cv.num_uncompressed,
+        (unsigned long long)cv.num_recompressed);
+  err = 0;
+ cleanup:
+  if (cv.state != NULL) {
+    cv.writer->end(outfp, cv.state, TRUE);
+  }
+  work_buffer_free(&cv.wb);
+  return err;
+}
@@ -43,9 +43,12 @@
  *
  * CRC32 code derived from work by Gary S. Brown.
  */
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "config.h"
 #include "crc32.h"
+#include "crc32c_tables.h"
 
 uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -743,6 +746,106 @@ multitable_crc32c(uint32_t crc32c,
 	return (crc32c_sb8_64_bit(crc32c, buffer, length, to_even_word));
 }
 
+#define TABLE_CHUNK_SIZE (1u << 30)
+
+static uint32_t
+table_crc32c(uint32_t crc32c,
+    const unsigned char *buffer,
+    size_t length)
+{
+	/* crc32c_sb8_64_bit() takes 32-bit lengths. */
+	while (length > TABLE_CHUNK_SIZE) {
+		crc32c = multitable_crc32c(crc32c, buffer, TABLE_CHUNK_SIZE);
+		buffer += TABLE_CHUNK_SIZE;
+		length -= TABLE_CHUNK_SIZE;
+	}
+	if (length < 4) {
+		return (singletable_crc32c(crc32c, buffer, length));
+	} else {
+		return (multitable_crc32c(crc32c, buffer, (unsigned int)length));
+	}
+}
+
+/*
+ * Slicing-by-16: 16 table lookups per 16 bytes without data dependencies
+ * between them except the final xor. The tables in crc32c_tables.h are
+ * generated by crc32c_gentab.c.
+ */
+static uint32_t
+sb16_crc32c(uint32_t crc32c,
+    const unsigned char *buffer,
+    size_t length)
+{
+	const uint32_t (*t)[256] = crc32c_sb16_table;
+
+	while (length > 0 && ((uintptr_t)buffer & 3) != 0) {
+		crc32c = t[0][(crc32c ^ *buffer++) & 0xff] ^ (crc32c >> 8);
+		length--;
+	}
+	while (length >= 16) {
+		/* the loads are assembled byte-wise, which is endian-neutral. */
+		uint32_t w0 = crc32c ^ (buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+
+		crc32c = t[15][w0 & 0xff] ^ t[14][(w0 >> 8) & 0xff] ^
+		    t[13][(w0 >> 16) & 0xff] ^ t[12][w0 >> 24] ^
+		    t[11][buffer[4]] ^ t[10][buffer[5]] ^ t[9][buffer[6]] ^ t[8][buffer[7]] ^
+		    t[7][buffer[8]] ^ t[6][buffer[9]] ^ t[5][buffer[10]] ^ t[4][buffer[11]] ^
+		    t[3][buffer[12]] ^ t[2][buffer[13]] ^ t[1][buffer[14]] ^ t[0][buffer[15]];
+		buffer += 16;
+		length -= 16;
+	}
+	while (length-- > 0) {
+		crc32c = t[0][(crc32c ^ *buffer++) & 0xff] ^ (crc32c >> 8);
+	}
+	return crc32c;
+}
+
+/*
+ * Multiply a and b modulo the crc32c polynomial. Both are bit-reflected,
+ * that is, the most significant bit is the coefficient of x^0.
+ * This is same with multmodp() in zlib's crc32.c.
+ */
+uint32_t
+crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b & 1) ? ((b >> 1) ^ 0x82f63b78) : (b >> 1);
+	}
+	return p;
+}
+
+/* x^(8n) modulo the crc32c polynomial, used to shift a crc by n zero bytes. */
+uint32_t
+crc32c_x8nmodp(size_t n)
+{
+	uint32_t p = 1u << 31; /* x^0 */
+	uint32_t sq = 1u << 23; /* x^8 */
+
+	while (n) {
+		if (n & 1) {
+			p = crc32c_multmodp(sq, p);
+		}
+		sq = crc32c_multmodp(sq, sq);
+		n >>= 1;
+	}
+	return p;
+}
+
+static int always_available(void)
+{
+	return 1;
+}
+
 #ifdef HAVE_SSE4_2
 /*
  * Use SSE4.2 to calculate crc32c.
@@ -775,6 +878,13 @@ multitable_crc32c(uint32_t crc32c,
  */
 #define CPUID_SSE4_2_IS_SET(x) (((x) & (1u << 20)) ? 1 : 0)
 
+/* bits checked by vpclmul_is_available() */
+#define CPUID1_ECX_PCLMUL (1u << 1)
+#define CPUID1_ECX_OSXSAVE (1u << 27)
+#define CPUID7_EBX_AVX512F (1u << 16)
+#define CPUID7_ECX_VPCLMULQDQ (1u << 10)
+#define XCR0_AVX512_STATE 0xe6 /* SSE, AVX, opmask, ZMM_Hi256 and Hi16_ZMM */
+
 #if defined __GNUC__
 #if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3)
 #include <cpuid.h>
@@ -805,6 +915,28 @@ static int sse4_2_is_available(void)
 	return CPUID_SSE4_2_IS_SET(ecx);
 }
 
+#ifdef HAVE_VPCLMUL
+static int vpclmul_is_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int xcr0;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!CPUID_SSE4_2_IS_SET(ecx) || !(ecx & CPUID1_ECX_PCLMUL) || !(ecx & CPUID1_ECX_OSXSAVE)) {
+		return 0;
+	}
+	__asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+	if ((xcr0 & XCR0_AVX512_STATE) != XCR0_AVX512_STATE) {
+		return 0;
+	}
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & CPUID7_EBX_AVX512F) && (ecx & CPUID7_ECX_VPCLMULQDQ);
+}
+#endif
+
 #elif defined USE_GCC_ASM
 static int sse4_2_is_available(void)
 {
@@ -837,6 +969,27 @@ static int sse4_2_is_available(void)
 	return CPUID_SSE4_2_IS_SET(cpuinfo[2]);
 }
 
+#ifdef HAVE_VPCLMUL
+static int vpclmul_is_available(void)
+{
+	int cpuinfo[4];
+
+	__cpuid(cpuinfo, 1);
+	if (!CPUID_SSE4_2_IS_SET(cpuinfo[2]) || !(cpuinfo[2] & CPUID1_ECX_PCLMUL) || !(cpuinfo[2] & CPUID1_ECX_OSXSAVE)) {
+		return 0;
+	}
+	if ((_xgetbv(0) & XCR0_AVX512_STATE) != XCR0_AVX512_STATE) {
+		return 0;
+	}
+	__cpuid(cpuinfo, 0);
+	if (cpuinfo[0] < 7) {
+		return 0;
+	}
+	__cpuidex(cpuinfo, 7, 0);
+	return (cpuinfo[1] & CPUID7_EBX_AVX512F) && (cpuinfo[2] & CPUID7_ECX_VPCLMULQDQ);
+}
+#endif
+
 #elif defined USE_MSVC_ASM
 static int sse4_2_is_available(void)
 {
@@ -853,38 +1006,77 @@ static int sse4_2_is_available(void)
 #error unsupported compiler to use cpuid instruction. run 'configure' with --disable-sse4_2
 #endif
 
-static uint32_t select_crc32c_func(uint32_t crc32c, const unsigned char *buffer,unsigned int length);
+#if defined HAVE_VPCLMUL && !defined USE_GCC_INTRINSIC && !defined USE_MSVC_INTRINSIC
+static int vpclmul_is_available(void)
+{
+	return 0;
+}
+#endif
+#endif /* HAVE_SSE4_2 */
 
-static uint32_t (*crc32c_func)(uint32_t, const unsigned char *, unsigned int) = select_crc32c_func;
+const crc32c_kernel_t crc32c_kernels[] = {
+#ifdef HAVE_VPCLMUL
+	{"vpclmul", calculate_crc32c_vpclmul, vpclmul_is_available},
+#endif
+#ifdef HAVE_SSE4_2
+	{"sse4_2_3way", calculate_crc32c_sse4_2_3way, sse4_2_is_available},
+	{"sse4_2", calculate_crc32c_sse4_2, sse4_2_is_available},
+#endif
+	{"sb16", sb16_crc32c, always_available},
+	{"table", table_crc32c, always_available},
+	{NULL, NULL, NULL},
+};
 
-/* This function is called only once. */
-static uint32_t
-select_crc32c_func(uint32_t crc32c,
-    const unsigned char *buffer,
-    unsigned int length)
+static const crc32c_kernel_t *crc32c_kernel = NULL;
+static crc32c_func_t crc32c_func = sb16_crc32c;
+
+#if defined __GNUC__
+__attribute__((constructor))
+#endif
+void
+crc32c_init(void)
 {
+	const crc32c_kernel_t *kernel;
+	const char *name;
+
+	if (crc32c_kernel != NULL) {
+		return;
+	}
+#ifdef HAVE_SSE4_2
 	if (sse4_2_is_available()) {
-		crc32c_func = calculate_crc32c_sse4_2;
-	} else {
-		crc32c_func = NULL;
+		crc32c_sse4_2_3way_init();
 	}
-	return calculate_crc32c(crc32c, buffer, length);
-}
 #endif
+	name = getenv("SNZIP_CRC32C");
+	if (name != NULL && *name != '\0') {
+		for (kernel = crc32c_kernels; kernel->name != NULL; kernel++) {
+			if (strcmp(kernel->name, name) == 0 && kernel->is_available()) {
+				crc32c_kernel = kernel;
+				crc32c_func = kernel->func;
+				return;
+			}
+		}
+		fprintf(stderr, "SNZIP_CRC32C: crc32c kernel '%s' is not available\n", name);
+	}
+	for (kernel = crc32c_kernels; kernel->name != NULL; kernel++) {
+		if (kernel->is_available()) {
+			crc32c_kernel = kernel;
+			crc32c_func = kernel->func;
+			return;
+		}
+	}
+}
+
+const char *
+crc32c_kernel_name(void)
+{
+	return crc32c_kernel ? crc32c_kernel->name : "sb16";
+}
 
 uint32_t
 calculate_crc32c(uint32_t crc32c,
     const unsigned char *buffer,
-    unsigned int length)
+    size_t length)
 {
-#ifdef HAVE_SSE4_2
-	if (crc32c_func) {
-		return crc32c_func(crc32c, buffer, length);
-	}
-#endif
-	if (length < 4) {
-		return (singletable_crc32c(crc32c, buffer, length));
-	} else {
-		return (multitable_crc32c(crc32c, buffer, length));
-	}
+	return crc32c_func(crc32c, buffer, length);
 }
@@ -1,14 +1,48 @@
 #ifndef CRC32_H
 #define CRC32_H 1
+#include <stddef.h>
 #include <stdint.h>
 
 #define MASK_DELTA 0xa282ead8
 
+typedef uint32_t (*crc32c_func_t)(uint32_t crc32c, const unsigned char *buffer, size_t length);
+
+typedef struct {
+  const char *name;
+  crc32c_func_t func;
+  int (*is_available)(void);
+} crc32c_kernel_t;
+
+/* Kernels in order of preference, terminated by an entry whose name is NULL. */
+extern const crc32c_kernel_t crc32c_kernels[];
+
+/* Select the kernel used by calculate_crc32c().
+ * This is run once at load time where constructors are supported and
+ * must be called before any threads are started otherwise.
+ * The environment variable SNZIP_CRC32C overrides the selection.
+ */
+void crc32c_init(void);
+const char *crc32c_kernel_name(void);
+
 uint32_t calculate_crc32c(uint32_t crc32c, const unsigned char *buffer,
-			  unsigned int length);
+			  size_t length);
+
+/* GF(2) arithmetic modulo the crc32c polynomial (bit-reflected) */
+uint32_t crc32c_multmodp(uint32_t a, uint32_t b);
+uint32_t crc32c_x8nmodp(size_t n);
 
+#ifdef HAVE_SSE4_2
 uint32_t calculate_crc32c_sse4_2(uint32_t crc32c, const unsigned char *buffer,
-			  unsigned int length);
+			  size_t length);
+uint32_t calculate_crc32c_sse4_2_3way(uint32_t crc32c, const unsigned char *buffer,
+			  size_t length);
+void crc32c_sse4_2_3way_init(void);
+#endif
+
+#ifdef HAVE_VPCLMUL
+uint32_t calculate_crc32c_vpclmul(uint32_t crc32c, const unsigned char *buffer,
+			  size_t length);
+#endif
 
 static inline unsigned int masked_crc32c(const char *buf, size_t len)
 {
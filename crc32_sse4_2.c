@@ -35,7 +35,7 @@
 uint32_t
 calculate_crc32c_sse4_2(uint32_t crc32c,
     const unsigned char *buffer,
-    unsigned int length)
+    size_t length)
 {
 	size_t quotient;
 
@@ -65,3 +65,93 @@ calculate_crc32c_sse4_2(uint32_t crc32c,
 	}
 	return crc32c;
 }
+
+/*
+ * The crc32 instruction has a latency of 3 cycles and a throughput of
+ * one per cycle. Calculating three independent streams at once keeps the
+ * pipeline full. The partial crcs are combined by shifting them over the
+ * following streams with the tables below.
+ * This is based on crc32c.c by Mark Adler.
+ */
+#define LONG_STREAM 8192
+#define SHORT_STREAM 256
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(_M_X64)
+typedef uint64_t crc_word_t;
+#define CRC32_WORD(crc, buf) _mm_crc32_u64(crc, *(const uint64_t*)(buf))
+#else
+typedef uint32_t crc_word_t;
+#define CRC32_WORD(crc, buf) _mm_crc32_u32(crc, *(const uint32_t*)(buf))
+#endif
+
+static uint32_t crc32c_long_shift[4][256];
+static uint32_t crc32c_short_shift[4][256];
+
+static void make_shift_table(uint32_t table[][256], size_t len)
+{
+	uint32_t op = crc32c_x8nmodp(len);
+	unsigned int n, k;
+
+	for (n = 0; n < 256; n++) {
+		for (k = 0; k < 4; k++) {
+			table[k][n] = crc32c_multmodp(op, (uint32_t)n << (k * 8));
+		}
+	}
+}
+
+void crc32c_sse4_2_3way_init(void)
+{
+	make_shift_table(crc32c_long_shift, LONG_STREAM);
+	make_shift_table(crc32c_short_shift, SHORT_STREAM);
+}
+
+static inline uint32_t crc32c_shift(uint32_t table[][256], uint32_t crc)
+{
+	return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+	    table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+uint32_t
+calculate_crc32c_sse4_2_3way(uint32_t crc32c,
+    const unsigned char *buffer,
+    size_t length)
+{
+	crc_word_t crc0 = crc32c, crc1, crc2;
+	const unsigned char *end;
+
+	while (length > 0 && ((uintptr_t)buffer & (sizeof(crc_word_t) - 1)) != 0) {
+		crc0 = _mm_crc32_u8((uint32_t)crc0, *buffer++);
+		length--;
+	}
+	while (length >= LONG_STREAM * 3) {
+		crc1 = 0;
+		crc2 = 0;
+		end = buffer + LONG_STREAM;
+		do {
+			crc0 = CRC32_WORD(crc0, buffer);
+			crc1 = CRC32_WORD(crc1, buffer + LONG_STREAM);
+			crc2 = CRC32_WORD(crc2, buffer + LONG_STREAM * 2);
+			buffer += sizeof(crc_word_t);
+		} while (buffer < end);
+		crc0 = crc32c_shift(crc32c_long_shift, (uint32_t)crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_long_shift, (uint32_t)crc0) ^ crc2;
+		buffer += LONG_STREAM * 2;
+		length -= LONG_STREAM * 3;
+	}
+	while (length >= SHORT_STREAM * 3) {
+		crc1 = 0;
+		crc2 = 0;
+		end = buffer + SHORT_STREAM;
+		do {
+			crc0 = CRC32_WORD(crc0, buffer);
+			crc1 = CRC32_WORD(crc1, buffer + SHORT_STREAM);
+			crc2 = CRC32_WORD(crc2, buffer + SHORT_STREAM * 2);
+			buffer += sizeof(crc_word_t);
+		} while (buffer < end);
+		crc0 = crc32c_shift(crc32c_short_shift, (uint32_t)crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_short_shift, (uint32_t)crc0) ^ crc2;
+		buffer += SHORT_STREAM * 2;
+		length -= SHORT_STREAM * 3;
+	}
+	return calculate_crc32c_sse4_2((uint32_t)crc0, buffer, length);
+}
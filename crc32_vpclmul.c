@@ -0,0 +1,128 @@
+/*
+ * Use AVX-512 VPCLMULQDQ to calculate crc32c.
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ */
+#include <stdlib.h>
+#include "config.h"
+#include "crc32.h"
+#include <immintrin.h>
+
+/*
+ * The input is folded into four 512-bit accumulators with carry-less
+ * multiplication. Each 128-bit lane is split into the first 8 bytes (the
+ * higher degree terms) and the last 8 bytes. Folding a lane forward over
+ * D bits multiplies them by x^(D+63) mod P and x^(D-1) mod P respectively.
+ * The constants are bit-reflected and shifted left by 32 bits so that the
+ * product lines up with the lane D bits ahead.
+ *
+ * The final 128-bit remainder is congruent to the input consumed so far,
+ * so feeding it to the crc32 instruction with an initial value of zero
+ * gives the crc.
+ */
+#define K2048_HI 0xe9a5d8be00000000ull
+#define K2048_LO 0x1426a81500000000ull
+#define K512_HI  0x1c19243b00000000ull
+#define K512_LO  0x75bba45b00000000ull
+#define K384_HI  0xa46ef4aa00000000ull
+#define K384_LO  0x6051243f00000000ull
+#define K256_HI  0x33ccbbbc00000000ull
+#define K256_LO  0xa2158b3400000000ull
+#define K128_HI  0x3743f7bd00000000ull
+#define K128_LO  0x3171d43000000000ull
+
+#define MIN_LENGTH 256
+
+/* (a folded over the distance of k) xor b */
+static inline __m512i fold512(__m512i a, __m512i k, __m512i b)
+{
+	return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(a, k, 0x00),
+	    _mm512_clmulepi64_epi128(a, k, 0x11), b, 0x96);
+}
+
+static inline __m128i fold128(__m128i a, __m128i k, __m128i b)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x00),
+	    _mm_clmulepi64_si128(a, k, 0x11)), b);
+}
+
+uint32_t
+calculate_crc32c_vpclmul(uint32_t crc32c,
+    const unsigned char *buffer,
+    size_t length)
+{
+	__m512i x0, x1, x2, x3, k;
+	__m128i a;
+
+	if (length < MIN_LENGTH) {
+		return calculate_crc32c_sse4_2(crc32c, buffer, length);
+	}
+
+	x0 = _mm512_loadu_si512((const void *)buffer);
+	x0 = _mm512_xor_si512(x0, _mm512_maskz_set1_epi32(1, (int)crc32c));
+	x1 = _mm512_loadu_si512((const void *)(buffer + 64));
+	x2 = _mm512_loadu_si512((const void *)(buffer + 128));
+	x3 = _mm512_loadu_si512((const void *)(buffer + 192));
+	buffer += 256;
+	length -= 256;
+
+	k = _mm512_broadcast_i32x4(_mm_set_epi64x(K2048_LO, K2048_HI));
+	while (length >= 256) {
+		x0 = fold512(x0, k, _mm512_loadu_si512((const void *)buffer));
+		x1 = fold512(x1, k, _mm512_loadu_si512((const void *)(buffer + 64)));
+		x2 = fold512(x2, k, _mm512_loadu_si512((const void *)(buffer + 128)));
+		x3 = fold512(x3, k, _mm512_loadu_si512((const void *)(buffer + 192)));
+		buffer += 256;
+		length -= 256;
+	}
+
+	/* four accumulators into one */
+	k = _mm512_broadcast_i32x4(_mm_set_epi64x(K512_LO, K512_HI));
+	x1 = fold512(x0, k, x1);
+	x2 = fold512(x1, k, x2);
+	x3 = fold512(x2, k, x3);
+	while (length >= 64) {
+		x3 = fold512(x3, k, _mm512_loadu_si512((const void *)buffer));
+		buffer += 64;
+		length -= 64;
+	}
+
+	/* four lanes into one */
+	a = _mm512_extracti32x4_epi32(x3, 3);
+	a = fold128(_mm512_extracti32x4_epi32(x3, 2), _mm_set_epi64x(K128_LO, K128_HI), a);
+	a = fold128(_mm512_extracti32x4_epi32(x3, 1), _mm_set_epi64x(K256_LO, K256_HI), a);
+	a = fold128(_mm512_castsi512_si128(x3), _mm_set_epi64x(K384_LO, K384_HI), a);
+	while (length >= 16) {
+		a = fold128(a, _mm_set_epi64x(K128_LO, K128_HI), _mm_loadu_si128((const __m128i *)buffer));
+		buffer += 16;
+		length -= 16;
+	}
+
+	crc32c = (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(a));
+	crc32c = (uint32_t)_mm_crc32_u64(crc32c, (uint64_t)_mm_extract_epi64(a, 1));
+	return calculate_crc32c_sse4_2(crc32c, buffer, length);
+}
@@ -0,0 +1,209 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+
+/*
+ * Check and benchmark the crc32c kernels in crc32.c.
+ *
+ *   usage: crc32c_bench [-c] [-s seed]
+ *
+ * All kernels available on the CPU are compared with a bitwise reference
+ * implementation over random lengths and alignments. Then throughput of
+ * each kernel is printed for buffer sizes from 16 bytes to 16 MiB.
+ * -c skips the benchmark.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+#include "crc32.h"
+
+#define MAX_ALIGNMENT 64
+#define NUM_CHECKS 2000
+#define MAX_CHECK_LENGTH (256 * 1024)
+#define MIN_BENCH_SIZE 16
+#define MAX_BENCH_SIZE (16 * 1024 * 1024)
+#define BENCH_BYTES (256 * 1024 * 1024) /* bytes processed per measurement */
+
+static uint32_t reference_crc32c(uint32_t crc, const unsigned char *buf, size_t len)
+{
+  int k;
+
+  while (len-- > 0) {
+    crc ^= *buf++;
+    for (k = 0; k < 8; k++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0x82f63b78) : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+static double now(void)
+{
+#ifdef WIN32
+  LARGE_INTEGER freq, cnt;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  return (double)cnt.QuadPart / freq.QuadPart;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static int check_kernels(const unsigned char *buf)
+{
+  const crc32c_kernel_t *kernel;
+  int i;
+  int err = 0;
+
+  /* well-known check value of crc32c("123456789") */
+  if (~reference_crc32c(~0u, (const unsigned char *)"123456789", 9) != 0xe3069283) {
+    printf("reference implementation is broken\n");
+    return 1;
+  }
+
+  for (i = 0; i < NUM_CHECKS; i++) {
+    size_t offset = rand() % MAX_ALIGNMENT;
+    /* short lengths are checked more often than long ones. */
+    size_t length = (i % 2) ? (rand() % 1024) : ((size_t)rand() * 64 + rand()) % MAX_CHECK_LENGTH;
+    uint32_t crc = ((uint32_t)rand() << 16) ^ rand();
+    uint32_t expected = reference_crc32c(crc, buf + offset, length);
+
+    for (kernel = crc32c_kernels; kernel->name != NULL; kernel++) {
+      uint32_t actual;
+      if (!kernel->is_available()) {
+        continue;
+      }
+      actual = kernel->func(crc, buf + offset, length);
+      if (actual != expected) {
+        printf("%s: crc32c error at length %lu, offset %lu (expected 0x%08x but 0x%08x)\n",
+               kernel->name, (unsigned long)length, (unsigned long)offset, expected, actual);
+        err = 1;
+      }
+    }
+  }
+  for (kernel = crc32c_kernels; kernel->name != NULL; kernel++) {
+    printf("%-12s %s\n", kernel->name,
+           kernel->is_available() ? (err ? "checked" : "ok") : "not available on this CPU");
+  }
+  return err;
+}
+
+static void run_benchmark(const unsigned char *buf)
+{
+  const crc32c_kernel_t *kernel;
+  size_t size;
+
+  printf("\n%10s", "size");
+  for (kernel = crc32c_kernels; kernel->name != NULL; kernel++) {
+    if (kernel->is_available()) {
+      printf(" %12s", kernel->name);
+    }
+  }
+  printf("   (GB/s)\n");
+
+  for (size = MIN_BENCH_SIZE; size <= MAX_BENCH_SIZE; size *= 4) {
+    if (size < 1024) {
+      printf("%8lu B", (unsigned long)size);
+    } else if (size < 1024 * 1024) {
+      printf("%6lu KiB", (unsigned long)size / 1024);
+    } else {
+      printf("%6lu MiB", (unsigned long)size / (1024 * 1024));
+    }
+    for (kernel = crc32c_kernels; kernel->name != NULL; kernel++) {
+      size_t iterations = BENCH_BYTES / size;
+      volatile uint32_t sink = 0;
+      double start;
+      size_t i;
+
+      if (!kernel->is_available()) {
+        continue;
+      }
+      start = now();
+      for (i = 0; i < iterations; i++) {
+        sink ^= kernel->func(~0u, buf, size);
+      }
+      printf(" %12.2f", (double)iterations * size / (now() - start) / 1e9);
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned char *buf;
+  unsigned int seed = (unsigned int)time(NULL);
+  int check_only = 0;
+  size_t buflen = MAX_BENCH_SIZE + MAX_ALIGNMENT;
+  size_t i;
+  int err;
+
+  for (i = 1; i < (size_t)argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      check_only = 1;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < (size_t)argc) {
+      seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [-c] [-s seed]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  buf = malloc(buflen);
+  if (buf == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  srand(seed);
+  for (i = 0; i < buflen; i++) {
+    buf[i] = (unsigned char)rand();
+  }
+
+  crc32c_init();
+  printf("seed: %u\n", seed);
+  printf("selected kernel: %s\n\n", crc32c_kernel_name());
+  err = check_kernels(buf);
+  if (!err && !check_only) {
+    run_benchmark(buf);
+  }
+  free(buf);
+  return err;
+}
@@ -0,0 +1,89 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+
+/*
+ * Generate lookup tables for the slicing-by-16 crc32c kernel in crc32.c.
+ * The output is committed as crc32c_tables.h and isn't generated while
+ * building so that cross compilation works. Run it only to change it.
+ *
+ *   usage: cc -o crc32c_gentab crc32c_gentab.c && ./crc32c_gentab crc32c_tables.h
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#define CRC32C_POLY 0x82f63b78 /* bit-reflected 0x1EDC6F41 */
+#define NUM_SLICES 16
+
+static uint32_t table[NUM_SLICES][256];
+
+int main(int argc, char **argv)
+{
+  FILE *fp;
+  int n, k;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s output_file\n", argv[0]);
+    return 1;
+  }
+
+  for (n = 0; n < 256; n++) {
+    uint32_t crc = n;
+    for (k = 0; k < 8; k++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ CRC32C_POLY) : (crc >> 1);
+    }
+    table[0][n] = crc;
+  }
+  for (n = 0; n < 256; n++) {
+    for (k = 1; k < NUM_SLICES; k++) {
+      table[k][n] = table[0][table[k - 1][n] & 0xff] ^ (table[k - 1][n] >> 8);
+    }
+  }
+
+  fp = fopen(argv[1], "w");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  fprintf(fp, "/* This file was generated by crc32c_gentab. Don't edit it. */\n");
+  fprintf(fp, "static const uint32_t crc32c_sb16_table[%d][256] = {\n", NUM_SLICES);
+  for (k = 0; k < NUM_SLICES; k++) {
+    fprintf(fp, "  {\n");
+    for (n = 0; n < 256; n++) {
+      fprintf(fp, "%s0x%08x,%s", (n % 8 == 0) ? "    " : " ", table[k][n], (n % 8 == 7) ? "\n" : "");
+    }
+    fprintf(fp, "  },\n");
+  }
+  fprintf(fp, "};\n");
+  if (fclose(fp) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  return 0;
+}
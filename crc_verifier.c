@@ -0,0 +1,269 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "snzip.h"
+#include "crc32.h"
+#include "thread.h"
+
+/*
+ * Verify checksums of uncompressed chunks and write them on a dedicated
+ * thread while the caller uncompresses the next chunks.
+ *
+ * The caller gets a buffer by crc_verifier_buffer(), fills it and passes
+ * it to crc_verifier_submit() with the part to be written. Chunks are
+ * verified and written in the submitted order. Once a checksum mismatches, the chunk and all chunks
+ * after it are discarded without being written.
+ */
+
+#define NUM_BUFFERS 4
+
+typedef struct {
+  char *buf;
+  const char *data;
+  size_t len;
+  unsigned int expected_crc32c;
+  size_t write_offset;
+  size_t write_len;
+} chunk_t;
+
+struct crc_verifier {
+  int outfd;
+  size_t bufsize;
+  chunk_t chunks[NUM_BUFFERS];
+  int head; /* next chunk filled by the caller */
+  int tail; /* next chunk verified by the verifier thread */
+  int count; /* number of submitted but not verified chunks */
+  int failed;
+#ifdef SNZ_HAVE_THREAD
+  int threaded;
+  int done;
+  snz_thread_t thread;
+  snz_mutex_t mutex;
+  snz_cond_t cond;
+#endif
+};
+
+static int verify_and_write(crc_verifier_t *cv, const chunk_t *chunk)
+{
+  unsigned int actual_crc32c = masked_crc32c(chunk->data, chunk->len);
+  if (actual_crc32c != chunk->expected_crc32c) {
+    print_error("CRC32C error! (expected 0x%08x but 0x%08x)\n", chunk->expected_crc32c, actual_crc32c);
+    return -1;
+  }
+  if (write_full(cv->outfd, chunk->data + chunk->write_offset, chunk->write_len) != chunk->write_len) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+#ifdef SNZ_HAVE_THREAD
+static SNZ_THREAD_FUNC(verifier_main, arg)
+{
+  crc_verifier_t *cv = (crc_verifier_t *)arg;
+  int failed;
+
+  snz_mutex_lock(&cv->mutex);
+  for (;;) {
+    chunk_t *chunk;
+
+    while (cv->count == 0 && !cv->done) {
+      snz_cond_wait(&cv->cond, &cv->mutex);
+    }
+    if (cv->count == 0) {
+      break;
+    }
+    chunk = &cv->chunks[cv->tail];
+    failed = cv->failed;
+    snz_mutex_unlock(&cv->mutex);
+
+    if (!failed && verify_and_write(cv, chunk) != 0) {
+      failed = 1;
+    }
+
+    snz_mutex_lock(&cv->mutex);
+    cv->failed = failed;
+    cv->tail = (cv->tail + 1) % NUM_BUFFERS;
+    cv->count--;
+    snz_cond_broadcast(&cv->cond);
+  }
+  snz_mutex_unlock(&cv->mutex);
+  SNZ_THREAD_RETURN;
+}
+#endif
+
+crc_verifier_t *crc_verifier_create(FILE *outfp, size_t bufsize)
+{
+  crc_verifier_t *cv = calloc(1, sizeof(crc_verifier_t));
+  int i;
+
+  if (cv == NULL) {
+    print_error("out of memory\n");
+    return NULL;
+  }
+  /* Use a file descriptor instead of the stdio file pointer
+   * to reduce the number of write system calls.
+   */
+  fflush(outfp);
+  cv->outfd = fileno(outfp);
+  cv->bufsize = bufsize;
+  for (i = 0; i < NUM_BUFFERS; i++) {
+    cv->chunks[i].buf = malloc(bufsize);
+    if (cv->chunks[i].buf == NULL) {
+      print_error("out of memory\n");
+      goto error;
+    }
+  }
+#ifdef SNZ_HAVE_THREAD
+  /* Overlapping doesn't pay on a single CPU. */
+  if (num_cpus() > 1) {
+    snz_mutex_init(&cv->mutex);
+    snz_cond_init(&cv->cond);
+    if (snz_thread_create(&cv->thread, verifier_main, cv) == 0) {
+      cv->threaded = 1;
+    } else {
+      snz_cond_destroy(&cv->cond);
+      snz_mutex_destroy(&cv->mutex);
+    }
+  }
+  trace("crc verifier thread: %s\n", cv->threaded ? "enabled" : "disabled");
+#endif
+  return cv;
+ error:
+  for (i = 0; i < NUM_BUFFERS; i++) {
+    free(cv->chunks[i].buf);
+  }
+  free(cv);
+  return NULL;
+}
+
+char *crc_verifier_buffer(crc_verifier_t *cv)
+{
+#ifdef SNZ_HAVE_THREAD
+  if (cv->threaded) {
+    snz_mutex_lock(&cv->mutex);
+    while (cv->count == NUM_BUFFERS) {
+      snz_cond_wait(&cv->cond, &cv->mutex);
+    }
+    snz_mutex_unlock(&cv->mutex);
+  }
+#endif
+  return cv->chunks[cv->head].buf;
+}
+
+int crc_verifier_submit(crc_verifier_t *cv, const char *data, size_t len, unsigned int expected_crc32c,
+                        size_t write_offset, size_t write_len)
+{
+  chunk_t *chunk = &cv->chunks[cv->head];
+#ifdef SNZ_HAVE_THREAD
+  int failed;
+#endif
+
+  chunk->data = data;
+  chunk->len = len;
+  chunk->expected_crc32c = expected_crc32c;
+  chunk->write_offset = write_offset;
+  chunk->write_len = write_len;
+#ifdef SNZ_HAVE_THREAD
+  if (cv->threaded) {
+    snz_mutex_lock(&cv->mutex);
+    cv->head = (cv->head + 1) % NUM_BUFFERS;
+    cv->count++;
+    snz_cond_broadcast(&cv->cond);
+    failed = cv->failed;
+    snz_mutex_unlock(&cv->mutex);
+    return failed ? -1 : 0;
+  }
+#endif
+  if (verify_and_write(cv, chunk) != 0) {
+    cv->failed = 1;
+  }
+  return cv->failed ? -1 : 0;
+}
+
+int crc_verifier_write(crc_verifier_t *cv, const char *data, size_t len, unsigned int expected_crc32c,
+                       size_t write_offset, size_t write_len)
+{
+  chunk_t chunk;
+
+#ifdef SNZ_HAVE_THREAD
+  if (cv->threaded) {
+    /* wait until all submitted chunks are written. */
+    snz_mutex_lock(&cv->mutex);
+    while (cv->count > 0) {
+      snz_cond_wait(&cv->cond, &cv->mutex);
+    }
+    snz_mutex_unlock(&cv->mutex);
+  }
+#endif
+  if (cv->failed) {
+    return -1;
+  }
+  chunk.data = data;
+  chunk.len = len;
+  chunk.expected_crc32c = expected_crc32c;
+  chunk.write_offset = write_offset;
+  chunk.write_len = write_len;
+  if (verify_and_write(cv, &chunk) != 0) {
+    cv->failed = 1;
+    return -1;
+  }
+  return 0;
+}
+
+int crc_verifier_finish(crc_verifier_t *cv)
+{
+  int failed;
+  int i;
+
+#ifdef SNZ_HAVE_THREAD
+  if (cv->threaded) {
+    snz_mutex_lock(&cv->mutex);
+    cv->done = 1;
+    snz_cond_broadcast(&cv->cond);
+    snz_mutex_unlock(&cv->mutex);
+    snz_thread_join(cv->thread);
+    snz_cond_destroy(&cv->cond);
+    snz_mutex_destroy(&cv->mutex);
+  }
+#endif
+  failed = cv->failed;
+  for (i = 0; i < NUM_BUFFERS; i++) {
+    free(cv->chunks[i].buf);
+  }
+  free(cv);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,199 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "snzip.h"
+
+/*
+ * Cache of recently compressed blocks enabled by --dedup.
+ *
+ * Blocks are looked up by the checksum, which is calculated before
+ * compression anyway, and the length. Uncompressed data are compared
+ * by memcmp() to confirm a hit because checksums may collide. When the
+ * cache is full, the least recently used entry is reused.
+ */
+struct dedup_entry {
+  dedup_entry_t *hash_next;
+  dedup_entry_t *prev; /* more recently used */
+  dedup_entry_t *next; /* less recently used */
+  unsigned int crc32c;
+  size_t len;
+  size_t compressed_len;
+  size_t size; /* allocated size of 'data' */
+  char *data; /* uncompressed data followed by compressed data */
+};
+
+void dedup_cache_init(dedup_cache_t *dc, size_t max_entries)
+{
+  memset(dc, 0, sizeof(*dc));
+  dc->max_entries = max_entries;
+}
+
+void dedup_cache_free(dedup_cache_t *dc)
+{
+  dedup_entry_t *entry = dc->head;
+
+  while (entry != NULL) {
+    dedup_entry_t *next = entry->next;
+    free(entry->data);
+    free(entry);
+    entry = next;
+  }
+  free(dc->buckets);
+  dc->buckets = NULL;
+  dc->head = dc->tail = NULL;
+  dc->num_entries = 0;
+}
+
+void dedup_cache_report(const dedup_cache_t *dc)
+{
+  if (dc->max_entries == 0) {
+    return;
+  }
+  trace("dedup cache: %llu hits in %llu blocks (%.1f%%), %llu bytes not compressed\n",
+        (unsigned long long)dc->num_hits, (unsigned long long)dc->num_lookups,
+        dc->num_lookups ? 100.0 * dc->num_hits / dc->num_lookups : 0.0,
+        (unsigned long long)dc->saved_bytes);
+}
+
+static void unlink_lru(dedup_cache_t *dc, dedup_entry_t *entry)
+{
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    dc->head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    dc->tail = entry->prev;
+  }
+}
+
+static void push_lru(dedup_cache_t *dc, dedup_entry_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = dc->head;
+  if (dc->head != NULL) {
+    dc->head->prev = entry;
+  } else {
+    dc->tail = entry;
+  }
+  dc->head = entry;
+}
+
+int dedup_cache_find(dedup_cache_t *dc, unsigned int crc32c, const char *data, size_t len,
+                     const char **compressed, size_t *compressed_len)
+{
+  dedup_entry_t *entry;
+
+  if (dc->max_entries == 0) {
+    return FALSE;
+  }
+  dc->num_lookups++;
+  if (dc->buckets == NULL) {
+    return FALSE;
+  }
+  for (entry = dc->buckets[crc32c & dc->mask]; entry != NULL; entry = entry->hash_next) {
+    if (entry->crc32c == crc32c && entry->len == len && memcmp(entry->data, data, len) == 0) {
+      unlink_lru(dc, entry);
+      push_lru(dc, entry);
+      dc->num_hits++;
+      dc->saved_bytes += len;
+      *compressed = entry->data + len;
+      *compressed_len = entry->compressed_len;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+void dedup_cache_add(dedup_cache_t *dc, unsigned int crc32c, const char *data, size_t len,
+                     const char *compressed, size_t compressed_len)
+{
+  dedup_entry_t *entry;
+
+  if (dc->max_entries == 0) {
+    return;
+  }
+  if (dc->buckets == NULL) {
+    size_t num_buckets = 1;
+    while (num_buckets < dc->max_entries * 2) {
+      num_buckets *= 2;
+    }
+    dc->buckets = calloc(num_buckets, sizeof(dedup_entry_t *));
+    if (dc->buckets == NULL) {
+      /* compress without the cache */
+      dc->max_entries = 0;
+      return;
+    }
+    dc->mask = num_buckets - 1;
+  }
+  if (dc->num_entries < dc->max_entries) {
+    entry = calloc(1, sizeof(dedup_entry_t));
+    if (entry == NULL) {
+      return;
+    }
+    dc->num_entries++;
+  } else {
+    /* reuse the least recently used entry */
+    dedup_entry_t **pp = &dc->buckets[dc->tail->crc32c & dc->mask];
+
+    entry = dc->tail;
+    while (*pp != entry) {
+      pp = &(*pp)->hash_next;
+    }
+    *pp = entry->hash_next;
+    unlink_lru(dc, entry);
+  }
+  if (entry->size < len + compressed_len) {
+    char *buf = realloc(entry->data, len + compressed_len);
+    if (buf == NULL) {
+      free(entry->data);
+      free(entry);
+      dc->num_entries--;
+      return;
+    }
+    entry->data = buf;
+    entry->size = len + compressed_len;
+  }
+  memcpy(entry->data, data, len);
+  memcpy(entry->data + len, compressed, compressed_len);
+  entry->crc32c = crc32c;
+  entry->len = len;
+  entry->compressed_len = compressed_len;
+  entry->hash_next = dc->buckets[crc32c & dc->mask];
+  dc->buckets[crc32c & dc->mask] = entry;
+  push_lru(dc, entry);
+}
@@ -0,0 +1,182 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#if defined HAVE_AVX2 && defined _MSC_VER
+#include <intrin.h>
+#endif
+#include "snzip.h"
+
+/*
+ * Pre-filter of snzip format version 3 for arrays of fixed-size elements
+ * such as integers and floats, enabled by --shuffle and --delta.
+ *
+ * Shuffling stores the first bytes of all elements in a block, then the
+ * second bytes and so on. Bytes at the same position of similar numbers
+ * are often same or close, so snappy finds longer matches. With delta,
+ * each byte in these planes is replaced by the difference from the
+ * previous one, which makes counters and slowly changing values
+ * repetitive. Bytes after the last whole element are stored as they are.
+ *
+ * Element sizes 4 and 8 are shuffled by AVX2 when the CPU supports it.
+ * SNZIP_SHUFFLE=scalar disables it.
+ */
+int shuffle_elem_size;
+int shuffle_delta;
+
+typedef size_t (*shuffle_kernel_t)(char *out, const char *in, size_t n);
+
+static int kernels_initialized;
+static const char *kernel_name = "scalar";
+static shuffle_kernel_t shuffle4;
+static shuffle_kernel_t shuffle8;
+static shuffle_kernel_t unshuffle4;
+static shuffle_kernel_t unshuffle8;
+
+#ifdef HAVE_AVX2
+#if defined __GNUC__
+static int avx2_is_available(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#elif defined _MSC_VER
+static int avx2_is_available(void)
+{
+  int cpuinfo[4];
+
+  __cpuid(cpuinfo, 1);
+  if (!(cpuinfo[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+    /* OSXSAVE isn't set or the OS doesn't save YMM registers */
+    return 0;
+  }
+  __cpuid(cpuinfo, 0);
+  if (cpuinfo[0] < 7) {
+    return 0;
+  }
+  __cpuidex(cpuinfo, 7, 0);
+  return (cpuinfo[1] & (1 << 5)) != 0;
+}
+#else
+static int avx2_is_available(void)
+{
+  return 0;
+}
+#endif
+#endif
+
+static void init_kernels(void)
+{
+#ifdef HAVE_AVX2
+  const char *name = getenv("SNZIP_SHUFFLE");
+
+  if ((name == NULL || strcmp(name, "scalar") != 0) && avx2_is_available()) {
+    kernel_name = "avx2";
+    shuffle4 = shuffle4_avx2;
+    shuffle8 = shuffle8_avx2;
+    unshuffle4 = unshuffle4_avx2;
+    unshuffle8 = unshuffle8_avx2;
+  }
+#endif
+  kernels_initialized = TRUE;
+  trace("shuffle kernel: %s\n", kernel_name);
+}
+
+/* elements processed by the AVX2 kernel for 'elem_size' or zero */
+static size_t run_kernel(int shuffle, char *out, const char *in, size_t n, int elem_size)
+{
+  shuffle_kernel_t kernel = NULL;
+
+  if (!kernels_initialized) {
+    init_kernels();
+  }
+  if (elem_size == 4) {
+    kernel = shuffle ? shuffle4 : unshuffle4;
+  } else if (elem_size == 8) {
+    kernel = shuffle ? shuffle8 : unshuffle8;
+  }
+  return kernel ? kernel(out, in, n) : 0;
+}
+
+void shuffle_block(char *out, const char *in, size_t len, int elem_size, int delta)
+{
+  size_t n = len / elem_size;
+  size_t i;
+  int j;
+
+  i = run_kernel(TRUE, out, in, n, elem_size);
+  for (; i < n; i++) {
+    for (j = 0; j < elem_size; j++) {
+      out[j * n + i] = in[i * elem_size + j];
+    }
+  }
+  if (delta) {
+    for (j = 0; j < elem_size; j++) {
+      unsigned char *p = (unsigned char *)out + j * n;
+      unsigned char prev = 0;
+      for (i = 0; i < n; i++) {
+        unsigned char cur = p[i];
+        p[i] = cur - prev;
+        prev = cur;
+      }
+    }
+  }
+  memcpy(out + n * elem_size, in + n * elem_size, len - n * elem_size);
+}
+
+/* 'in' is modified when 'delta' is true */
+void unshuffle_block(char *out, char *in, size_t len, int elem_size, int delta)
+{
+  size_t n = len / elem_size;
+  size_t i;
+  int j;
+
+  if (delta) {
+    for (j = 0; j < elem_size; j++) {
+      unsigned char *p = (unsigned char *)in + j * n;
+      unsigned char sum = 0;
+      for (i = 0; i < n; i++) {
+        sum += p[i];
+        p[i] = sum;
+      }
+    }
+  }
+  i = run_kernel(FALSE, out, in, n, elem_size);
+  for (; i < n; i++) {
+    for (j = 0; j < elem_size; j++) {
+      out[i * elem_size + j] = in[j * n + i];
+    }
+  }
+  memcpy(out + n * elem_size, in + n * elem_size, len - n * elem_size);
+}
@@ -0,0 +1,186 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <immintrin.h>
+#include "snzip.h"
+
+/*
+ * AVX2 kernels of --shuffle for 4- and 8-byte elements. They process
+ * whole groups of 32 (4-byte) or 16 (8-byte) elements and return the
+ * number of processed elements. The rest is done by the scalar code.
+ * Plane j of 'n' elements starts at out + j * n.
+ *
+ * This file is compiled with AVX2 enabled. Don't call these functions
+ * unless the CPU supports it.
+ */
+
+/* 4x4 byte transposition in each 128-bit lane. It is self-inverse. */
+#define TRANSPOSE4x4 _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, \
+                                      0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15)
+
+size_t shuffle4_avx2(char *out, const char *in, size_t n)
+{
+  const __m256i mask = TRANSPOSE4x4;
+  /* gather the same planes of two lanes into 64-bit words */
+  const __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    const __m256i *src = (const __m256i *)(in + i * 4);
+    __m256i v0 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_loadu_si256(src + 0), mask), perm);
+    __m256i v1 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_loadu_si256(src + 1), mask), perm);
+    __m256i v2 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_loadu_si256(src + 2), mask), perm);
+    __m256i v3 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_loadu_si256(src + 3), mask), perm);
+    /* vK has 64-bit words of planes 0, 1, 2 and 3 of elements i + 8K ... i + 8K + 7 */
+    __m256i t0 = _mm256_unpacklo_epi64(v0, v1);
+    __m256i t1 = _mm256_unpackhi_epi64(v0, v1);
+    __m256i t2 = _mm256_unpacklo_epi64(v2, v3);
+    __m256i t3 = _mm256_unpackhi_epi64(v2, v3);
+
+    _mm256_storeu_si256((__m256i *)(out + 0 * n + i), _mm256_permute2x128_si256(t0, t2, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 1 * n + i), _mm256_permute2x128_si256(t1, t3, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 2 * n + i), _mm256_permute2x128_si256(t0, t2, 0x31));
+    _mm256_storeu_si256((__m256i *)(out + 3 * n + i), _mm256_permute2x128_si256(t1, t3, 0x31));
+  }
+  return i;
+}
+
+size_t unshuffle4_avx2(char *out, const char *in, size_t n)
+{
+  const __m256i mask = TRANSPOSE4x4;
+  const __m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i p0 = _mm256_loadu_si256((const __m256i *)(in + 0 * n + i));
+    __m256i p1 = _mm256_loadu_si256((const __m256i *)(in + 1 * n + i));
+    __m256i p2 = _mm256_loadu_si256((const __m256i *)(in + 2 * n + i));
+    __m256i p3 = _mm256_loadu_si256((const __m256i *)(in + 3 * n + i));
+    __m256i t0 = _mm256_permute2x128_si256(p0, p2, 0x20);
+    __m256i t2 = _mm256_permute2x128_si256(p0, p2, 0x31);
+    __m256i t1 = _mm256_permute2x128_si256(p1, p3, 0x20);
+    __m256i t3 = _mm256_permute2x128_si256(p1, p3, 0x31);
+    __m256i *dst = (__m256i *)(out + i * 4);
+
+    _mm256_storeu_si256(dst + 0, _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t0, t1), perm), mask));
+    _mm256_storeu_si256(dst + 1, _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t0, t1), perm), mask));
+    _mm256_storeu_si256(dst + 2, _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t2, t3), perm), mask));
+    _mm256_storeu_si256(dst + 3, _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t2, t3), perm), mask));
+  }
+  return i;
+}
+
+/* interleave bytes of two 8-byte elements in each 128-bit lane */
+#define INTERLEAVE8 _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, \
+                                     0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15)
+#define DEINTERLEAVE8 _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, \
+                                       0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15)
+/* split 32-bit words of two planes into 8 bytes of each plane */
+#define SPLIT_PLANES _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15, \
+                                      0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15)
+#define JOIN_PLANES _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15, \
+                                     0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15)
+
+/* store planes 'k' and 'k + 1' of 16 elements from 'v' */
+static inline void store_plane_pair(char *out, size_t n, size_t i, int k, __m256i v, __m256i mask)
+{
+  v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, mask), 0xd8);
+  _mm_storeu_si128((__m128i *)(out + k * n + i), _mm256_castsi256_si128(v));
+  _mm_storeu_si128((__m128i *)(out + (k + 1) * n + i), _mm256_extracti128_si256(v, 1));
+}
+
+static inline __m256i load_plane_pair(const char *in, size_t n, size_t i, int k, __m256i mask)
+{
+  __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + k * n + i))),
+                                      _mm_loadu_si128((const __m128i *)(in + (k + 1) * n + i)), 1);
+  return _mm256_shuffle_epi8(_mm256_permute4x64_epi64(v, 0xd8), mask);
+}
+
+size_t shuffle8_avx2(char *out, const char *in, size_t n)
+{
+  const __m256i interleave = INTERLEAVE8;
+  const __m256i split = SPLIT_PLANES;
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const __m256i *src = (const __m256i *)(in + i * 8);
+    __m256i l0 = _mm256_loadu_si256(src + 0);
+    __m256i l1 = _mm256_loadu_si256(src + 1);
+    __m256i l2 = _mm256_loadu_si256(src + 2);
+    __m256i l3 = _mm256_loadu_si256(src + 3);
+    /* elements 2K and 2K + 1 in the lower lane of vK, 2K + 8 and 2K + 9 in the upper one */
+    __m256i v0 = _mm256_shuffle_epi8(_mm256_permute2x128_si256(l0, l2, 0x20), interleave);
+    __m256i v1 = _mm256_shuffle_epi8(_mm256_permute2x128_si256(l0, l2, 0x31), interleave);
+    __m256i v2 = _mm256_shuffle_epi8(_mm256_permute2x128_si256(l1, l3, 0x20), interleave);
+    __m256i v3 = _mm256_shuffle_epi8(_mm256_permute2x128_si256(l1, l3, 0x31), interleave);
+    __m256i a = _mm256_unpacklo_epi32(v0, v1);
+    __m256i b = _mm256_unpackhi_epi32(v0, v1);
+    __m256i c = _mm256_unpacklo_epi32(v2, v3);
+    __m256i d = _mm256_unpackhi_epi32(v2, v3);
+
+    store_plane_pair(out, n, i, 0, _mm256_unpacklo_epi64(a, c), split);
+    store_plane_pair(out, n, i, 2, _mm256_unpackhi_epi64(a, c), split);
+    store_plane_pair(out, n, i, 4, _mm256_unpacklo_epi64(b, d), split);
+    store_plane_pair(out, n, i, 6, _mm256_unpackhi_epi64(b, d), split);
+  }
+  return i;
+}
+
+size_t unshuffle8_avx2(char *out, const char *in, size_t n)
+{
+  const __m256i deinterleave = DEINTERLEAVE8;
+  const __m256i join = JOIN_PLANES;
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m256i e = load_plane_pair(in, n, i, 0, join);
+    __m256i f = load_plane_pair(in, n, i, 2, join);
+    __m256i g = load_plane_pair(in, n, i, 4, join);
+    __m256i h = load_plane_pair(in, n, i, 6, join);
+    __m256i a = _mm256_shuffle_epi32(_mm256_unpacklo_epi64(e, f), 0xd8);
+    __m256i c = _mm256_shuffle_epi32(_mm256_unpackhi_epi64(e, f), 0xd8);
+    __m256i b = _mm256_shuffle_epi32(_mm256_unpacklo_epi64(g, h), 0xd8);
+    __m256i d = _mm256_shuffle_epi32(_mm256_unpackhi_epi64(g, h), 0xd8);
+    __m256i v0 = _mm256_shuffle_epi8(_mm256_unpacklo_epi64(a, b), deinterleave);
+    __m256i v1 = _mm256_shuffle_epi8(_mm256_unpackhi_epi64(a, b), deinterleave);
+    __m256i v2 = _mm256_shuffle_epi8(_mm256_unpacklo_epi64(c, d), deinterleave);
+    __m256i v3 = _mm256_shuffle_epi8(_mm256_unpackhi_epi64(c, d), deinterleave);
+    __m256i *dst = (__m256i *)(out + i * 8);
+
+    _mm256_storeu_si256(dst + 0, _mm256_permute2x128_si256(v0, v1, 0x20));
+    _mm256_storeu_si256(dst + 1, _mm256_permute2x128_si256(v2, v3, 0x20));
+    _mm256_storeu_si256(dst + 2, _mm256_permute2x128_si256(v0, v1, 0x31));
+    _mm256_storeu_si256(dst + 3, _mm256_permute2x128_si256(v2, v3, 0x31));
+  }
+  return i;
+}
@@ -55,26 +55,42 @@ static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
   size_t compressed_data_len;
   char *uncompressed_data = malloc(max_uncompressed_data_len);
   char *compressed_data = malloc(max_compressed_data_len);
+  incompressible_detector_t detector;
+  dedup_cache_t dedup;
+  chunker_t chunker;
   int err = 1;
 
+  dedup_cache_init(&dedup, dedup_cache_blocks);
   if (uncompressed_data == NULL || compressed_data == NULL) {
     print_error("out of memory\n");
     goto cleanup;
   }
+  incompressible_detector_init(&detector);
 
   /* write the steam header */
   fwrite(stream_header, sizeof(stream_header), 1, outfp);
 
   /* write file body */
-  while ((uncompressed_data_len = fread(uncompressed_data, 1, max_uncompressed_data_len, infp)) > 0) {
+  chunker_init(&chunker);
+  while ((uncompressed_data_len = chunker_read(&chunker, uncompressed_data, max_uncompressed_data_len, infp)) > 0) {
     unsigned int crc32c = masked_crc32c(uncompressed_data, uncompressed_data_len);
+    const char *compressed = compressed_data;
     char type_code;
     size_t write_len;
     const char *write_data;
 
-    /* compress the block. */
-    compressed_data_len = max_compressed_data_len;
-    snappy_compress(uncompressed_data, uncompressed_data_len, compressed_data, &compressed_data_len);
+    /* compress the block unless it is detected as incompressible or compressed before.
+     * The detector sees every block so that the output doesn't depend on --dedup. */
+    if (is_incompressible(&detector, uncompressed_data, uncompressed_data_len)) {
+      compressed_data_len = uncompressed_data_len;
+    } else if (dedup_cache_find(&dedup, crc32c, uncompressed_data, uncompressed_data_len, &compressed, &compressed_data_len)) {
+      /* use the cached compressed data */
+    } else {
+      compressed_data_len = max_compressed_data_len;
+      snappy_compress(uncompressed_data, uncompressed_data_len, compressed_data, &compressed_data_len);
+      dedup_cache_add(&dedup, crc32c, uncompressed_data, uncompressed_data_len, compressed_data, compressed_data_len);
+    }
+    incompressible_detector_update(&detector, uncompressed_data_len, compressed_data_len);
 
     if (compressed_data_len >= (uncompressed_data_len - (uncompressed_data_len / 8))) {
       /* uncompressed data */
@@ -85,7 +101,7 @@ static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
       /* compressed data */
       type_code = COMPRESSED_DATA_IDENTIFIER;
       write_len = compressed_data_len;
-      write_data = compressed_data;
+      write_data = compressed;
     }
 
     /* write block type */
@@ -109,14 +125,18 @@ static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  incompressible_detector_report(&detector);
+  dedup_cache_report(&dedup);
   if (ferror(outfp)) {
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  chunker_report(&chunker);
   err = 0;
  cleanup:
   free(uncompressed_data);
   free(compressed_data);
+  dedup_cache_free(&dedup);
   return err;
 }
 
@@ -137,28 +157,30 @@ static int read_data(char *buf, size_t buflen, FILE *fp)
  * Callers must ensure that the checksum pointer is aligned to a 4 byte boundary
  * if the CPU disallows unaligned accesss.
  */
-static int check_crc32c(const char *data, size_t datalen, const char *checksum)
+static unsigned int get_crc32c(const char *checksum)
 {
-  unsigned int actual_crc32c = masked_crc32c(data, datalen);
-  unsigned int expected_crc32c = SNZ_FROM_LE32(*(unsigned int*)checksum);
-  if (actual_crc32c != expected_crc32c) {
-    print_error("CRC32C error! (expected 0x%08x but 0x%08x)\n", expected_crc32c, actual_crc32c);
-    return -1;
-  }
-  return 0;
+  return SNZ_FROM_LE32(*(unsigned int*)checksum);
 }
 
-static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+/*
+ * Uncompress chunks overlapping the byte range. Other chunks are skipped
+ * without being uncompressed.
+ */
+static int framing_format_uncompress_chunks(FILE *infp, FILE *outfp, int skip_magic, byte_range_t *br)
 {
   const size_t max_data_len = MAX_DATA_LEN;
   const size_t max_uncompressed_data_len = MAX_UNCOMPRESSED_DATA_LEN;
   size_t data_len;
   size_t uncompressed_data_len;
+  size_t head_len;
+  size_t write_offset;
+  size_t write_len;
   char *data = malloc(max_data_len);
-  char *uncompressed_data = malloc(max_uncompressed_data_len);
+  char *uncompressed_data;
+  crc_verifier_t *cv = NULL;
   int err = 1;
 
-  if (data == NULL || uncompressed_data == NULL) {
+  if (data == NULL) {
     print_error("out of memory\n");
     goto cleanup;
   }
@@ -174,7 +196,15 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     }
   }
 
-  for (;;) {
+  /* Checksums are verified and uncompressed data are written by
+   * the crc verifier while the next chunk is uncompressed.
+   */
+  cv = crc_verifier_create(outfp, max_uncompressed_data_len);
+  if (cv == NULL) {
+    goto cleanup;
+  }
+
+  while (!byte_range_done(br)) {
     int id = getc(infp);
     if (id == EOF) {
       break;
@@ -191,34 +221,66 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
         print_error("too short data length %lu\n", data_len);
         goto cleanup;
       }
-      if (read_data(data, data_len, infp) != 0) {
+      /* read the checksum and the head of the compressed data */
+      if (read_data(data, 4, infp) != 0
+          || read_uncompressed_length(infp, data + 4, data_len - 4, &head_len, &uncompressed_data_len) != 0) {
+        goto cleanup;
+      }
+      if (uncompressed_data_len > max_uncompressed_data_len) {
+        print_error("Invalid data: too long uncompressed length %lu\n", uncompressed_data_len);
         goto cleanup;
       }
+      if (byte_range_skip(br, uncompressed_data_len)) {
+        if (skip_input(infp, data_len - 4 - head_len) != 0) {
+          goto cleanup;
+        }
+        continue;
+      }
+      if (data_len - 4 > head_len && read_data(data + 4 + head_len, data_len - 4 - head_len, infp) != 0) {
+        goto cleanup;
+      }
+      uncompressed_data = crc_verifier_buffer(cv);
       uncompressed_data_len = max_uncompressed_data_len;
       if (snappy_uncompress(data + 4, data_len - 4, uncompressed_data, &uncompressed_data_len)) {
         print_error("Invalid data: snappy_uncompress failed\n");
         goto cleanup;
       }
-      if (check_crc32c(uncompressed_data, uncompressed_data_len, data) != 0) {
+      write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+      if (crc_verifier_submit(cv, uncompressed_data, uncompressed_data_len, get_crc32c(data), write_offset, write_len) != 0) {
         goto cleanup;
       }
-      if (fwrite(uncompressed_data, uncompressed_data_len, 1, outfp) != 1) {
-        break;
-      }
     } else if (id == UNCOMPRESSED_DATA_IDENTIFIER) {
       /* 4.3. Uncompressed data (chunk type 0x01) */
       if (data_len < 4) {
         print_error("too short data length %lu\n", data_len);
         goto cleanup;
       }
-      if (read_data(data, data_len, infp) != 0) {
-        goto cleanup;
-      }
-      if (check_crc32c(data + 4, data_len - 4, data) != 0) {
-        goto cleanup;
+      uncompressed_data_len = data_len - 4;
+      if (byte_range_skip(br, uncompressed_data_len)) {
+        if (skip_input(infp, data_len) != 0) {
+          goto cleanup;
+        }
+        continue;
       }
-      if (fwrite(data + 4, data_len - 4, 1, outfp) != 1) {
-        break;
+      if (uncompressed_data_len <= max_uncompressed_data_len) {
+        /* read the data into a buffer passed to the crc verifier directly. */
+        uncompressed_data = crc_verifier_buffer(cv);
+        if (read_data(data, 4, infp) != 0
+            || (uncompressed_data_len > 0 && read_data(uncompressed_data, uncompressed_data_len, infp) != 0)) {
+          goto cleanup;
+        }
+        write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+        if (crc_verifier_submit(cv, uncompressed_data, uncompressed_data_len, get_crc32c(data), write_offset, write_len) != 0) {
+          goto cleanup;
+        }
+      } else {
+        if (read_data(data, data_len, infp) != 0) {
+          goto cleanup;
+        }
+        write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+        if (crc_verifier_write(cv, data + 4, uncompressed_data_len, get_crc32c(data), write_offset, write_len) != 0) {
+          goto cleanup;
+        }
       }
     } else if (id < 0x80) {
       /* 4.4. Reserved unskippable chunks (chunk types 0x02-0x7f) */
@@ -226,11 +288,8 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
       goto cleanup;
     } else {
       /* 4.5. Reserved skippable chunks (chunk types 0x80-0xfe) */
-      while (data_len-- > 0) {
-        if (getc(infp) == EOF) {
-          print_error("Unexpected end of file\n");
-          goto cleanup;
-        }
+      if (skip_input(infp, data_len) != 0) {
+        goto cleanup;
       }
     }
   }
@@ -239,21 +298,170 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
-  if (ferror(outfp)) {
-    print_error("Failed to write a file: %s\n", strerror(errno));
+  err = crc_verifier_finish(cv) ? 1 : 0;
+  cv = NULL;
+ cleanup:
+  if (cv != NULL) {
+    crc_verifier_finish(cv);
+  }
+  free(data);
+  return err;
+}
+
+static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+{
+  byte_range_t br;
+
+  byte_range_init(&br, 0, UINT64_MAX);
+  return framing_format_uncompress_chunks(infp, outfp, skip_magic, &br);
+}
+
+static int framing_format_uncompress_range(FILE *infp, FILE *outfp, int skip_magic, uint64_t offset, uint64_t length)
+{
+  byte_range_t br;
+
+  byte_range_init(&br, offset, length);
+  return framing_format_uncompress_chunks(infp, outfp, skip_magic, &br);
+}
+
+/*
+ * The stream identifier may appear more than once in a stream.
+ * Files are copied as they are.
+ */
+static int framing_format_concat(int infd, int outfd, uint64_t size, int first)
+{
+  char header[sizeof(stream_header)];
+
+  if (size < sizeof(stream_header) || pread_full(infd, header, sizeof(header), 0) != 0
+      || memcmp(header, stream_header, sizeof(stream_header)) != 0) {
+    print_error("Invalid stream header\n");
+    return -1;
+  }
+  return copy_data(outfd, infd, 0, size);
+}
+
+static int framing_format_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
+{
+  work_buffer_t wb;
+  char header[sizeof(stream_header)];
+  int err = 1;
+
+  work_buffer_init(&wb, MAX_UNCOMPRESSED_DATA_LEN);
+  if (!skip_magic) {
+    if (read_data(header, sizeof(header), infp) != 0) {
+      goto cleanup;
+    }
+    if (memcmp(header, stream_header, sizeof(stream_header)) != 0) {
+      print_error("Invalid stream identfier\n");
+      goto cleanup;
+    }
+  }
+  for (;;) {
+    snappy_block_t blk;
+    size_t data_len;
+    int id = getc(infp);
+
+    if (id == EOF) {
+      break;
+    }
+    data_len = getc(infp);
+    data_len |= getc(infp) << 8;
+    if (feof(infp)) {
+      print_error("Unexpected end of file\n");
+      goto cleanup;
+    }
+    if (id != COMPRESSED_DATA_IDENTIFIER && id != UNCOMPRESSED_DATA_IDENTIFIER) {
+      if (id < 0x80) {
+        print_error("Unsupported identifier 0x%02x\n", id);
+        goto cleanup;
+      }
+      /* Skippable chunks such as stream identifiers and padding are dropped. */
+      if (skip_input(infp, data_len) != 0) {
+        goto cleanup;
+      }
+      continue;
+    }
+    if (data_len < 4) {
+      print_error("too short data length %lu\n", (unsigned long)data_len);
+      goto cleanup;
+    }
+    if (read_compressed_data(infp, &wb, data_len) != 0) {
+      goto cleanup;
+    }
+    blk.data = wb.c + 4;
+    blk.len = data_len - 4;
+    blk.compressed = (id == COMPRESSED_DATA_IDENTIFIER);
+    blk.has_crc = TRUE;
+    blk.crc32c = get_crc32c(wb.c);
+    if (!blk.compressed) {
+      blk.uncompressed_len = blk.len;
+    } else if (snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK) {
+      print_error("Invalid data: snappy_uncompressed_length failed\n");
+      goto cleanup;
+    }
+    if (blk.uncompressed_len > MAX_UNCOMPRESSED_DATA_LEN) {
+      print_error("Invalid data: too long uncompressed length %lu\n", (unsigned long)blk.uncompressed_len);
+      goto cleanup;
+    }
+    if (handler(ctx, &blk) != 0) {
+      goto cleanup;
+    }
+  }
+  if (ferror(infp)) {
+    print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
   err = 0;
  cleanup:
-  free(data);
-  free(uncompressed_data);
+  work_buffer_free(&wb);
   return err;
 }
 
+static int framing_format_write_header(FILE *outfp, size_t block_size, void **state)
+{
+  if (fwrite(stream_header, sizeof(stream_header), 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int framing_format_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  putc(blk->compressed ? COMPRESSED_DATA_IDENTIFIER : UNCOMPRESSED_DATA_IDENTIFIER, outfp);
+  putc(((blk->len + 4) >> 0), outfp);
+  putc(((blk->len + 4) >> 8), outfp);
+  putc((blk->crc32c >>  0), outfp);
+  putc((blk->crc32c >>  8), outfp);
+  putc((blk->crc32c >> 16), outfp);
+  putc((blk->crc32c >> 24), outfp);
+  if (fwrite(blk->data, blk->len, 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static const block_writer_t framing_format_block_writer = {
+  MAX_UNCOMPRESSED_DATA_LEN,
+  MAX_UNCOMPRESSED_DATA_LEN,
+  MAX_DATA_LEN - 4,
+  TRUE,
+  TRUE,
+  FALSE,
+  framing_format_write_header,
+  framing_format_write_block,
+  NULL,
+};
+
 stream_format_t framing_format = {
   "framing",
   "https://github.com/google/snappy/blob/0755c815197dacc77d8971ae917c86d7aa96bf8e/framing_format.txt",
   "sz",
   framing_format_compress,
   framing_format_uncompress,
+  framing_format_uncompress_range,
+  framing_format_concat,
+  framing_format_read_blocks,
+  &framing_format_block_writer,
 };
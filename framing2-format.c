@@ -34,9 +34,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <snappy-c.h>
 #include "snzip.h"
 #include "crc32.h"
+#ifdef WIN32
+#define stat _stati64
+#define fstat _fstati64
+#endif
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
 
 #define COMPRESSED_DATA_IDENTIFIER 0x00
 #define UNCOMPRESSED_DATA_IDENTIFIER 0x01
@@ -47,6 +56,150 @@ static const char stream_header[10] = {0xff, 0x06, 0x00, 0x00, 0x73, 0x4e, 0x61,
 #define MAX_DATA_LEN 16777215 /* maximum chunk data length */
 #define MAX_UNCOMPRESSED_DATA_LEN 65536 /* maximum uncompressed data length excluding checksum */
 
+/*
+ * Chunk index written by --seekable.
+ *
+ * The index is stored in a skippable chunk followed by a fixed-size
+ * locator chunk at the end of the stream. Decoders not aware of them
+ * skip both as they are skippable chunks.
+ *
+ * index chunk (0xf0):
+ *   masked crc32c of the rest (4 bytes)
+ *   number of chunks per entry (4 bytes)
+ *   number of entries (4 bytes)
+ *   total uncompressed length (8 bytes)
+ *   entries: uncompressed offset (8 bytes), compressed offset (8 bytes)
+ *
+ * locator chunk (0xf1):
+ *   masked crc32c of the rest (4 bytes)
+ *   compressed offset of the index chunk (8 bytes)
+ *
+ * All integers are little endian. Compressed offsets are relative to
+ * the stream identifier.
+ */
+#define INDEX_IDENTIFIER 0xf0
+#define INDEX_LOCATOR_IDENTIFIER 0xf1
+#define INDEX_HEADER_LEN 20
+#define INDEX_ENTRY_LEN 16
+#define INDEX_LOCATOR_LEN 16 /* including the chunk header */
+#define MAX_INDEX_ENTRIES ((MAX_DATA_LEN - INDEX_HEADER_LEN) / INDEX_ENTRY_LEN)
+
+/*
+ * Padding chunks written by --align.
+ *
+ * A padding chunk (0xfe) is inserted before a data chunk when the chunk
+ * doesn't start at a multiple of the alignment. As a padding chunk
+ * needs at least 4 bytes, a gap shorter than that is extended by one
+ * more alignment unit.
+ */
+#define PADDING_IDENTIFIER 0xfe
+
+typedef struct {
+  uint64_t uncompressed_offset;
+  uint64_t compressed_offset;
+} index_entry_t;
+
+typedef struct {
+  uint32_t interval; /* number of chunks per entry */
+  size_t num_entries;
+  size_t max_entries;
+  uint64_t total_length;
+  uint64_t offset; /* compressed offset of the index chunk */
+  index_entry_t *entries;
+} chunk_index_t;
+
+static int add_index_entry(chunk_index_t *idx, uint64_t uncompressed_offset, uint64_t compressed_offset)
+{
+  if (idx->num_entries == MAX_INDEX_ENTRIES) {
+    /* drop every other entry not to exceed the maximum chunk length. */
+    size_t i;
+    for (i = 0; i < idx->num_entries / 2; i++) {
+      idx->entries[i] = idx->entries[i * 2];
+    }
+    idx->num_entries /= 2;
+    idx->interval *= 2;
+    trace("chunk index interval is changed to %u\n", idx->interval);
+  }
+  if (idx->num_entries == idx->max_entries) {
+    size_t max_entries = idx->max_entries ? idx->max_entries * 2 : 1024;
+    index_entry_t *entries = realloc(idx->entries, max_entries * sizeof(index_entry_t));
+    if (entries == NULL) {
+      print_error("out of memory\n");
+      return -1;
+    }
+    idx->entries = entries;
+    idx->max_entries = max_entries;
+  }
+  idx->entries[idx->num_entries].uncompressed_offset = uncompressed_offset;
+  idx->entries[idx->num_entries].compressed_offset = compressed_offset;
+  idx->num_entries++;
+  return 0;
+}
+
+static int write_index(FILE *outfp, const chunk_index_t *idx)
+{
+  size_t data_len = INDEX_HEADER_LEN + idx->num_entries * INDEX_ENTRY_LEN;
+  char *data = malloc(4 + data_len);
+  char locator[INDEX_LOCATOR_LEN];
+  char *p;
+  size_t i;
+  int err = -1;
+
+  if (data == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  /* index chunk */
+  data[0] = INDEX_IDENTIFIER;
+  snz_put_le(data + 1, data_len, 3);
+  snz_put_le(data + 8, idx->interval, 4);
+  snz_put_le(data + 12, idx->num_entries, 4);
+  snz_put_le(data + 16, idx->total_length, 8);
+  p = data + 4 + INDEX_HEADER_LEN;
+  for (i = 0; i < idx->num_entries; i++) {
+    snz_put_le(p, idx->entries[i].uncompressed_offset, 8);
+    snz_put_le(p + 8, idx->entries[i].compressed_offset, 8);
+    p += INDEX_ENTRY_LEN;
+  }
+  snz_put_le(data + 4, masked_crc32c(data + 8, data_len - 4), 4);
+
+  /* locator chunk */
+  locator[0] = INDEX_LOCATOR_IDENTIFIER;
+  snz_put_le(locator + 1, INDEX_LOCATOR_LEN - 4, 3);
+  snz_put_le(locator + 8, idx->offset, 8);
+  snz_put_le(locator + 4, masked_crc32c(locator + 8, 8), 4);
+
+  if (fwrite(data, 4 + data_len, 1, outfp) != 1 || fwrite(locator, sizeof(locator), 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  trace("write chunk index: %lu entries, %u chunks per entry\n", (unsigned long)idx->num_entries, idx->interval);
+  err = 0;
+ cleanup:
+  free(data);
+  return err;
+}
+
+static int write_padding(FILE *outfp, size_t len)
+{
+  static const char zeros[4096];
+
+  putc(PADDING_IDENTIFIER, outfp);
+  putc(((len - 4) >> 0), outfp);
+  putc(((len - 4) >> 8), outfp);
+  putc(((len - 4) >> 16), outfp);
+  len -= 4;
+  while (len > 0) {
+    size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+    if (fwrite(zeros, n, 1, outfp) != 1) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
+      return -1;
+    }
+    len -= n;
+  }
+  return 0;
+}
+
 static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
 {
   const size_t max_uncompressed_data_len = MAX_UNCOMPRESSED_DATA_LEN;
@@ -55,26 +208,72 @@ static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
   size_t compressed_data_len;
   char *uncompressed_data = malloc(max_uncompressed_data_len);
   char *compressed_data = malloc(max_compressed_data_len);
+  chunk_index_t idx = {0, };
+  uint64_t num_chunks = 0;
+  uint64_t compressed_offset = sizeof(stream_header);
+  uint64_t padding_len = 0;
+  incompressible_detector_t detector;
+  constant_block_t constant;
+  dedup_cache_t dedup;
+  chunker_t chunker;
   int err = 1;
 
+  constant_block_init(&constant);
+  dedup_cache_init(&dedup, dedup_cache_blocks);
   if (uncompressed_data == NULL || compressed_data == NULL) {
     print_error("out of memory\n");
     goto cleanup;
   }
+  idx.interval = framing2_index_interval;
+  incompressible_detector_init(&detector);
 
   /* write the steam header */
   fwrite(stream_header, sizeof(stream_header), 1, outfp);
 
   /* write file body */
-  while ((uncompressed_data_len = fread(uncompressed_data, 1, max_uncompressed_data_len, infp)) > 0) {
-    unsigned int crc32c = masked_crc32c(uncompressed_data, uncompressed_data_len);
+  chunker_init(&chunker);
+  while ((uncompressed_data_len = chunker_read(&chunker, uncompressed_data, max_uncompressed_data_len, infp)) > 0) {
+    const constant_block_t *cb = find_constant_block(&constant, uncompressed_data, uncompressed_data_len);
+    unsigned int crc32c = cb ? cb->crc32c : masked_crc32c(uncompressed_data, uncompressed_data_len);
+    const char *compressed = compressed_data;
     char type_code;
     size_t write_len;
     const char *write_data;
 
-    /* compress the block. */
-    compressed_data_len = max_compressed_data_len;
-    snappy_compress(uncompressed_data, uncompressed_data_len, compressed_data, &compressed_data_len);
+    if (framing2_alignment != 0 && num_chunks % framing2_align_interval == 0) {
+      size_t gap = (framing2_alignment - compressed_offset % framing2_alignment) % framing2_alignment;
+      if (gap != 0) {
+        if (gap < 4) {
+          gap += framing2_alignment;
+        }
+        if (write_padding(outfp, gap) != 0) {
+          goto cleanup;
+        }
+        compressed_offset += gap;
+        padding_len += gap;
+      }
+    }
+    if (idx.interval != 0 && num_chunks % idx.interval == 0) {
+      if (add_index_entry(&idx, idx.total_length, compressed_offset) != 0) {
+        goto cleanup;
+      }
+    }
+
+    /* compress the block unless it is constant, detected as incompressible or compressed before.
+     * The detector sees every block so that the output doesn't depend on --dedup. */
+    if (cb != NULL) {
+      compressed = cb->compressed;
+      compressed_data_len = cb->compressed_len;
+    } else if (is_incompressible(&detector, uncompressed_data, uncompressed_data_len)) {
+      compressed_data_len = uncompressed_data_len;
+    } else if (dedup_cache_find(&dedup, crc32c, uncompressed_data, uncompressed_data_len, &compressed, &compressed_data_len)) {
+      /* use the cached compressed data */
+    } else {
+      compressed_data_len = max_compressed_data_len;
+      snappy_compress(uncompressed_data, uncompressed_data_len, compressed_data, &compressed_data_len);
+      dedup_cache_add(&dedup, crc32c, uncompressed_data, uncompressed_data_len, compressed_data, compressed_data_len);
+    }
+    incompressible_detector_update(&detector, uncompressed_data_len, compressed_data_len);
 
     if (compressed_data_len >= (uncompressed_data_len - (uncompressed_data_len / 8))) {
       /* uncompressed data */
@@ -85,7 +284,7 @@ static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
       /* compressed data */
       type_code = COMPRESSED_DATA_IDENTIFIER;
       write_len = compressed_data_len;
-      write_data = compressed_data;
+      write_data = compressed;
     }
 
     /* write block type */
@@ -104,20 +303,41 @@ static int framing_format_compress(FILE *infp, FILE *outfp, size_t block_size)
       print_error("Failed to write a file: %s\n", strerror(errno));
       goto cleanup;
     }
+    num_chunks++;
+    compressed_offset += 8 + write_len;
+    idx.total_length += uncompressed_data_len;
   }
   /* check stream errors */
   if (ferror(infp)) {
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  incompressible_detector_report(&detector);
+  constant_block_report(&constant);
+  dedup_cache_report(&dedup);
+  if (framing2_alignment != 0) {
+    trace("padding: %llu bytes in %llu bytes (%.2f%%)\n",
+          (unsigned long long)padding_len, (unsigned long long)compressed_offset,
+          compressed_offset ? padding_len * 100.0 / compressed_offset : 0.0);
+  }
+  if (idx.interval != 0) {
+    idx.offset = compressed_offset;
+    if (write_index(outfp, &idx) != 0) {
+      goto cleanup;
+    }
+  }
   if (ferror(outfp)) {
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  chunker_report(&chunker);
   err = 0;
  cleanup:
   free(uncompressed_data);
   free(compressed_data);
+  free(idx.entries);
+  constant_block_free(&constant);
+  dedup_cache_free(&dedup);
   return err;
 }
 
@@ -138,28 +358,32 @@ static int read_data(char *buf, size_t buflen, FILE *fp)
  * Callers must ensure that the checksum pointer is aligned to a 4 byte boundary
  * if the CPU disallows unaligned accesss.
  */
-static int check_crc32c(const char *data, size_t datalen, const char *checksum)
+static unsigned int get_crc32c(const char *checksum)
 {
-  unsigned int actual_crc32c = masked_crc32c(data, datalen);
-  unsigned int expected_crc32c = SNZ_FROM_LE32(*(unsigned int*)checksum);
-  if (actual_crc32c != expected_crc32c) {
-    print_error("CRC32C error! (expected 0x%08x but 0x%08x)\n", expected_crc32c, actual_crc32c);
-    return -1;
-  }
-  return 0;
+  return SNZ_FROM_LE32(*(unsigned int*)checksum);
 }
 
-static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+/*
+ * Uncompress chunks overlapping the byte range. Other chunks are skipped
+ * without being uncompressed.
+ */
+static int framing_format_uncompress_chunks(FILE *infp, FILE *outfp, int skip_magic, byte_range_t *br)
 {
   const size_t max_data_len = MAX_DATA_LEN;
   const size_t max_uncompressed_data_len = MAX_UNCOMPRESSED_DATA_LEN;
   size_t data_len;
   size_t uncompressed_data_len;
+  size_t head_len;
+  size_t write_offset;
+  size_t write_len;
   char *data = malloc(max_data_len);
-  char *uncompressed_data = malloc(max_uncompressed_data_len);
+  char *uncompressed_data;
+  crc_verifier_t *cv = NULL;
+  constant_block_t constant;
   int err = 1;
 
-  if (data == NULL || uncompressed_data == NULL) {
+  constant_block_init(&constant);
+  if (data == NULL) {
     print_error("out of memory\n");
     goto cleanup;
   }
@@ -175,7 +399,15 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     }
   }
 
-  for (;;) {
+  /* Checksums are verified and uncompressed data are written by
+   * the crc verifier while the next chunk is uncompressed.
+   */
+  cv = crc_verifier_create(outfp, max_uncompressed_data_len);
+  if (cv == NULL) {
+    goto cleanup;
+  }
+
+  while (!byte_range_done(br)) {
     int id = getc(infp);
     if (id == EOF) {
       break;
@@ -193,19 +425,36 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
         print_error("too short data length %lu\n", data_len);
         goto cleanup;
       }
-      if (read_data(data, data_len, infp) != 0) {
+      /* read the checksum and the head of the compressed data */
+      if (read_data(data, 4, infp) != 0
+          || read_uncompressed_length(infp, data + 4, data_len - 4, &head_len, &uncompressed_data_len) != 0) {
         goto cleanup;
       }
-      uncompressed_data_len = max_uncompressed_data_len;
-      if (snappy_uncompress(data + 4, data_len - 4, uncompressed_data, &uncompressed_data_len)) {
-        print_error("Invalid data: snappy_uncompress failed\n");
+      if (uncompressed_data_len > max_uncompressed_data_len) {
+        print_error("Invalid data: too long uncompressed length %lu\n", uncompressed_data_len);
         goto cleanup;
       }
-      if (check_crc32c(uncompressed_data, uncompressed_data_len, data) != 0) {
+      if (byte_range_skip(br, uncompressed_data_len)) {
+        if (skip_input(infp, data_len - 4 - head_len) != 0) {
+          goto cleanup;
+        }
+        continue;
+      }
+      if (data_len - 4 > head_len && read_data(data + 4 + head_len, data_len - 4 - head_len, infp) != 0) {
         goto cleanup;
       }
-      if (fwrite(uncompressed_data, uncompressed_data_len, 1, outfp) != 1) {
-        break;
+      uncompressed_data = crc_verifier_buffer(cv);
+      uncompressed_data_len = max_uncompressed_data_len;
+      if (!uncompress_constant_block(&constant, data + 4, data_len - 4, uncompressed_data, &uncompressed_data_len)) {
+        if (snappy_uncompress(data + 4, data_len - 4, uncompressed_data, &uncompressed_data_len)) {
+          print_error("Invalid data: snappy_uncompress failed\n");
+          goto cleanup;
+        }
+        remember_constant_block(&constant, data + 4, data_len - 4, uncompressed_data, uncompressed_data_len);
+      }
+      write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+      if (crc_verifier_submit(cv, uncompressed_data, uncompressed_data_len, get_crc32c(data), write_offset, write_len) != 0) {
+        goto cleanup;
       }
     } else if (id == UNCOMPRESSED_DATA_IDENTIFIER) {
       /* 4.3. Uncompressed data (chunk type 0x01) */
@@ -213,14 +462,32 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
         print_error("too short data length %lu\n", data_len);
         goto cleanup;
       }
-      if (read_data(data, data_len, infp) != 0) {
-        goto cleanup;
-      }
-      if (check_crc32c(data + 4, data_len - 4, data) != 0) {
-        goto cleanup;
+      uncompressed_data_len = data_len - 4;
+      if (byte_range_skip(br, uncompressed_data_len)) {
+        if (skip_input(infp, data_len) != 0) {
+          goto cleanup;
+        }
+        continue;
       }
-      if (fwrite(data + 4, data_len - 4, 1, outfp) != 1) {
-        break;
+      if (uncompressed_data_len <= max_uncompressed_data_len) {
+        /* read the data into a buffer passed to the crc verifier directly. */
+        uncompressed_data = crc_verifier_buffer(cv);
+        if (read_data(data, 4, infp) != 0
+            || (uncompressed_data_len > 0 && read_data(uncompressed_data, uncompressed_data_len, infp) != 0)) {
+          goto cleanup;
+        }
+        write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+        if (crc_verifier_submit(cv, uncompressed_data, uncompressed_data_len, get_crc32c(data), write_offset, write_len) != 0) {
+          goto cleanup;
+        }
+      } else {
+        if (read_data(data, data_len, infp) != 0) {
+          goto cleanup;
+        }
+        write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+        if (crc_verifier_write(cv, data + 4, uncompressed_data_len, get_crc32c(data), write_offset, write_len) != 0) {
+          goto cleanup;
+        }
       }
     } else if (id < 0x80) {
       /* 4.4. Reserved unskippable chunks (chunk types 0x02-0x7f) */
@@ -228,11 +495,8 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
       goto cleanup;
     } else {
       /* 4.5. Reserved skippable chunks (chunk types 0x80-0xfe) */
-      while (data_len-- > 0) {
-        if (getc(infp) == EOF) {
-          print_error("Unexpected end of file\n");
-          goto cleanup;
-        }
+      if (skip_input(infp, data_len) != 0) {
+        goto cleanup;
       }
     }
   }
@@ -241,6 +505,223 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  err = crc_verifier_finish(cv) ? 1 : 0;
+  cv = NULL;
+  constant_block_report(&constant);
+ cleanup:
+  if (cv != NULL) {
+    crc_verifier_finish(cv);
+  }
+  free(data);
+  constant_block_free(&constant);
+  return err;
+}
+
+static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+{
+  byte_range_t br;
+
+  byte_range_init(&br, 0, UINT64_MAX);
+  return framing_format_uncompress_chunks(infp, outfp, skip_magic, &br);
+}
+
+/*
+ * Read the chunk index at the end of the file.
+ * This returns 1 when the file has no index, isn't a regular file or
+ * consists of concatenated streams.
+ */
+static int read_index(int fd, chunk_index_t *idx)
+{
+  struct stat sbuf;
+  char locator[INDEX_LOCATOR_LEN];
+  char header[4];
+  uint64_t locator_offset;
+  size_t data_len;
+  char *data = NULL;
+  const char *p;
+  size_t i;
+
+  if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode)) {
+    return 1;
+  }
+  if (sbuf.st_size < sizeof(stream_header) + INDEX_LOCATOR_LEN) {
+    return 1;
+  }
+  locator_offset = sbuf.st_size - INDEX_LOCATOR_LEN;
+  if (pread_full(fd, locator, sizeof(locator), locator_offset) != 0) {
+    return -1;
+  }
+  if ((unsigned char)locator[0] != INDEX_LOCATOR_IDENTIFIER
+      || snz_get_le(locator + 1, 3) != INDEX_LOCATOR_LEN - 4
+      || snz_get_le(locator + 4, 4) != masked_crc32c(locator + 8, 8)) {
+    return 1;
+  }
+  idx->offset = snz_get_le(locator + 8, 8);
+  if (idx->offset > locator_offset - 4) {
+    print_error("Invalid chunk index locator\n");
+    return -1;
+  }
+  if (pread_full(fd, header, sizeof(header), idx->offset) != 0) {
+    return -1;
+  }
+  data_len = snz_get_le(header + 1, 3);
+  if ((unsigned char)header[0] != INDEX_IDENTIFIER
+      || data_len < INDEX_HEADER_LEN
+      || idx->offset + 4 + data_len != locator_offset) {
+    /* Offsets are relative to the start of the last stream when
+     * streams are concatenated. Walk chunk headers instead. */
+    trace("chunk index doesn't start at %llu\n", (unsigned long long)idx->offset);
+    return 1;
+  }
+  data = malloc(data_len);
+  if (data == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  if (pread_full(fd, data, data_len, idx->offset + 4) != 0) {
+    goto error;
+  }
+  if (snz_get_le(data, 4) != masked_crc32c(data + 4, data_len - 4)) {
+    print_error("Invalid chunk index: CRC32C error\n");
+    goto error;
+  }
+  idx->interval = snz_get_le(data + 4, 4);
+  idx->num_entries = snz_get_le(data + 8, 4);
+  idx->total_length = snz_get_le(data + 12, 8);
+  if (idx->num_entries != (data_len - INDEX_HEADER_LEN) / INDEX_ENTRY_LEN) {
+    print_error("Invalid chunk index: wrong number of entries\n");
+    goto error;
+  }
+  idx->entries = malloc((idx->num_entries + 1) * sizeof(index_entry_t));
+  if (idx->entries == NULL) {
+    print_error("out of memory\n");
+    goto error;
+  }
+  p = data + INDEX_HEADER_LEN;
+  for (i = 0; i < idx->num_entries; i++) {
+    idx->entries[i].uncompressed_offset = snz_get_le(p, 8);
+    idx->entries[i].compressed_offset = snz_get_le(p + 8, 8);
+    p += INDEX_ENTRY_LEN;
+  }
+  free(data);
+  trace("read chunk index: %lu entries, %u chunks per entry\n", (unsigned long)idx->num_entries, idx->interval);
+  return 0;
+ error:
+  free(data);
+  return -1;
+}
+
+/*
+ * Uncompress a byte range using the chunk index. Each run of chunks
+ * between two index entries is read by one pread and only chunks
+ * overlapping the range are uncompressed.
+ */
+static int uncompress_range_with_index(int fd, FILE *outfp, const chunk_index_t *idx, byte_range_t *br)
+{
+  char *data = NULL;
+  size_t data_size = 0;
+  char *uncompressed_data = malloc(MAX_UNCOMPRESSED_DATA_LEN);
+  size_t lo, hi;
+  int err = 1;
+
+  if (uncompressed_data == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+
+  /* find the last entry whose uncompressed offset <= the start of the range */
+  lo = 0;
+  hi = idx->num_entries;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (idx->entries[mid].uncompressed_offset <= br->start) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (; lo < idx->num_entries && !byte_range_done(br); lo++) {
+    uint64_t start_offset = idx->entries[lo].compressed_offset;
+    uint64_t end_offset = (lo + 1 < idx->num_entries) ? idx->entries[lo + 1].compressed_offset : idx->offset;
+    size_t span = end_offset - start_offset;
+    const char *p;
+
+    if (end_offset < start_offset) {
+      print_error("Invalid chunk index\n");
+      goto cleanup;
+    }
+    if (data_size < span) {
+      char *tmp = realloc(data, span);
+      if (tmp == NULL) {
+        print_error("out of memory\n");
+        goto cleanup;
+      }
+      data = tmp;
+      data_size = span;
+    }
+    trace("read %lu bytes at %llu\n", (unsigned long)span, (unsigned long long)start_offset);
+    if (pread_full(fd, data, span, start_offset) != 0) {
+      goto cleanup;
+    }
+
+    br->pos = idx->entries[lo].uncompressed_offset;
+    p = data;
+    while (p < data + span && !byte_range_done(br)) {
+      int id = (unsigned char)p[0];
+      size_t data_len;
+      size_t uncompressed_data_len;
+      size_t write_offset;
+      size_t write_len;
+      const char *out;
+
+      if (data + span - p < 4 || (data_len = snz_get_le(p + 1, 3)) > (size_t)(data + span - p - 4)) {
+        print_error("Invalid data: truncated chunk\n");
+        goto cleanup;
+      }
+      p += 4;
+      if (id == COMPRESSED_DATA_IDENTIFIER || id == UNCOMPRESSED_DATA_IDENTIFIER) {
+        if (data_len < 4) {
+          print_error("too short data length %lu\n", data_len);
+          goto cleanup;
+        }
+        if (id == COMPRESSED_DATA_IDENTIFIER) {
+          if (snappy_uncompressed_length(p + 4, data_len - 4, &uncompressed_data_len) != SNAPPY_OK
+              || uncompressed_data_len > MAX_UNCOMPRESSED_DATA_LEN) {
+            print_error("Invalid data: snappy_uncompressed_length failed\n");
+            goto cleanup;
+          }
+        } else {
+          uncompressed_data_len = data_len - 4;
+        }
+        if (!byte_range_skip(br, uncompressed_data_len)) {
+          if (id == COMPRESSED_DATA_IDENTIFIER) {
+            if (snappy_uncompress(p + 4, data_len - 4, uncompressed_data, &uncompressed_data_len)) {
+              print_error("Invalid data: snappy_uncompress failed\n");
+              goto cleanup;
+            }
+            out = uncompressed_data;
+          } else {
+            out = p + 4;
+          }
+          if (masked_crc32c(out, uncompressed_data_len) != snz_get_le(p, 4)) {
+            print_error("CRC32C error! (expected 0x%08x but 0x%08x)\n",
+                        (unsigned int)snz_get_le(p, 4), masked_crc32c(out, uncompressed_data_len));
+            goto cleanup;
+          }
+          write_len = byte_range_clip(br, uncompressed_data_len, &write_offset);
+          if (write_len > 0 && fwrite(out + write_offset, write_len, 1, outfp) != 1) {
+            print_error("Failed to write a file: %s\n", strerror(errno));
+            goto cleanup;
+          }
+        }
+      } else if (id < 0x80) {
+        print_error("Unsupported identifier 0x%02x\n", id);
+        goto cleanup;
+      }
+      p += data_len;
+    }
+  }
   if (ferror(outfp)) {
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
@@ -252,10 +733,180 @@ static int framing_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
   return err;
 }
 
+static int framing_format_uncompress_range(FILE *infp, FILE *outfp, int skip_magic, uint64_t offset, uint64_t length)
+{
+  chunk_index_t idx = {0, };
+  byte_range_t br;
+  int err;
+
+  byte_range_init(&br, offset, length);
+  switch (read_index(fileno(infp), &idx)) {
+  case 0:
+    err = uncompress_range_with_index(fileno(infp), outfp, &idx, &br);
+    free(idx.entries);
+    return err;
+  case 1:
+    /* walk chunk headers when no index is available. */
+    trace("no chunk index\n");
+    return framing_format_uncompress_chunks(infp, outfp, skip_magic, &br);
+  default:
+    return 1;
+  }
+}
+
+/*
+ * The stream identifier may appear more than once in a stream.
+ * Files are copied as they are except the chunk index, which is
+ * valid only at the end of the file.
+ */
+static int framing_format_concat(int infd, int outfd, uint64_t size, int first)
+{
+  char header[sizeof(stream_header)];
+  chunk_index_t idx = {0, };
+
+  if (size < sizeof(stream_header) || pread_full(infd, header, sizeof(header), 0) != 0
+      || memcmp(header, stream_header, sizeof(stream_header)) != 0) {
+    print_error("Invalid stream header\n");
+    return -1;
+  }
+  switch (read_index(infd, &idx)) {
+  case 0:
+    trace("drop the chunk index at %llu\n", (unsigned long long)idx.offset);
+    size = idx.offset;
+    free(idx.entries);
+    break;
+  case 1:
+    break;
+  default:
+    return -1;
+  }
+  return copy_data(outfd, infd, 0, size);
+}
+
+static int framing_format_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
+{
+  work_buffer_t wb;
+  char header[sizeof(stream_header)];
+  int err = 1;
+
+  work_buffer_init(&wb, MAX_UNCOMPRESSED_DATA_LEN);
+  if (!skip_magic) {
+    if (read_data(header, sizeof(header), infp) != 0) {
+      goto cleanup;
+    }
+    if (memcmp(header, stream_header, sizeof(stream_header)) != 0) {
+      print_error("Invalid stream identfier\n");
+      goto cleanup;
+    }
+  }
+  for (;;) {
+    snappy_block_t blk;
+    size_t data_len;
+    int id = getc(infp);
+
+    if (id == EOF) {
+      break;
+    }
+    data_len = getc(infp);
+    data_len |= getc(infp) << 8;
+    data_len |= getc(infp) << 16;
+    if (feof(infp)) {
+      print_error("Unexpected end of file\n");
+      goto cleanup;
+    }
+    if (id != COMPRESSED_DATA_IDENTIFIER && id != UNCOMPRESSED_DATA_IDENTIFIER) {
+      if (id < 0x80) {
+        print_error("Unsupported identifier 0x%02x\n", id);
+        goto cleanup;
+      }
+      /* Skippable chunks such as stream identifiers and padding are dropped. */
+      if (skip_input(infp, data_len) != 0) {
+        goto cleanup;
+      }
+      continue;
+    }
+    if (data_len < 4) {
+      print_error("too short data length %lu\n", (unsigned long)data_len);
+      goto cleanup;
+    }
+    if (read_compressed_data(infp, &wb, data_len) != 0) {
+      goto cleanup;
+    }
+    blk.data = wb.c + 4;
+    blk.len = data_len - 4;
+    blk.compressed = (id == COMPRESSED_DATA_IDENTIFIER);
+    blk.has_crc = TRUE;
+    blk.crc32c = get_crc32c(wb.c);
+    if (!blk.compressed) {
+      blk.uncompressed_len = blk.len;
+    } else if (snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK) {
+      print_error("Invalid data: snappy_uncompressed_length failed\n");
+      goto cleanup;
+    }
+    if (blk.uncompressed_len > MAX_UNCOMPRESSED_DATA_LEN) {
+      print_error("Invalid data: too long uncompressed length %lu\n", (unsigned long)blk.uncompressed_len);
+      goto cleanup;
+    }
+    if (handler(ctx, &blk) != 0) {
+      goto cleanup;
+    }
+  }
+  if (ferror(infp)) {
+    print_error("Failed to read a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  err = 0;
+ cleanup:
+  work_buffer_free(&wb);
+  return err;
+}
+
+static int framing_format_write_header(FILE *outfp, size_t block_size, void **state)
+{
+  if (fwrite(stream_header, sizeof(stream_header), 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int framing_format_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  putc(blk->compressed ? COMPRESSED_DATA_IDENTIFIER : UNCOMPRESSED_DATA_IDENTIFIER, outfp);
+  putc(((blk->len + 4) >> 0), outfp);
+  putc(((blk->len + 4) >> 8), outfp);
+  putc(((blk->len + 4) >> 16), outfp);
+  putc((blk->crc32c >>  0), outfp);
+  putc((blk->crc32c >>  8), outfp);
+  putc((blk->crc32c >> 16), outfp);
+  putc((blk->crc32c >> 24), outfp);
+  if (fwrite(blk->data, blk->len, 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static const block_writer_t framing_format_block_writer = {
+  MAX_UNCOMPRESSED_DATA_LEN,
+  MAX_UNCOMPRESSED_DATA_LEN,
+  MAX_DATA_LEN - 4,
+  TRUE,
+  TRUE,
+  FALSE,
+  framing_format_write_header,
+  framing_format_write_block,
+  NULL,
+};
+
 stream_format_t framing2_format = {
   "framing2",
   "https://github.com/google/snappy/blob/master/framing_format.txt",
   "sz",
   framing_format_compress,
   framing_format_uncompress,
+  framing_format_uncompress_range,
+  framing_format_concat,
+  framing_format_read_blocks,
+  &framing_format_block_writer,
 };
@@ -34,11 +34,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <snappy-c.h>
 #include "snzip.h"
+#include "thread.h"
+#ifdef WIN32
+#define stat _stati64
+#define fstat _fstati64
+#endif
 
 /* same with CommonConfigurationKeys.IO_COMPRESSION_CODEC_SNAPPY_BUFFERSIZE_DEFAULT in hadoop */
 #define SNAPPY_BUFFER_SIZE_DEFAULT (256 * 1024)
+/* hadoop_snappy_max_input_size(0) and snappy_max_compressed_length() of it */
+#define MAX_INPUT_SIZE_DEFAULT (SNAPPY_BUFFER_SIZE_DEFAULT - (SNAPPY_BUFFER_SIZE_DEFAULT / 6 + 32))
+#define MAX_COMPRESSED_LENGTH_DEFAULT (32 + MAX_INPUT_SIZE_DEFAULT + MAX_INPUT_SIZE_DEFAULT / 6)
+
+/*
+ * Outer blocks larger than this are written as several subblocks as
+ * BlockCompressorStream does for a write() longer than MAX_INPUT_SIZE.
+ * The subblocks can be uncompressed by readers with the default buffer
+ * size and snappy's working set for each stays in the L2 cache.
+ */
+#define SUB_BLOCK_SIZE MAX_INPUT_SIZE_DEFAULT
+#define MAX_COMPRESSOR_THREADS 63 /* besides the current thread */
 
 /* Calculate max_input_size from block_size as in hadoop-snappy.
  *
@@ -67,48 +86,231 @@ static inline int write_num(FILE *fp, size_t num)
   return 1;
 }
 
+/*
+ * The index file lists the compressed and uncompressed offsets of
+ * outer blocks, one block per line. The last line is the compressed
+ * file size and the total uncompressed size.
+ */
+static int write_index_header(FILE *idxfp)
+{
+  if (fputs("# hadoop-snappy index: compressed_offset uncompressed_offset\n", idxfp) < 0) {
+    print_error("Failed to write an index file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int write_index_entry(FILE *idxfp, uint64_t compressed_offset, uint64_t uncompressed_offset)
+{
+  if (fprintf(idxfp, "%llu %llu\n", (unsigned long long)compressed_offset, (unsigned long long)uncompressed_offset) < 0) {
+    print_error("Failed to write an index file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+typedef struct {
+  const char *data;
+  size_t len;
+  char *compressed;
+  size_t compressed_len; /* capacity of 'compressed' until compressed */
+  int done; /* TRUE when 'compressed' is set without compression */
+} sub_block_t;
+
+typedef struct {
+  sub_block_t *sub_blocks;
+  size_t num_sub_blocks;
+  size_t next;
+#ifdef SNZ_HAVE_THREAD
+  snz_mutex_t mutex;
+#endif
+} sub_block_queue_t;
+
+/* compress subblocks one by one until all of them are taken */
+static SNZ_THREAD_FUNC(compressor_main, arg)
+{
+  sub_block_queue_t *q = (sub_block_queue_t *)arg;
+
+  for (;;) {
+    sub_block_t *sb;
+
+#ifdef SNZ_HAVE_THREAD
+    snz_mutex_lock(&q->mutex);
+#endif
+    sb = (q->next < q->num_sub_blocks) ? &q->sub_blocks[q->next++] : NULL;
+#ifdef SNZ_HAVE_THREAD
+    snz_mutex_unlock(&q->mutex);
+#endif
+    if (sb == NULL) {
+      break;
+    }
+    if (!sb->done) {
+      snappy_compress(sb->data, sb->len, sb->compressed, &sb->compressed_len);
+    }
+  }
+  SNZ_THREAD_RETURN;
+}
+
+/* compress subblocks in parallel and return the number of threads used */
+static size_t compress_sub_blocks(sub_block_queue_t *q, size_t num_sub_blocks, size_t num_pending)
+{
+  size_t num_threads = 1;
+
+  q->num_sub_blocks = num_sub_blocks;
+  q->next = 0;
+#ifdef SNZ_HAVE_THREAD
+  num_threads = num_cpus();
+  if (num_threads > num_pending) {
+    num_threads = num_pending;
+  }
+  if (num_threads > 1) {
+    snz_thread_t threads[MAX_COMPRESSOR_THREADS];
+    size_t num_started = 0;
+    size_t i;
+
+    if (num_threads > MAX_COMPRESSOR_THREADS + 1) {
+      num_threads = MAX_COMPRESSOR_THREADS + 1;
+    }
+    /* The current thread is one of them. */
+    while (num_started < num_threads - 1
+           && snz_thread_create(&threads[num_started], compressor_main, q) == 0) {
+      num_started++;
+    }
+    compressor_main(q);
+    for (i = 0; i < num_started; i++) {
+      snz_thread_join(threads[i]);
+    }
+    return num_started + 1;
+  }
+#endif
+  compressor_main(q);
+  return num_threads;
+}
+
 static int hadoop_snappy_format_compress(FILE *infp, FILE *outfp, size_t block_size)
 {
   work_buffer_t wb;
   size_t uncompressed_data_len;
+  FILE *idxfp = hadoop_snappy_index_fp;
+  uint64_t compressed_offset = 0;
+  uint64_t uncompressed_offset = 0;
+  constant_block_t constant;
+  chunker_t chunker;
+  size_t max_input_size = hadoop_snappy_max_input_size(block_size);
+  size_t sub_block_size = (max_input_size < SUB_BLOCK_SIZE) ? max_input_size : SUB_BLOCK_SIZE;
+  size_t slot_len = snappy_max_compressed_length(sub_block_size);
+  size_t max_sub_blocks = (max_input_size + sub_block_size - 1) / sub_block_size;
+  sub_block_queue_t queue;
+  uint64_t num_split_blocks = 0;
+  size_t max_threads = 1;
   int err = 1;
 
-  work_buffer_init(&wb, hadoop_snappy_max_input_size(block_size));
+  constant_block_init(&constant);
+  work_buffer_init(&wb, max_input_size);
+  if (wb.clen < max_sub_blocks * slot_len) {
+    work_buffer_resize(&wb, max_sub_blocks * slot_len, 0);
+  }
+  queue.sub_blocks = malloc(max_sub_blocks * sizeof(sub_block_t));
+  if (queue.sub_blocks == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+#ifdef SNZ_HAVE_THREAD
+  snz_mutex_init(&queue.mutex);
+#endif
+  if (idxfp != NULL && write_index_header(idxfp) != 0) {
+    goto cleanup;
+  }
 
   /* write file body */
-  while ((uncompressed_data_len = fread(wb.uc, 1, wb.uclen, infp)) > 0) {
-    size_t compressed_data_len;
+  chunker_init(&chunker);
+  while ((uncompressed_data_len = chunker_read(&chunker, wb.uc, wb.uclen, infp)) > 0) {
+    size_t num_sub_blocks = (uncompressed_data_len + sub_block_size - 1) / sub_block_size;
+    size_t num_pending = 0;
+    size_t compressed_data_len = 0;
+    size_t num_threads;
+    size_t i;
+
+    if (idxfp != NULL && write_index_entry(idxfp, compressed_offset, uncompressed_offset) != 0) {
+      goto cleanup;
+    }
     /* write length before compression */
     if (write_num(outfp, uncompressed_data_len) == 0) {
       goto cleanup;
     }
 
-    /* compress the block. */
-    compressed_data_len = wb.clen;
-    snappy_compress(wb.uc, uncompressed_data_len, wb.c, &compressed_data_len);
+    /* compress subblocks unless they are constant. */
+    for (i = 0; i < num_sub_blocks; i++) {
+      sub_block_t *sb = &queue.sub_blocks[i];
+      const constant_block_t *cb;
 
-    /* write compressed length */
-    if (write_num(outfp, compressed_data_len) == 0) {
-      goto cleanup;
+      sb->data = wb.uc + i * sub_block_size;
+      sb->len = (i + 1 < num_sub_blocks) ? sub_block_size : uncompressed_data_len - i * sub_block_size;
+      sb->compressed = wb.c + i * slot_len;
+      cb = find_constant_block(&constant, sb->data, sb->len);
+      if (cb != NULL) {
+        /* copied because the template changes with the length */
+        memcpy(sb->compressed, cb->compressed, cb->compressed_len);
+        sb->compressed_len = cb->compressed_len;
+        sb->done = TRUE;
+      } else {
+        sb->compressed_len = slot_len;
+        sb->done = FALSE;
+        num_pending++;
+      }
     }
-    /* write data */
-    if (fwrite(wb.c, compressed_data_len, 1, outfp) != 1) {
-      print_error("Failed to write a file: %s\n", strerror(errno));
-      goto cleanup;
+    num_threads = compress_sub_blocks(&queue, num_sub_blocks, num_pending);
+    if (max_threads < num_threads) {
+      max_threads = num_threads;
     }
+    if (num_sub_blocks > 1) {
+      num_split_blocks++;
+    }
+
+    for (i = 0; i < num_sub_blocks; i++) {
+      const sub_block_t *sb = &queue.sub_blocks[i];
+
+      /* write compressed length */
+      if (write_num(outfp, sb->compressed_len) == 0) {
+        goto cleanup;
+      }
+      /* write data */
+      if (fwrite(sb->compressed, sb->compressed_len, 1, outfp) != 1) {
+        print_error("Failed to write a file: %s\n", strerror(errno));
+        goto cleanup;
+      }
+      compressed_data_len += 4 + sb->compressed_len;
+    }
+    chunker_add_output(&chunker, compressed_data_len);
+    compressed_offset += 4 + compressed_data_len;
+    uncompressed_offset += uncompressed_data_len;
   }
   /* check stream errors */
   if (ferror(infp)) {
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  if (idxfp != NULL && write_index_entry(idxfp, compressed_offset, uncompressed_offset) != 0) {
+    goto cleanup;
+  }
+  constant_block_report(&constant);
   if (ferror(outfp)) {
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  chunker_report(&chunker);
+  trace("blocks split into subblocks: %llu (up to %lu threads)\n",
+        (unsigned long long)num_split_blocks, (unsigned long)max_threads);
   err = 0;
  cleanup:
+#ifdef SNZ_HAVE_THREAD
+  if (queue.sub_blocks != NULL) {
+    snz_mutex_destroy(&queue.mutex);
+  }
+#endif
+  free(queue.sub_blocks);
   work_buffer_free(&wb);
+  constant_block_free(&constant);
   return err;
 }
 
@@ -125,14 +327,18 @@ static int read_data(char *buf, size_t buflen, FILE *fp)
   return 0;
 }
 
-static int hadoop_snappy_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+static int hadoop_snappy_format_uncompress_range(FILE *infp, FILE *outfp, int skip_magic, uint64_t offset, uint64_t length)
 {
   work_buffer_t wb;
+  byte_range_t br;
   size_t source_len = 0;
   size_t compressed_len = 0;
+  constant_block_t constant;
   int err = 1;
 
+  constant_block_init(&constant);
   work_buffer_init(&wb, hadoop_snappy_max_input_size(0));
+  byte_range_init(&br, offset, length);
 
   if (skip_magic) {
     source_len = hadoop_snappy_source_length;
@@ -142,11 +348,12 @@ static int hadoop_snappy_format_uncompress(FILE *infp, FILE *outfp, int skip_mag
     goto after_reading_compressed_len;
   }
 
-  for (;;) {
+  while (!byte_range_done(&br)) {
     unsigned int n;
 
     if (fread(&n, sizeof(n), 1, infp) != 1) {
       if (feof(infp)) {
+        constant_block_report(&constant);
         err = 0;
       } else {
         print_error("Failed to read a file: %s\n", strerror(errno));
@@ -156,8 +363,11 @@ static int hadoop_snappy_format_uncompress(FILE *infp, FILE *outfp, int skip_mag
     source_len = SNZ_FROM_BE32(n);
     trace("source_len = %ld.\n", (long)source_len);
 
-    while (source_len > 0) {
+    while (source_len > 0 && !byte_range_done(&br)) {
       size_t uncompressed_len;
+      size_t head_len;
+      size_t write_offset;
+      size_t write_len;
 
       if (read_data((char*)&n, sizeof(n), infp) != 0) {
         goto cleanup;
@@ -169,38 +379,46 @@ static int hadoop_snappy_format_uncompress(FILE *infp, FILE *outfp, int skip_mag
         work_buffer_resize(&wb, compressed_len, 0);
       }
 
-      /* read the compressed data */
-      if (read_data(wb.c, compressed_len, infp) != 0) {
-        goto cleanup;
-      }
-      trace("read %ld bytes.\n", (long)(compressed_len));
-
       /* check the uncompressed length */
-      err = snappy_uncompressed_length(wb.c, compressed_len, &uncompressed_len);
-      if (err != 0) {
-        print_error("Invalid data: GetUncompressedLength failed %d\n", err);
+      if (read_uncompressed_length(infp, wb.c, compressed_len, &head_len, &uncompressed_len) != 0) {
         goto cleanup;
       }
-      err = 1;
       if (uncompressed_len > source_len) {
         print_error("Invalid data: uncompressed_length > source_len\n");
         goto cleanup;
       }
+      if (byte_range_skip(&br, uncompressed_len)) {
+        if (skip_input(infp, compressed_len - head_len) != 0) {
+          goto cleanup;
+        }
+        source_len -= uncompressed_len;
+        continue;
+      }
+
+      /* read the rest of the compressed data */
+      if (compressed_len > head_len && read_data(wb.c + head_len, compressed_len - head_len, infp) != 0) {
+        goto cleanup;
+      }
+      trace("read %ld bytes.\n", (long)(compressed_len));
 
       if (uncompressed_len > wb.uclen) {
         work_buffer_resize(&wb, 0, uncompressed_len);
       }
 
       /* uncompress and write */
-      if (snappy_uncompress(wb.c, compressed_len, wb.uc, &uncompressed_len)) {
-        print_error("Invalid data: RawUncompress failed\n");
-        goto cleanup;
+      if (!uncompress_constant_block(&constant, wb.c, compressed_len, wb.uc, &uncompressed_len)) {
+        if (snappy_uncompress(wb.c, compressed_len, wb.uc, &uncompressed_len)) {
+          print_error("Invalid data: RawUncompress failed\n");
+          goto cleanup;
+        }
+        remember_constant_block(&constant, wb.c, compressed_len, wb.uc, uncompressed_len);
       }
-      if (fwrite(wb.uc, uncompressed_len, 1, outfp) != 1) {
+      write_len = byte_range_clip(&br, uncompressed_len, &write_offset);
+      if (write_len > 0 && fwrite(wb.uc + write_offset, write_len, 1, outfp) != 1) {
         print_error("Failed to write a file: %s\n", strerror(errno));
         goto cleanup;
       }
-      trace("write %ld bytes\n", (long)uncompressed_len);
+      trace("write %ld bytes\n", (long)write_len);
 
       source_len -= uncompressed_len;
       trace("uncompressed_len = %ld, source_len -> %ld\n", (long)uncompressed_len, (long)source_len);
@@ -215,16 +433,203 @@ static int hadoop_snappy_format_uncompress(FILE *infp, FILE *outfp, int skip_mag
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  constant_block_report(&constant);
+  err = 0;
+ cleanup:
+  work_buffer_free(&wb);
+  constant_block_free(&constant);
+  return err;
+}
+
+static int hadoop_snappy_format_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+{
+  return hadoop_snappy_format_uncompress_range(infp, outfp, skip_magic, 0, UINT64_MAX);
+}
+
+/*
+ * Create an index file of an existing file by reading block headers
+ * and the heads of compressed data only.
+ */
+int hadoop_snappy_build_index(FILE *infp, FILE *idxfp)
+{
+  char head[5];
+  struct stat sbuf;
+  uint64_t compressed_offset = 0;
+  uint64_t uncompressed_offset = 0;
+
+  if (write_index_header(idxfp) != 0) {
+    return 1;
+  }
+  for (;;) {
+    unsigned int n;
+    size_t source_len;
+
+    if (fread(&n, sizeof(n), 1, infp) != 1) {
+      if (!feof(infp)) {
+        print_error("Failed to read a file: %s\n", strerror(errno));
+        return 1;
+      }
+      break;
+    }
+    if (write_index_entry(idxfp, compressed_offset, uncompressed_offset) != 0) {
+      return 1;
+    }
+    source_len = SNZ_FROM_BE32(n);
+    compressed_offset += sizeof(n);
+    uncompressed_offset += source_len;
+
+    while (source_len > 0) {
+      size_t compressed_len;
+      size_t uncompressed_len;
+      size_t head_len;
+
+      if (read_data((char*)&n, sizeof(n), infp) != 0) {
+        return 1;
+      }
+      compressed_len = SNZ_FROM_BE32(n);
+      if (read_uncompressed_length(infp, head, compressed_len, &head_len, &uncompressed_len) != 0) {
+        return 1;
+      }
+      if (uncompressed_len > source_len) {
+        print_error("Invalid data: uncompressed_length > source_len\n");
+        return 1;
+      }
+      if (skip_input(infp, compressed_len - head_len) != 0) {
+        return 1;
+      }
+      compressed_offset += sizeof(n) + compressed_len;
+      source_len -= uncompressed_len;
+    }
+  }
+  /* skip_input() may seek beyond the end of a truncated file. */
+  if (fstat(fileno(infp), &sbuf) == 0 && (sbuf.st_mode & S_IFMT) == S_IFREG && sbuf.st_size != compressed_offset) {
+    print_error("Unexpected end of file\n");
+    return 1;
+  }
+  if (write_index_entry(idxfp, compressed_offset, uncompressed_offset) != 0) {
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Each subblock is passed as a block.
+ */
+static int hadoop_snappy_format_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
+{
+  work_buffer_t wb;
+  size_t source_len;
+  int first = skip_magic;
+  int err = 1;
+
+  work_buffer_init(&wb, hadoop_snappy_max_input_size(0));
+  for (;;) {
+    unsigned int n;
+
+    if (first) {
+      source_len = hadoop_snappy_source_length;
+    } else {
+      if (fread(&n, sizeof(n), 1, infp) != 1) {
+        if (feof(infp)) {
+          break;
+        }
+        print_error("Failed to read a file: %s\n", strerror(errno));
+        goto cleanup;
+      }
+      source_len = SNZ_FROM_BE32(n);
+    }
+    while (source_len > 0 || first) {
+      snappy_block_t blk;
+
+      if (first) {
+        blk.len = hadoop_snappy_compressed_length;
+        first = FALSE;
+      } else {
+        if (read_data((char*)&n, sizeof(n), infp) != 0) {
+          goto cleanup;
+        }
+        blk.len = SNZ_FROM_BE32(n);
+      }
+      if (read_compressed_data(infp, &wb, blk.len) != 0) {
+        goto cleanup;
+      }
+      blk.data = wb.c;
+      blk.compressed = TRUE;
+      blk.has_crc = FALSE;
+      blk.crc32c = 0;
+      if (snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK) {
+        print_error("Invalid data: GetUncompressedLength failed\n");
+        goto cleanup;
+      }
+      if (blk.uncompressed_len > source_len) {
+        print_error("Invalid data: uncompressed_length > source_len\n");
+        goto cleanup;
+      }
+      if (handler(ctx, &blk) != 0) {
+        goto cleanup;
+      }
+      source_len -= blk.uncompressed_len;
+    }
+  }
   err = 0;
  cleanup:
   work_buffer_free(&wb);
   return err;
 }
 
+/*
+ * A block is written as an outer block with one subblock.
+ */
+static int hadoop_snappy_format_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  if (write_num(outfp, blk->uncompressed_len) == 0 || write_num(outfp, blk->len) == 0) {
+    return -1;
+  }
+  if (fwrite(blk->data, blk->len, 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static const block_writer_t hadoop_snappy_format_block_writer = {
+  MAX_INPUT_SIZE_DEFAULT,
+  MAX_INPUT_SIZE_DEFAULT,
+  MAX_COMPRESSED_LENGTH_DEFAULT,
+  FALSE,
+  FALSE,
+  FALSE,
+  NULL,
+  hadoop_snappy_format_write_block,
+  NULL,
+};
+
+/*
+ * Hadoop-snappy files have no file header. They are copied as they are
+ * after checking the first block header.
+ */
+static int hadoop_snappy_format_concat(int infd, int outfd, uint64_t size, int first)
+{
+  uint32_t head[2];
+
+  if (size > 0) {
+    if (size < sizeof(head) || pread_full(infd, head, sizeof(head), 0) != 0
+        || SNZ_FROM_BE32(head[1]) > snappy_max_compressed_length(hadoop_snappy_max_input_size(0))) {
+      print_error("Invalid hadoop-snappy block header\n");
+      return -1;
+    }
+  }
+  return copy_data(outfd, infd, 0, size);
+}
+
 stream_format_t hadoop_snappy_format = {
   "hadoop-snappy",
   "https://code.google.com/p/hadoop-snappy/",
   "snappy",
   hadoop_snappy_format_compress,
   hadoop_snappy_format_uncompress,
+  hadoop_snappy_format_uncompress_range,
+  hadoop_snappy_format_concat,
+  hadoop_snappy_format_read_blocks,
+  &hadoop_snappy_format_block_writer,
 };
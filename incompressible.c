@@ -0,0 +1,116 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <snappy-c.h>
+#include "snzip.h"
+
+/*
+ * Detect incompressible blocks such as JPEG, video and encrypted data
+ * without compressing whole blocks.
+ *
+ * Four pieces evenly spaced in a block are compressed as a sample.
+ * A sample can't show repeats longer than a piece or farther than the
+ * pieces, so it is trusted only after DETECTOR_RUN_THRESHOLD blocks in
+ * a row were actually stored uncompressed. Then a block is stored
+ * without compression when its sample shrinks by less than 1/32, far
+ * from the 1/8 needed to be stored compressed. Every
+ * DETECTOR_VERIFY_INTERVAL-th of such blocks is compressed anyway to
+ * verify the guess. A block which compresses ends the run.
+ */
+#define DETECTOR_NUM_PIECES 4
+#define DETECTOR_PIECE_LEN (DETECTOR_SAMPLE_LEN / DETECTOR_NUM_PIECES)
+#define DETECTOR_MIN_BLOCK_LEN (4 * DETECTOR_SAMPLE_LEN)
+#define DETECTOR_RUN_THRESHOLD 4
+#define DETECTOR_VERIFY_INTERVAL 8
+
+int detect_incompressible = TRUE;
+
+void incompressible_detector_init(incompressible_detector_t *det)
+{
+  det->run = 0;
+  det->num_guessed = 0;
+  det->num_blocks = 0;
+  det->num_stored = 0;
+  det->num_verified = 0;
+}
+
+/* TRUE when 'data' shrinks by less than 1/32 */
+static int is_incompressible_sample(incompressible_detector_t *det, const char *data, size_t len)
+{
+  size_t compressed_len = sizeof(det->compressed_sample);
+
+  snappy_compress(data, len, det->compressed_sample, &compressed_len);
+  return compressed_len >= len - len / 32;
+}
+
+int is_incompressible(incompressible_detector_t *det, const char *data, size_t len)
+{
+  size_t step;
+  int i;
+
+  det->num_blocks++;
+  if (!detect_incompressible || len < DETECTOR_MIN_BLOCK_LEN || det->run < DETECTOR_RUN_THRESHOLD) {
+    /* compressing the whole block costs little or is needed to start a run. */
+    return FALSE;
+  }
+  step = (len - DETECTOR_PIECE_LEN) / (DETECTOR_NUM_PIECES - 1);
+  for (i = 0; i < DETECTOR_NUM_PIECES; i++) {
+    memcpy(det->sample + i * DETECTOR_PIECE_LEN, data + i * step, DETECTOR_PIECE_LEN);
+  }
+  if (!is_incompressible_sample(det, det->sample, DETECTOR_SAMPLE_LEN)) {
+    return FALSE;
+  }
+  if (++det->num_guessed % DETECTOR_VERIFY_INTERVAL == 0) {
+    det->num_verified++;
+    return FALSE;
+  }
+  det->num_stored++;
+  return TRUE;
+}
+
+void incompressible_detector_update(incompressible_detector_t *det, size_t len, size_t compressed_len)
+{
+  if (compressed_len >= len - len / 8) {
+    det->run++;
+  } else {
+    det->run = 0;
+  }
+}
+
+void incompressible_detector_report(const incompressible_detector_t *det)
+{
+  trace("incompressible blocks: %llu stored without compression, %llu compressed to verify sampling out of %llu blocks\n",
+        (unsigned long long)det->num_stored, (unsigned long long)det->num_verified,
+        (unsigned long long)det->num_blocks);
+}
@@ -50,6 +50,7 @@ static int iwa_compress(FILE *infp, FILE *outfp, size_t block_size)
   size_t compressed_data_len;
   char *uncompressed_data = malloc(max_uncompressed_data_len);
   char *compressed_data = malloc(max_compressed_data_len);
+  chunker_t chunker;
   int err = 1;
 
   if (uncompressed_data == NULL || compressed_data == NULL) {
@@ -58,7 +59,8 @@ static int iwa_compress(FILE *infp, FILE *outfp, size_t block_size)
   }
 
   /* write file body */
-  while ((uncompressed_data_len = fread(uncompressed_data, 1, max_uncompressed_data_len, infp)) > 0) {
+  chunker_init(&chunker);
+  while ((uncompressed_data_len = chunker_read(&chunker, uncompressed_data, max_uncompressed_data_len, infp)) > 0) {
     /* compress the block. */
     compressed_data_len = max_compressed_data_len;
     snappy_compress(uncompressed_data, uncompressed_data_len, compressed_data, &compressed_data_len);
@@ -84,6 +86,7 @@ static int iwa_compress(FILE *infp, FILE *outfp, size_t block_size)
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  chunker_report(&chunker);
   err = 0;
  cleanup:
   free(uncompressed_data);
@@ -167,10 +170,106 @@ static int iwa_uncompress(FILE *infp, FILE *outfp, int skip_magic)
   return err;
 }
 
+static int iwa_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
+{
+  work_buffer_t wb;
+  int err = 1;
+
+  work_buffer_init(&wb, MAX_UNCOMPRESSED_DATA_LEN);
+  for (;;) {
+    snappy_block_t blk;
+    int id = getc(infp);
+
+    if (id == EOF) {
+      break;
+    }
+    if (id != COMPRESSED_DATA_IDENTIFIER) {
+      print_error("Invalid data identifier: 0x%02x\n", id);
+      goto cleanup;
+    }
+    blk.len = getc(infp);
+    blk.len |= getc(infp) << 8;
+    blk.len |= getc(infp) << 16;
+    if (feof(infp)) {
+      print_error("Unexpected end of file\n");
+      goto cleanup;
+    }
+    if (read_compressed_data(infp, &wb, blk.len) != 0) {
+      goto cleanup;
+    }
+    blk.data = wb.c;
+    blk.compressed = TRUE;
+    blk.has_crc = FALSE;
+    blk.crc32c = 0;
+    if (snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK
+        || blk.uncompressed_len > MAX_UNCOMPRESSED_DATA_LEN) {
+      print_error("Invalid data: snappy_uncompressed_length failed\n");
+      goto cleanup;
+    }
+    if (handler(ctx, &blk) != 0) {
+      goto cleanup;
+    }
+  }
+  if (ferror(infp)) {
+    print_error("Failed to read a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  err = 0;
+ cleanup:
+  work_buffer_free(&wb);
+  return err;
+}
+
+static int iwa_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  putc(COMPRESSED_DATA_IDENTIFIER, outfp);
+  putc((blk->len >> 0), outfp);
+  putc((blk->len >> 8), outfp);
+  putc((blk->len >> 16), outfp);
+  if (fwrite(blk->data, blk->len, 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static const block_writer_t iwa_block_writer = {
+  MAX_UNCOMPRESSED_DATA_LEN,
+  MAX_UNCOMPRESSED_DATA_LEN,
+  MAX_DATA_LEN,
+  FALSE,
+  FALSE,
+  FALSE,
+  NULL,
+  iwa_write_block,
+  NULL,
+};
+
+/*
+ * Iwa files have no file header. They are copied as they are after
+ * checking the first chunk type.
+ */
+static int iwa_concat(int infd, int outfd, uint64_t size, int first)
+{
+  char id;
+
+  if (size > 0) {
+    if (pread_full(infd, &id, 1, 0) != 0 || id != COMPRESSED_DATA_IDENTIFIER) {
+      print_error("Invalid iwa chunk header\n");
+      return -1;
+    }
+  }
+  return copy_data(outfd, infd, 0, size);
+}
+
 stream_format_t iwa_format = {
   "iwa",
   "https://github.com/obriensp/iWorkFileFormat/blob/master/Docs/index.md#snappy-compression",
   "iwa",
   iwa_compress,
   iwa_uncompress,
+  NULL,
+  iwa_concat,
+  iwa_read_blocks,
+  &iwa_block_writer,
 };
@@ -49,6 +49,7 @@
 #endif
 extern "C" {
 #include "snzip.h"
+#include "thread.h"
 }
 
 namespace snzip {
@@ -153,6 +154,404 @@ namespace snzip {
     int64_t restsize_;
     bool err_;
   };
+
+  /*
+   * Streaming decoder of raw snappy data.
+   *
+   * snappy::Uncompress() keeps the whole output in memory until the end
+   * because copies may refer to any preceding byte. The snappy compressor
+   * however compresses input in independent fragments of kBlockSize bytes
+   * and its copies never refer to data before the fragment. This decoder
+   * keeps only the last kBlockSize bytes as history and writes the rest
+   * of the window as it fills up. Copies farther than that are rejected.
+   */
+  class StreamDecoder {
+  public:
+    StreamDecoder(snappy::Source *src, snappy::Sink *dst)
+      : src_(src), dst_(dst), ip_(NULL), ip_limit_(NULL), written_(0), expected_(0) {
+      window_ = new char[kWindowSize];
+      op_ = window_;
+    }
+
+    ~StreamDecoder() {
+      delete[] window_;
+    }
+
+    bool Decode() {
+      uint64_t expected = 0;
+      int shift;
+
+      /* the preamble: uncompressed length as a varint */
+      for (shift = 0; ; shift += 7) {
+        unsigned char c;
+        if (shift > 28 || !ReadBytes((char*)&c, 1)) {
+          print_error("Invalid data: broken uncompressed length\n");
+          return false;
+        }
+        expected |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+          break;
+        }
+      }
+      if (expected > 0xffffffff) {
+        /* snappy's varint32 allows only four bits in the fifth byte. */
+        print_error("Invalid data: broken uncompressed length\n");
+        return false;
+      }
+      expected_ = expected;
+      trace("uncompressed length: %llu\n", (unsigned long long)expected_);
+
+      for (;;) {
+        unsigned char buf[5];
+        size_t len;
+
+        if (!Fill()) {
+          break; /* end of input */
+        }
+        buf[0] = *ip_++;
+        switch (buf[0] & 3) {
+        case 0: /* literal */
+          len = buf[0] >> 2;
+          if (len >= 60) {
+            size_t n = len - 59;
+            if (!ReadBytes((char*)buf + 1, n)) {
+              return Truncated();
+            }
+            len = snz_get_le((char*)buf + 1, (int)n);
+          }
+          if (!Literal((uint64_t)len + 1)) {
+            return false;
+          }
+          break;
+        case 1: /* copy with 1-byte offset */
+          if (!ReadBytes((char*)buf + 1, 1)) {
+            return Truncated();
+          }
+          if (!Copy(((size_t)(buf[0] >> 5) << 8) | buf[1], 4 + ((buf[0] >> 2) & 7))) {
+            return false;
+          }
+          break;
+        case 2: /* copy with 2-byte offset */
+          if (!ReadBytes((char*)buf + 1, 2)) {
+            return Truncated();
+          }
+          if (!Copy(snz_get_le((char*)buf + 1, 2), (buf[0] >> 2) + 1)) {
+            return false;
+          }
+          break;
+        case 3: /* copy with 4-byte offset */
+          if (!ReadBytes((char*)buf + 1, 4)) {
+            return Truncated();
+          }
+          if (!Copy(snz_get_le((char*)buf + 1, 4), (buf[0] >> 2) + 1)) {
+            return false;
+          }
+          break;
+        }
+      }
+      if (Produced() != expected_) {
+        return Truncated();
+      }
+      Flush(0);
+      return true;
+    }
+
+  private:
+    static const size_t kHistorySize = snappy::kBlockSize;
+    static const size_t kWindowSize = 16 * snappy::kBlockSize;
+    static const size_t kMaxCopyLength = 64;
+
+    uint64_t Produced() const {
+      return written_ + (op_ - window_);
+    }
+
+    bool Truncated() {
+      print_error("Invalid data: uncompressed length mismatch or truncated data\n");
+      return false;
+    }
+
+    /* make the input buffer non-empty. false at the end of input. */
+    bool Fill() {
+      if (ip_ == ip_limit_) {
+        size_t n;
+
+        if (ip_ != NULL) {
+          src_->Skip(ip_limit_ - ip_start_);
+        }
+        ip_start_ = ip_ = src_->Peek(&n);
+        ip_limit_ = ip_ + n;
+        if (n == 0) {
+          ip_ = ip_limit_ = NULL;
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool ReadBytes(char *buf, size_t n) {
+      while (n > 0) {
+        size_t len;
+        if (!Fill()) {
+          return false;
+        }
+        len = (size_t)(ip_limit_ - ip_) < n ? ip_limit_ - ip_ : n;
+        memcpy(buf, ip_, len);
+        ip_ += len;
+        buf += len;
+        n -= len;
+      }
+      return true;
+    }
+
+    /* write the window except the last 'keep' bytes and move them to the head */
+    void Flush(size_t keep) {
+      size_t len = op_ - window_;
+
+      if (len > keep) {
+        dst_->Append(window_, len - keep);
+        memmove(window_, op_ - keep, keep);
+        written_ += len - keep;
+        op_ = window_ + keep;
+      }
+    }
+
+    bool Reserve(uint64_t len) {
+      if (Produced() + len > expected_) {
+        print_error("Invalid data: longer than the uncompressed length\n");
+        return false;
+      }
+      if ((size_t)(window_ + kWindowSize - op_) < kMaxCopyLength) {
+        Flush(kHistorySize);
+      }
+      return true;
+    }
+
+    bool Literal(uint64_t len) {
+      if (!Reserve(len)) {
+        return false;
+      }
+      while (len > 0) {
+        size_t n = window_ + kWindowSize - op_;
+
+        if (!Fill()) {
+          return Truncated();
+        }
+        if (n > (size_t)(ip_limit_ - ip_)) {
+          n = ip_limit_ - ip_;
+        }
+        if (n > len) {
+          n = (size_t)len;
+        }
+        memcpy(op_, ip_, n);
+        op_ += n;
+        ip_ += n;
+        len -= n;
+        if (op_ == window_ + kWindowSize) {
+          Flush(kHistorySize);
+        }
+      }
+      return true;
+    }
+
+    bool Copy(size_t offset, size_t len) {
+      const char *from;
+
+      if (offset > kHistorySize) {
+        print_error("Unsupported data: copy offset %lu is beyond %lu bytes\n",
+                    (unsigned long)offset, (unsigned long)kHistorySize);
+        return false;
+      }
+      if (offset == 0 || offset > (size_t)(op_ - window_)) {
+        print_error("Invalid data: copy offset %lu\n", (unsigned long)offset);
+        return false;
+      }
+      if (!Reserve(len)) {
+        return false;
+      }
+      from = op_ - offset;
+      if (offset >= len) {
+        memcpy(op_, from, len);
+        op_ += len;
+      } else {
+        /* overlapping copy repeats the last 'offset' bytes */
+        while (len-- > 0) {
+          *op_++ = *from++;
+        }
+      }
+      return true;
+    }
+
+    snappy::Source *src_;
+    snappy::Sink *dst_;
+    const char *ip_start_;
+    const char *ip_;
+    const char *ip_limit_;
+    char *window_;
+    char *op_;
+    uint64_t written_; /* bytes passed to dst_ */
+    uint64_t expected_;
+  };
+
+#ifdef SNZ_HAVE_THREAD
+  /*
+   * Parallel encoder of raw snappy data.
+   *
+   * snappy::Compress() writes the uncompressed length as a varint and
+   * compresses the rest in independent fragments of kBlockSize bytes.
+   * This encoder reads a batch of fragments, compresses each of them by
+   * snappy::RawCompress() on worker threads, strips the length preamble
+   * of the results and writes them in order. The output is identical to
+   * snappy::Compress().
+   */
+  class ParallelEncoder {
+  public:
+    static const size_t kMaxThreads = 64;
+
+    ParallelEncoder(snappy::Source *src, snappy::Sink *dst, size_t num_threads)
+      : src_(src), dst_(dst), num_threads_(num_threads), next_(0), num_fragments_(0) {
+      max_fragments_ = num_threads * kFragmentsPerThread;
+      input_ = new char[max_fragments_ * snappy::kBlockSize];
+      output_ = new char[max_fragments_ * kMaxFragmentOutput];
+      fragments_ = new Fragment[max_fragments_];
+      snz_mutex_init(&mutex_);
+    }
+
+    ~ParallelEncoder() {
+      snz_mutex_destroy(&mutex_);
+      delete[] fragments_;
+      delete[] output_;
+      delete[] input_;
+    }
+
+    bool Encode(uint64_t length) {
+      char preamble[10];
+      size_t preamble_len = 0;
+      uint64_t rest = length;
+
+      while (rest >= 0x80) {
+        preamble[preamble_len++] = (char)(rest | 0x80);
+        rest >>= 7;
+      }
+      preamble[preamble_len++] = (char)rest;
+      dst_->Append(preamble, preamble_len);
+
+      rest = length;
+      while (rest > 0) {
+        size_t len = max_fragments_ * snappy::kBlockSize;
+        size_t i;
+
+        if ((uint64_t)len > rest) {
+          len = (size_t)rest;
+        }
+        if (!Read(len)) {
+          return false;
+        }
+        num_fragments_ = 0;
+        for (i = 0; i < len; i += snappy::kBlockSize) {
+          Fragment *f = &fragments_[num_fragments_];
+          f->data = input_ + i;
+          f->len = (len - i < snappy::kBlockSize) ? len - i : snappy::kBlockSize;
+          f->compressed = output_ + num_fragments_ * kMaxFragmentOutput;
+          num_fragments_++;
+        }
+        CompressFragments();
+        for (i = 0; i < num_fragments_; i++) {
+          const Fragment *f = &fragments_[i];
+          size_t skip = 0;
+
+          /* drop the length preamble of the fragment */
+          while (f->compressed[skip++] & 0x80) {
+          }
+          dst_->Append(f->compressed + skip, f->compressed_len - skip);
+        }
+        rest -= len;
+      }
+      return true;
+    }
+
+  private:
+    struct Fragment {
+      const char *data;
+      size_t len;
+      char *compressed;
+      size_t compressed_len;
+    };
+
+    /* read 'len' bytes to input_ */
+    bool Read(size_t len) {
+      size_t pos = 0;
+
+      while (pos < len) {
+        size_t n;
+        const char *p = src_->Peek(&n);
+
+        if (n == 0) {
+          if (src_->Available() > 0) {
+            print_error("Unexpected end of file\n");
+          }
+          return false;
+        }
+        if (n > len - pos) {
+          n = len - pos;
+        }
+        memcpy(input_ + pos, p, n);
+        src_->Skip(n);
+        pos += n;
+      }
+      return true;
+    }
+
+    void CompressFragments() {
+      size_t num_threads = (num_threads_ < num_fragments_) ? num_threads_ : num_fragments_;
+      snz_thread_t threads[kMaxThreads];
+      size_t num_started = 0;
+      size_t i;
+
+      next_ = 0;
+      /* The current thread is one of them. */
+      while (num_started < num_threads - 1
+             && snz_thread_create(&threads[num_started], Worker, this) == 0) {
+        num_started++;
+      }
+      Worker(this);
+      for (i = 0; i < num_started; i++) {
+        snz_thread_join(threads[i]);
+      }
+    }
+
+    /* compress fragments one by one until all of them are taken */
+    static SNZ_THREAD_FUNC(Worker, arg) {
+      ParallelEncoder *self = (ParallelEncoder *)arg;
+
+      for (;;) {
+        Fragment *f;
+
+        snz_mutex_lock(&self->mutex_);
+        f = (self->next_ < self->num_fragments_) ? &self->fragments_[self->next_++] : NULL;
+        snz_mutex_unlock(&self->mutex_);
+        if (f == NULL) {
+          break;
+        }
+        snappy::RawCompress(f->data, f->len, f->compressed, &f->compressed_len);
+      }
+      SNZ_THREAD_RETURN;
+    }
+
+    static const size_t kFragmentsPerThread = 16;
+    static const size_t kMaxFragmentOutput = 32 + snappy::kBlockSize + snappy::kBlockSize / 6; /* snappy::MaxCompressedLength(kBlockSize) */
+
+    snappy::Source *src_;
+    snappy::Sink *dst_;
+    size_t num_threads_;
+    size_t max_fragments_;
+    char *input_;
+    char *output_;
+    Fragment *fragments_;
+    size_t next_;
+    size_t num_fragments_;
+    snz_mutex_t mutex_;
+  };
+#endif
 }
 
 static int raw_compress(FILE *infp, FILE *outfp, size_t block_size)
@@ -176,6 +575,28 @@ static int raw_compress(FILE *infp, FILE *outfp, size_t block_size)
 
   snzip::FileSource src(fileno(infp), filesize, block_size);
   snzip::FileSink dst(fileno(outfp));
+#ifdef SNZ_HAVE_THREAD
+  {
+    uint64_t num_fragments = (filesize + snappy::kBlockSize - 1) / snappy::kBlockSize;
+    size_t num_threads = num_cpus();
+
+    if (num_threads > snzip::ParallelEncoder::kMaxThreads) {
+      num_threads = snzip::ParallelEncoder::kMaxThreads;
+    }
+    if ((uint64_t)num_threads > num_fragments) {
+      num_threads = (size_t)num_fragments;
+    }
+    if (num_threads > 1) {
+      snzip::ParallelEncoder encoder(&src, &dst, num_threads);
+
+      trace("compress raw data by %lu threads\n", (unsigned long)num_threads);
+      if (!encoder.Encode(filesize)) {
+        return 1;
+      }
+      return src.err() || dst.err();
+    }
+  }
+#endif
   if (!snappy::Compress(&src, &dst)) {
     print_error("Invalid data: snappy::Compress failed\n");
     return 1;
@@ -187,8 +608,8 @@ static int raw_uncompress(FILE *infp, FILE *outfp, int skip_magic)
 {
   snzip::FileSource src(fileno(infp), -1, snappy::kBlockSize);
   snzip::FileSink dst(fileno(outfp));
-  if (!snappy::Uncompress(&src, &dst)) {
-    print_error("Invalid data: snappy::Uncompress failed\n");
+  snzip::StreamDecoder decoder(&src, &dst);
+  if (!decoder.Decode()) {
     return 1;
   }
   return src.err() || dst.err();
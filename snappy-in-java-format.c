@@ -61,16 +61,18 @@ static const snappy_in_java_header_t snappy_in_java_header = {
 };
 
 static int write_block(FILE *outfp, const char *buffer, size_t length, int compressed, unsigned int crc32c);
-static int check_and_write_block(int outfd, const char *buffer, size_t length, int verify_checksum, unsigned int crc32c);
 
 static int snappy_in_java_compress(FILE *infp, FILE *outfp, size_t block_size)
 {
   work_buffer_t wb;
   size_t uncompressed_length;
+  incompressible_detector_t detector;
+  chunker_t chunker;
   int err = 1;
 
   wb.c = NULL;
   wb.uc = NULL;
+  incompressible_detector_init(&detector);
 
   if (block_size == 0) {
     block_size = DEFAULT_BLOCK_SIZE;
@@ -88,14 +90,20 @@ static int snappy_in_java_compress(FILE *infp, FILE *outfp, size_t block_size)
 
   /* write file body */
   work_buffer_init(&wb, block_size);
-  while ((uncompressed_length = fread(wb.uc, 1, wb.uclen, infp)) > 0) {
+  chunker_init(&chunker);
+  while ((uncompressed_length = chunker_read(&chunker, wb.uc, wb.uclen, infp)) > 0) {
     size_t compressed_length = wb.clen;
     unsigned int crc32c = masked_crc32c(wb.uc, uncompressed_length);
 
     trace("read %lu bytes.\n", (unsigned long)uncompressed_length);
 
-    /* compress the block. */
-    snappy_compress(wb.uc, uncompressed_length, wb.c, &compressed_length);
+    /* compress the block unless it is detected as incompressible. */
+    if (is_incompressible(&detector, wb.uc, uncompressed_length)) {
+      compressed_length = uncompressed_length;
+    } else {
+      snappy_compress(wb.uc, uncompressed_length, wb.c, &compressed_length);
+    }
+    incompressible_detector_update(&detector, uncompressed_length, compressed_length);
     trace("compressed_legnth is %lu.\n", (unsigned long)compressed_length);
 
     if (compressed_length >= (uncompressed_length - (uncompressed_length / 8))) {
@@ -115,6 +123,8 @@ static int snappy_in_java_compress(FILE *infp, FILE *outfp, size_t block_size)
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  incompressible_detector_report(&detector);
+  chunker_report(&chunker);
   err = 0;
  cleanup:
   work_buffer_free(&wb);
@@ -150,12 +160,9 @@ static int write_block(FILE *outfp, const char *buffer, size_t length, int compr
 static int snappy_in_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
 {
   snappy_in_java_header_t header;
-  work_buffer_t wb;
+  char *compressed_data = NULL;
+  crc_verifier_t *cv = NULL;
   int err = 1;
-  int outfd;
-
-  wb.c = NULL;
-  wb.uc = NULL;
 
   if (!skip_magic) {
     /* read header */
@@ -171,25 +178,34 @@ static int snappy_in_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     }
   }
 
-  /* Use a file descriptor 'outfd' instead of the stdio file pointer 'outfp'
-   * to reduce the number of write system calls.
+  compressed_data = malloc(MAX_BLOCK_SIZE);
+  if (compressed_data == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+  /* Checksums are verified and uncompressed data are written by
+   * the crc verifier while the next block is uncompressed.
    */
-  fflush(outfp);
-  outfd = fileno(outfp);
+  cv = crc_verifier_create(outfp, MAX_BLOCK_SIZE);
+  if (cv == NULL) {
+    goto cleanup;
+  }
 
   /* read body */
-  work_buffer_init(&wb, MAX_BLOCK_SIZE);
   for (;;) {
     int compressed_flag;
     size_t length = 0;
     unsigned int crc32c = 0;
+    char *uncompressed_data;
+    size_t uncompressed_length;
 
     /* read compressed flag */
     compressed_flag = getc(infp);
     switch (compressed_flag) {
     case EOF:
       /* read all blocks */
-      err = 0;
+      err = crc_verifier_finish(cv) ? 1 : 0;
+      cv = NULL;
       goto cleanup;
     case COMPRESSED_FLAG:
     case UNCOMPRESSED_FLAG:
@@ -219,8 +235,10 @@ static int snappy_in_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
       goto cleanup;
     }
 
-    /* read data */
-    if (fread(wb.c, length, 1, infp) != 1) {
+    /* read data. Uncompressed data are read into a buffer passed to
+     * the crc verifier directly. */
+    uncompressed_data = crc_verifier_buffer(cv);
+    if (fread(compressed_flag == COMPRESSED_FLAG ? compressed_data : uncompressed_data, length, 1, infp) != 1) {
       if (feof(infp)) {
         print_error("Unexpected end of file\n");
       } else {
@@ -232,58 +250,152 @@ static int snappy_in_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
 
     if (compressed_flag == COMPRESSED_FLAG) {
       /* check the uncompressed length */
-      size_t uncompressed_length;
-      err = snappy_uncompressed_length(wb.c, length, &uncompressed_length);
-      if (err != 0) {
-        print_error("Invalid data: GetUncompressedLength failed %d\n", err);
+      int rv = snappy_uncompressed_length(compressed_data, length, &uncompressed_length);
+      if (rv != 0) {
+        print_error("Invalid data: GetUncompressedLength failed %d\n", rv);
         goto cleanup;
       }
-      err = 1;
-      if (uncompressed_length > wb.uclen) {
+      if (uncompressed_length > MAX_BLOCK_SIZE) {
         print_error("Invalid data: too long uncompressed length\n");
         goto cleanup;
       }
 
-      /* uncompress and write */
-      if (snappy_uncompress(wb.c, length, wb.uc, &uncompressed_length)) {
+      /* uncompress */
+      if (snappy_uncompress(compressed_data, length, uncompressed_data, &uncompressed_length)) {
         print_error("Invalid data: RawUncompress failed\n");
         goto cleanup;
       }
-      if (check_and_write_block(outfd, wb.uc, uncompressed_length, 1, crc32c)) {
-        goto cleanup;
-      }
     } else {
-      if (check_and_write_block(outfd, wb.c, length, 1, crc32c)) {
-        goto cleanup;
-      }
+      uncompressed_length = length;
     }
+    if (crc_verifier_submit(cv, uncompressed_data, uncompressed_length, crc32c, 0, uncompressed_length) != 0) {
+      goto cleanup;
+    }
+    trace("write %ld bytes\n", (long)uncompressed_length);
   }
  cleanup:
-  work_buffer_free(&wb);
+  if (cv != NULL) {
+    crc_verifier_finish(cv);
+  }
+  free(compressed_data);
   return err;
 }
 
-static int check_and_write_block(int outfd, const char *buffer, size_t length, int verify_checksum, unsigned int crc32c)
+static int snappy_in_java_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
 {
-  if (verify_checksum) {
-    unsigned int actual_crc32c = masked_crc32c(buffer, length);
-    if (actual_crc32c != crc32c) {
-      print_error("Invalid crc code (expected 0x%08x but 0x%08x)\n", crc32c, actual_crc32c);
-      return 1;
+  snappy_in_java_header_t header;
+  work_buffer_t wb;
+  int err = 1;
+
+  work_buffer_init(&wb, MAX_BLOCK_SIZE);
+  if (!skip_magic) {
+    if (fread(&header, sizeof(header), 1, infp) != 1) {
+      print_error("Failed to read a file: %s\n", strerror(errno));
+      goto cleanup;
+    }
+    if (memcmp(header.magic, SNAPPY_IN_JAVA_MAGIC, SNAPPY_IN_JAVA_MAGIC_LEN) != 0) {
+      print_error("This is not a snappy-in-java file.\n");
+      goto cleanup;
+    }
+  }
+  for (;;) {
+    snappy_block_t blk;
+    int compressed_flag = getc(infp);
+
+    if (compressed_flag == EOF) {
+      break;
+    }
+    if (compressed_flag != COMPRESSED_FLAG && compressed_flag != UNCOMPRESSED_FLAG) {
+      print_error("Unknown compressed flag 0x%02x\n", compressed_flag);
+      goto cleanup;
+    }
+    blk.len = getc(infp) << 8;
+    blk.len |= getc(infp);
+    blk.crc32c = (unsigned int)getc(infp) << 24;
+    blk.crc32c |= getc(infp) << 16;
+    blk.crc32c |= getc(infp) << 8;
+    blk.crc32c |= getc(infp);
+    if (feof(infp)) {
+      print_error("Unexpected end of file.\n");
+      goto cleanup;
+    }
+    if (read_compressed_data(infp, &wb, blk.len) != 0) {
+      goto cleanup;
+    }
+    blk.data = wb.c;
+    blk.compressed = (compressed_flag == COMPRESSED_FLAG);
+    blk.has_crc = TRUE;
+    if (!blk.compressed) {
+      blk.uncompressed_len = blk.len;
+    } else if (snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK
+               || blk.uncompressed_len > MAX_BLOCK_SIZE) {
+      print_error("Invalid data: GetUncompressedLength failed\n");
+      goto cleanup;
     }
+    if (handler(ctx, &blk) != 0) {
+      goto cleanup;
+    }
+  }
+  if (ferror(infp)) {
+    print_error("Failed to read a file: %s\n", strerror(errno));
+    goto cleanup;
   }
-  if (write_full(outfd, buffer, length) != length) {
+  err = 0;
+ cleanup:
+  work_buffer_free(&wb);
+  return err;
+}
+
+static int snappy_in_java_write_header(FILE *outfp, size_t block_size, void **state)
+{
+  if (fwrite(&snappy_in_java_header, sizeof(snappy_in_java_header), 1, outfp) != 1) {
     print_error("Failed to write a file: %s\n", strerror(errno));
-    return 1;
+    return -1;
   }
-  trace("write %ld bytes\n", (long)length);
   return 0;
 }
 
+static int snappy_in_java_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  return write_block(outfp, blk->data, blk->len, blk->compressed, blk->crc32c);
+}
+
+static const block_writer_t snappy_in_java_block_writer = {
+  DEFAULT_BLOCK_SIZE,
+  MAX_BLOCK_SIZE,
+  MAX_BLOCK_SIZE,
+  TRUE,
+  TRUE,
+  FALSE,
+  snappy_in_java_write_header,
+  snappy_in_java_write_block,
+  NULL,
+};
+
+/*
+ * The file header is allowed only at the beginning of a file.
+ * It is stripped from the second and later files.
+ */
+static int snappy_in_java_concat(int infd, int outfd, uint64_t size, int first)
+{
+  snappy_in_java_header_t header;
+
+  if (size < sizeof(header) || pread_full(infd, &header, sizeof(header), 0) != 0
+      || memcmp(header.magic, SNAPPY_IN_JAVA_MAGIC, SNAPPY_IN_JAVA_MAGIC_LEN) != 0) {
+    print_error("Invalid snappy-in-java header\n");
+    return -1;
+  }
+  return copy_data(outfd, infd, first ? 0 : sizeof(header), size);
+}
+
 stream_format_t snappy_in_java_format = {
   "snappy-in-java",
   "https://github.com/dain/snappy",
   "snappy",
   snappy_in_java_compress,
   snappy_in_java_uncompress,
+  NULL,
+  snappy_in_java_concat,
+  snappy_in_java_read_blocks,
+  &snappy_in_java_block_writer,
 };
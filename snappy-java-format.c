@@ -46,6 +46,7 @@
 #define SNAPPY_JAVA_MAGIC_LEN 8
 #define SNAPPY_JAVA_FILE_VERSION 1
 #define DEFAULT_BLOCK_SIZE (32 * 1024) // Use 32kb for the default block size
+#define ADAPTIVE_MAX_BLOCK_SIZE (1024 * 1024) /* maximum block size of --adaptive-blocks */
 
 typedef struct {
   char magic[SNAPPY_JAVA_MAGIC_LEN];
@@ -58,13 +59,14 @@ static int snappy_java_compress(FILE *infp, FILE *outfp, size_t block_size)
   snappy_java_header_t header;
   work_buffer_t wb;
   size_t uncompressed_length;
+  chunker_t chunker;
   int err = 1;
 
   wb.c = NULL;
   wb.uc = NULL;
 
   if (block_size == 0) {
-    block_size = DEFAULT_BLOCK_SIZE;
+    block_size = adaptive_blocks ? ADAPTIVE_MAX_BLOCK_SIZE : DEFAULT_BLOCK_SIZE;
   }
 
   /* write the file header */
@@ -79,7 +81,8 @@ static int snappy_java_compress(FILE *infp, FILE *outfp, size_t block_size)
 
   /* write file body */
   work_buffer_init(&wb, block_size);
-  while ((uncompressed_length = fread(wb.uc, 1, wb.uclen, infp)) > 0) {
+  chunker_init(&chunker);
+  while ((uncompressed_length = chunker_read(&chunker, wb.uc, wb.uclen, infp)) > 0) {
     size_t compressed_length = wb.clen;
 
     trace("read %lu bytes.\n", (unsigned long)uncompressed_length);
@@ -87,6 +90,7 @@ static int snappy_java_compress(FILE *infp, FILE *outfp, size_t block_size)
     /* compress the block. */
     snappy_compress(wb.uc, uncompressed_length, wb.c, &compressed_length);
     trace("compressed_legnth is %lu.\n", (unsigned long)compressed_length);
+    chunker_add_output(&chunker, compressed_length);
 
     /* write the compressed length. */
     putc((compressed_length >> 24), outfp);
@@ -107,39 +111,34 @@ static int snappy_java_compress(FILE *infp, FILE *outfp, size_t block_size)
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  chunker_report(&chunker);
   err = 0;
  cleanup:
   work_buffer_free(&wb);
   return err;
 }
 
-static int snappy_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+static int read_header(FILE *infp, int skip_magic)
 {
   snappy_java_header_t header;
-  work_buffer_t wb;
-  int err = 1;
-  int outfd;
-
-  wb.c = NULL;
-  wb.uc = NULL;
 
   if (skip_magic) {
     /* read header except magic */
     if (fread(&header.version, sizeof(header) - sizeof(header.magic), 1, infp) != 1) {
       print_error("Failed to read a file: %s\n", strerror(errno));
-      goto cleanup;
+      return -1;
     }
   } else {
     /* read header */
     if (fread(&header, sizeof(header), 1, infp) != 1) {
       print_error("Failed to read a file: %s\n", strerror(errno));
-      goto cleanup;
+      return -1;
     }
 
     /* check magic */
     if (memcmp(header.magic, SNAPPY_JAVA_MAGIC, SNAPPY_JAVA_MAGIC_LEN) != 0) {
       print_error("This is not a snappy-java file.\n");
-      goto cleanup;
+      return -1;
     }
   }
 
@@ -147,12 +146,29 @@ static int snappy_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
   header.version = SNZ_FROM_BE32(header.version);
   if (header.version != SNAPPY_JAVA_FILE_VERSION) {
     print_error("Unknown snappy-java version %d\n", header.version);
-    goto cleanup;
+    return -1;
   }
 
   header.compatible_version = SNZ_FROM_BE32(header.compatible_version);
   if (header.compatible_version != SNAPPY_JAVA_FILE_VERSION) {
     print_error("Unknown snappy-java compatible version %d\n", header.compatible_version);
+    return -1;
+  }
+  return 0;
+}
+
+static int snappy_java_uncompress_range(FILE *infp, FILE *outfp, int skip_magic, uint64_t offset, uint64_t length)
+{
+  work_buffer_t wb;
+  byte_range_t br;
+  int err = 1;
+  int outfd;
+
+  wb.c = NULL;
+  wb.uc = NULL;
+  byte_range_init(&br, offset, length);
+
+  if (read_header(infp, skip_magic) != 0) {
     goto cleanup;
   }
 
@@ -164,10 +180,13 @@ static int snappy_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
 
   /* read body */
   work_buffer_init(&wb, DEFAULT_BLOCK_SIZE);
-  for (;;) {
+  while (!byte_range_done(&br)) {
     /* read the compressed length in a block */
     size_t compressed_length = 0;
     size_t uncompressed_length = wb.uclen;
+    size_t head_length;
+    size_t write_offset;
+    size_t write_length;
     int idx;
 
     for (idx = 3; idx >= 0; idx--) {
@@ -193,8 +212,22 @@ static int snappy_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
       work_buffer_resize(&wb, compressed_length, 0);
     }
 
-    /* read the compressed data */
-    if (fread(wb.c, compressed_length, 1, infp) != 1) {
+    /* check the uncompressed length */
+    if (read_uncompressed_length(infp, wb.c, compressed_length, &head_length, &uncompressed_length) != 0) {
+      goto cleanup;
+    }
+    if (byte_range_skip(&br, uncompressed_length)) {
+      if (skip_input(infp, compressed_length - head_length) != 0) {
+        goto cleanup;
+      }
+      continue;
+    }
+    if (uncompressed_length > wb.uclen) {
+      work_buffer_resize(&wb, 0, uncompressed_length);
+    }
+
+    /* read the rest of the compressed data */
+    if (compressed_length > head_length && fread(wb.c + head_length, compressed_length - head_length, 1, infp) != 1) {
       if (feof(infp)) {
         print_error("Unexpected end of file\n");
       } else {
@@ -204,37 +237,138 @@ static int snappy_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     }
     trace("read %ld bytes.\n", (long)(compressed_length));
 
-    /* check the uncompressed length */
-    err = snappy_uncompressed_length(wb.c, compressed_length, &uncompressed_length);
-    if (err != 0) {
-      print_error("Invalid data: GetUncompressedLength failed %d\n", err);
-      goto cleanup;
-    }
-    err = 1;
-    if (uncompressed_length > wb.uclen) {
-      work_buffer_resize(&wb, 0, uncompressed_length);
-    }
-
     /* uncompress and write */
     if (snappy_uncompress(wb.c, compressed_length, wb.uc, &uncompressed_length)) {
       print_error("Invalid data: RawUncompress failed\n");
       goto cleanup;
     }
-    if (write_full(outfd, wb.uc, uncompressed_length) != uncompressed_length) {
+    write_length = byte_range_clip(&br, uncompressed_length, &write_offset);
+    if (write_full(outfd, wb.uc + write_offset, write_length) != write_length) {
       print_error("Failed to write a file: %s\n", strerror(errno));
       goto cleanup;
     }
-    trace("write %ld bytes\n", (long)uncompressed_length);
+    trace("write %ld bytes\n", (long)write_length);
+  }
+  err = 0;
+ cleanup:
+  work_buffer_free(&wb);
+  return err;
+}
+
+static int snappy_java_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+{
+  return snappy_java_uncompress_range(infp, outfp, skip_magic, 0, UINT64_MAX);
+}
+
+static int snappy_java_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
+{
+  work_buffer_t wb;
+  int err = 1;
+
+  work_buffer_init(&wb, DEFAULT_BLOCK_SIZE);
+  if (read_header(infp, skip_magic) != 0) {
+    goto cleanup;
+  }
+  for (;;) {
+    snappy_block_t blk;
+    unsigned int n;
+
+    if (fread(&n, sizeof(n), 1, infp) != 1) {
+      if (feof(infp)) {
+        break;
+      }
+      print_error("Failed to read a file: %s\n", strerror(errno));
+      goto cleanup;
+    }
+    blk.len = SNZ_FROM_BE32(n);
+    if (blk.len == 0) {
+      print_error("Invalid compressed length %ld\n", (long)blk.len);
+      goto cleanup;
+    }
+    if (read_compressed_data(infp, &wb, blk.len) != 0) {
+      goto cleanup;
+    }
+    blk.data = wb.c;
+    blk.compressed = TRUE;
+    blk.has_crc = FALSE;
+    blk.crc32c = 0;
+    if (snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK) {
+      print_error("Invalid data: GetUncompressedLength failed\n");
+      goto cleanup;
+    }
+    if (handler(ctx, &blk) != 0) {
+      goto cleanup;
+    }
   }
+  err = 0;
  cleanup:
   work_buffer_free(&wb);
   return err;
 }
 
+static int snappy_java_write_header(FILE *outfp, size_t block_size, void **state)
+{
+  snappy_java_header_t header;
+
+  memcpy(header.magic, SNAPPY_JAVA_MAGIC, SNAPPY_JAVA_MAGIC_LEN);
+  header.version = SNZ_TO_BE32(SNAPPY_JAVA_FILE_VERSION);
+  header.compatible_version = SNZ_TO_BE32(SNAPPY_JAVA_FILE_VERSION);
+  if (fwrite(&header, sizeof(header), 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int snappy_java_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  unsigned int n = SNZ_TO_BE32((unsigned int)blk->len);
+
+  if (fwrite(&n, sizeof(n), 1, outfp) != 1 || fwrite(blk->data, blk->len, 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* snappy-java reads blocks into byte arrays whose length is an int. */
+static const block_writer_t snappy_java_block_writer = {
+  DEFAULT_BLOCK_SIZE,
+  0x7fffffff,
+  0x7fffffff,
+  FALSE,
+  FALSE,
+  FALSE,
+  snappy_java_write_header,
+  snappy_java_write_block,
+  NULL,
+};
+
+/*
+ * The file header is allowed only at the beginning of a file.
+ * It is stripped from the second and later files.
+ */
+static int snappy_java_concat(int infd, int outfd, uint64_t size, int first)
+{
+  snappy_java_header_t header;
+
+  if (size < sizeof(header) || pread_full(infd, &header, sizeof(header), 0) != 0
+      || memcmp(header.magic, SNAPPY_JAVA_MAGIC, SNAPPY_JAVA_MAGIC_LEN) != 0
+      || SNZ_FROM_BE32(header.version) != SNAPPY_JAVA_FILE_VERSION) {
+    print_error("Invalid snappy-java header\n");
+    return -1;
+  }
+  return copy_data(outfd, infd, first ? 0 : sizeof(header), size);
+}
+
 stream_format_t snappy_java_format = {
   "snappy-java",
   "https://github.com/xerial/snappy-java",
   "snappy",
   snappy_java_compress,
   snappy_java_uncompress,
+  snappy_java_uncompress_range,
+  snappy_java_concat,
+  snappy_java_read_blocks,
+  &snappy_java_block_writer,
 };
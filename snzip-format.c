@@ -34,38 +34,147 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <snappy-c.h>
 #include "snzip.h"
+#include "crc32.h"
+#ifdef WIN32
+#define stat _stati64
+#define fstat _fstati64
+#define fseeko _fseeki64
+#endif
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
 
 #define SNZ_MAGIC "SNZ"
 #define SNZ_MAGIC_LEN 3
 #define SNZ_FILE_VERSION 1
+#define SNZ_INDEX_VERSION 2 /* with checksums and a footer index */
+#define SNZ_FILTER_VERSION 3 /* version 2 with a filter after the header */
 
 #define SNZ_DEFAULT_BLOCK_SIZE 16 /* (1 << 16) => 64 KiB */
 #define SNZ_MAX_BLOCK_SIZE 27 /* (1 << 27) => 128 MiB */
+#define SNZ_ADAPTIVE_BLOCK_SIZE 20 /* maximum with --adaptive-blocks */
 
 #define VARINT_MAX 5
 
+/* footer of version 2 */
+#define SNZ_INDEX_ENTRY_LEN 8
+#define SNZ_TRAILER_LEN 28
+#define SNZ_TRAILER_MAGIC "SNZX"
+
 typedef struct {
   char magic[SNZ_MAGIC_LEN]; /* SNZ_MAGIC */
-  char version;  /* SNZ_FILE_VERSION */
+  char version;  /* SNZ_FILE_VERSION, SNZ_INDEX_VERSION or SNZ_FILTER_VERSION */
   unsigned char block_size; /* nth power of two. */
 } snz_header_t;
 
+/* follows the header in version 3 */
+typedef struct {
+  unsigned char type; /* FILTER_SHUFFLE or FILTER_SHUFFLE_DELTA */
+  unsigned char elem_size;
+} snz_filter_t;
+
+typedef struct {
+  uint64_t total_length; /* total uncompressed length */
+  uint64_t offset; /* offset of the footer from the beginning of the stream */
+  uint32_t num_blocks;
+} snz_trailer_t;
+
+/* version written by the compressor. --shuffle writes SNZ_FILTER_VERSION. */
+int snzip_output_version = SNZ_FILE_VERSION;
+
+static int read_filter(FILE *fp, snz_filter_t *filter)
+{
+  if (fread(filter, sizeof(*filter), 1, fp) != 1) {
+    print_error("Unexpected end of file\n");
+    return -1;
+  }
+  if ((filter->type != FILTER_SHUFFLE && filter->type != FILTER_SHUFFLE_DELTA) || filter->elem_size == 0) {
+    print_error("Unknown filter %d (element size %d)\n", filter->type, filter->elem_size);
+    return -1;
+  }
+  trace("filter %d, element size %d\n", filter->type, filter->elem_size);
+  return 0;
+}
+
+static int write_varint(FILE *fp, size_t value)
+{
+  int len = 1;
+
+  while (value >= 128) {
+    putc((value & 127) | 128, fp);
+    value >>= 7;
+    len++;
+  }
+  putc(value, fp);
+  return len;
+}
+
+/*
+ * Write the footer of version 2; the compressed offsets of blocks
+ * followed by a fixed-length trailer.
+ */
+static int write_footer(FILE *fp, const uint64_t *block_offsets, const snz_trailer_t *trailer)
+{
+  size_t len = trailer->num_blocks * SNZ_INDEX_ENTRY_LEN + SNZ_TRAILER_LEN;
+  char *buf = malloc(len);
+  char *p = buf;
+  uint32_t i;
+  int err = -1;
+
+  if (buf == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  for (i = 0; i < trailer->num_blocks; i++) {
+    snz_put_le(p, block_offsets[i], 8);
+    p += SNZ_INDEX_ENTRY_LEN;
+  }
+  snz_put_le(p, trailer->total_length, 8);
+  snz_put_le(p + 8, trailer->offset, 8);
+  snz_put_le(p + 16, trailer->num_blocks, 4);
+  snz_put_le(p + 20, masked_crc32c(buf, p + 20 - buf), 4);
+  memcpy(p + 24, SNZ_TRAILER_MAGIC, 4);
+  if (fwrite(buf, len, 1, fp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  trace("write %lu bytes for footer.\n", (unsigned long)len);
+  err = 0;
+ cleanup:
+  free(buf);
+  return err;
+}
+
 static int snzip_compress(FILE *infp, FILE *outfp, size_t block_size)
 {
   snz_header_t header;
   work_buffer_t wb;
   size_t uncompressed_length;
+  snz_trailer_t trailer = {0, };
+  uint64_t *block_offsets = NULL;
+  size_t max_blocks = 0;
+  constant_block_t constant;
+  dedup_cache_t dedup;
+  chunker_t chunker;
+  char *filtered = NULL;
+  int version = shuffle_elem_size ? SNZ_FILTER_VERSION : snzip_output_version;
+  int need_crc = (version >= SNZ_INDEX_VERSION || dedup_cache_blocks != 0);
   int err = 1;
   int nshift;
 
   wb.c = NULL;
   wb.uc = NULL;
+  constant_block_init(&constant);
+  dedup_cache_init(&dedup, dedup_cache_blocks);
+  chunker_init(&chunker);
 
   if (block_size == 0) {
-    block_size = 1ul << SNZ_DEFAULT_BLOCK_SIZE;
-    nshift = SNZ_DEFAULT_BLOCK_SIZE;
+    nshift = adaptive_blocks ? SNZ_ADAPTIVE_BLOCK_SIZE : SNZ_DEFAULT_BLOCK_SIZE;
+    block_size = 1ul << nshift;
   } else {
     if (block_size > (1ul << SNZ_MAX_BLOCK_SIZE)) {
       print_error("too large block size: %lu\n", block_size);
@@ -85,84 +194,266 @@ static int snzip_compress(FILE *infp, FILE *outfp, size_t block_size)
 
   /* write the file header */
   memcpy(header.magic, SNZ_MAGIC, SNZ_MAGIC_LEN);
-  header.version = SNZ_FILE_VERSION;
+  header.version = version;
   header.block_size = nshift;
 
   if (fwrite(&header, sizeof(header), 1, outfp) != 1) {
     print_error("Failed to write a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  trailer.offset = sizeof(header);
+  if (shuffle_elem_size) {
+    snz_filter_t filter;
+
+    filter.type = shuffle_delta ? FILTER_SHUFFLE_DELTA : FILTER_SHUFFLE;
+    filter.elem_size = shuffle_elem_size;
+    if (fwrite(&filter, sizeof(filter), 1, outfp) != 1) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
+      goto cleanup;
+    }
+    trailer.offset += sizeof(filter);
+    filtered = malloc(block_size);
+    if (filtered == NULL) {
+      print_error("out of memory\n");
+      goto cleanup;
+    }
+  }
 
   /* write file body */
   work_buffer_init(&wb, block_size);
-  while ((uncompressed_length = fread(wb.uc, 1, wb.uclen, infp)) > 0) {
+  /* Blocks may be shorter than the block size only in version 1. */
+  while ((uncompressed_length = chunker_read(&chunker, wb.uc, wb.uclen, infp)) > 0) {
     size_t compressed_length = wb.clen;
+    const char *data = filtered ? filtered : wb.uc; /* data to be compressed */
+    const constant_block_t *cb;
+    unsigned int crc32c = 0;
+    const char *compressed = wb.c;
+    char buf[4];
+    int len;
 
     trace("read %lu bytes.\n", (unsigned long)uncompressed_length);
 
-    /* compress the block. */
-    snappy_compress(wb.uc, uncompressed_length, wb.c, &compressed_length);
+    if (filtered != NULL) {
+      shuffle_block(filtered, wb.uc, uncompressed_length, shuffle_elem_size, shuffle_delta);
+    }
+    /* The checksum is of the data before filtering. */
+    cb = find_constant_block(&constant, data, uncompressed_length);
+    if (need_crc) {
+      crc32c = (cb != NULL && filtered == NULL) ? cb->crc32c : masked_crc32c(wb.uc, uncompressed_length);
+    }
+
+    if (version >= SNZ_INDEX_VERSION) {
+      if (trailer.num_blocks == max_blocks) {
+        size_t new_max_blocks = max_blocks ? max_blocks * 2 : 1024;
+        uint64_t *tmp = realloc(block_offsets, new_max_blocks * sizeof(uint64_t));
+        if (tmp == NULL) {
+          print_error("out of memory\n");
+          goto cleanup;
+        }
+        block_offsets = tmp;
+        max_blocks = new_max_blocks;
+      }
+      block_offsets[trailer.num_blocks++] = trailer.offset;
+    }
+
+    /* compress the block unless it is constant or compressed before. */
+    if (cb != NULL) {
+      compressed = cb->compressed;
+      compressed_length = cb->compressed_len;
+    } else if (!dedup_cache_find(&dedup, crc32c, data, uncompressed_length, &compressed, &compressed_length)) {
+      snappy_compress(data, uncompressed_length, wb.c, &compressed_length);
+      dedup_cache_add(&dedup, crc32c, data, uncompressed_length, wb.c, compressed_length);
+    }
     trace("compressed_legnth is %lu.\n", (unsigned long)compressed_length);
+    chunker_add_output(&chunker, compressed_length);
 
-    /* write the compressed length. */
-    if (compressed_length < (1ul << 7)) {
-      putc(compressed_length, outfp);
-      trace("write 1 byte for compressed data length.\n");
-    } else if (compressed_length < (1ul << 14)) {
-      putc((compressed_length >> 0) | 0x80, outfp);
-      putc((compressed_length >> 7), outfp);
-      trace("write 2 bytes for compressed data length.\n");
-    } else if (compressed_length < (1ul << 21)) {
-      putc((compressed_length >> 0) | 0x80, outfp);
-      putc((compressed_length >> 7) | 0x80, outfp);
-      putc((compressed_length >> 14), outfp);
-      trace("write 3 bytes for compressed data length.\n");
-    } else if (compressed_length < (1ul << 28)) {
-      putc((compressed_length >> 0) | 0x80, outfp);
-      putc((compressed_length >> 7) | 0x80, outfp);
-      putc((compressed_length >> 14)| 0x80, outfp);
-      putc((compressed_length >> 21), outfp);
-      trace("write 4 bytes for compressed data length.\n");
-    } else {
-      putc((compressed_length >> 0) | 0x80, outfp);
-      putc((compressed_length >> 7) | 0x80, outfp);
-      putc((compressed_length >> 14)| 0x80, outfp);
-      putc((compressed_length >> 21)| 0x80, outfp);
-      putc((compressed_length >> 28), outfp);
-      trace("write 5 bytes for compressed data length.\n");
+    /* write the compressed length, the uncompressed length and the checksum. */
+    len = write_varint(outfp, compressed_length);
+    if (version >= SNZ_INDEX_VERSION) {
+      len += write_varint(outfp, uncompressed_length);
+      snz_put_le(buf, crc32c, 4);
+      fwrite(buf, 4, 1, outfp);
+      len += 4;
     }
+    trace("write %d bytes for block header.\n", len);
 
     /* write the compressed data. */
-    if (fwrite(wb.c, compressed_length, 1, outfp) != 1) {
+    if (fwrite(compressed, compressed_length, 1, outfp) != 1) {
       print_error("Failed to write a file: %s\n", strerror(errno));
       goto cleanup;
     }
     trace("write %ld bytes for compressed data.\n", (long)compressed_length);
+    trailer.offset += len + compressed_length;
+    trailer.total_length += uncompressed_length;
   }
   if (!feof(infp)) {
     /* fread() failed. */
     print_error("Failed to read a file: %s\n", strerror(errno));
     goto cleanup;
   }
+  constant_block_report(&constant);
+  dedup_cache_report(&dedup);
+  chunker_report(&chunker);
   putc('\0', outfp);
   trace("write 1 byte\n");
+  trailer.offset++;
+  if (version >= SNZ_INDEX_VERSION && write_footer(outfp, block_offsets, &trailer) != 0) {
+    goto cleanup;
+  }
   err = 0;
  cleanup:
   work_buffer_free(&wb);
+  free(block_offsets);
+  free(filtered);
+  constant_block_free(&constant);
+  dedup_cache_free(&dedup);
   return err;
 }
 
-static int snzip_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+static int read_varint(FILE *fp, size_t *value, int *len)
+{
+  int idx;
+
+  *value = 0;
+  for (idx = 0; idx < VARINT_MAX; idx++) {
+    int chr = getc(fp);
+    if (chr == -1) {
+      print_error("Unexpected end of file.\n");
+      return -1;
+    }
+    *value |= ((size_t)(chr & 127) << (idx * 7));
+    if ((chr & 128) == 0) {
+      *len = idx + 1;
+      return 0;
+    }
+  }
+  print_error("Invalid format.\n");
+  return -1;
+}
+
+static int parse_trailer(const char *buf, snz_trailer_t *trailer)
+{
+  if (memcmp(buf + 24, SNZ_TRAILER_MAGIC, 4) != 0) {
+    return -1;
+  }
+  trailer->total_length = snz_get_le(buf, 8);
+  trailer->offset = snz_get_le(buf + 8, 8);
+  trailer->num_blocks = snz_get_le(buf + 16, 4);
+  return 0;
+}
+
+/*
+ * Read the footer following the end of data and check it.
+ */
+static int check_footer(FILE *fp, const snz_trailer_t *expected)
+{
+  size_t len = expected->num_blocks * SNZ_INDEX_ENTRY_LEN + SNZ_TRAILER_LEN;
+  char *buf = malloc(len);
+  char *trailer_buf = buf + len - SNZ_TRAILER_LEN;
+  snz_trailer_t trailer;
+  int err = -1;
+
+  if (buf == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  if (fread(buf, len, 1, fp) != 1) {
+    if (feof(fp)) {
+      print_error("Unexpected end of file\n");
+    } else {
+      print_error("Failed to read a file: %s\n", strerror(errno));
+    }
+    goto cleanup;
+  }
+  if (parse_trailer(trailer_buf, &trailer) != 0
+      || snz_get_le(trailer_buf + 20, 4) != masked_crc32c(buf, len - 8)) {
+    print_error("Invalid footer\n");
+    goto cleanup;
+  }
+  if (trailer.num_blocks != expected->num_blocks
+      || trailer.total_length != expected->total_length
+      || trailer.offset != expected->offset) {
+    print_error("Invalid footer: inconsistent with data\n");
+    goto cleanup;
+  }
+  err = 0;
+ cleanup:
+  free(buf);
+  return err;
+}
+
+/*
+ * Seek to the block including the start of the byte range by using the
+ * footer of version 2. All blocks except the last one have the same
+ * uncompressed length. This returns 1 when the footer isn't available.
+ */
+static int seek_block(FILE *fp, int nshift, byte_range_t *br, snz_trailer_t *pos)
+{
+  int fd = fileno(fp);
+  struct stat sbuf;
+  char buf[SNZ_TRAILER_LEN];
+  snz_trailer_t trailer;
+  uint64_t block_no;
+
+  if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode) || sbuf.st_size < sizeof(snz_header_t) + 1 + SNZ_TRAILER_LEN) {
+    return 1;
+  }
+  if (pread_full(fd, buf, sizeof(buf), sbuf.st_size - SNZ_TRAILER_LEN) != 0) {
+    return -1;
+  }
+  if (parse_trailer(buf, &trailer) != 0) {
+    return 1;
+  }
+  /* The footer must be at the end of the stream starting at the beginning of the file. */
+  if (trailer.offset + (uint64_t)trailer.num_blocks * SNZ_INDEX_ENTRY_LEN + SNZ_TRAILER_LEN != sbuf.st_size) {
+    trace("footer for another stream\n");
+    return 1;
+  }
+  block_no = br->start >> nshift;
+  if (block_no >= trailer.num_blocks) {
+    /* nothing to be read */
+    br->pos = br->end;
+    return 0;
+  }
+  if (pread_full(fd, buf, SNZ_INDEX_ENTRY_LEN, trailer.offset + block_no * SNZ_INDEX_ENTRY_LEN) != 0) {
+    return -1;
+  }
+  pos->offset = snz_get_le(buf, 8);
+  pos->num_blocks = block_no;
+  pos->total_length = block_no << nshift;
+  if (pos->offset < sizeof(snz_header_t) || pos->offset >= trailer.offset) {
+    print_error("Invalid footer\n");
+    return -1;
+  }
+  trace("seek to block %llu at %llu\n", (unsigned long long)block_no, (unsigned long long)pos->offset);
+  if (fseeko(fp, pos->offset, SEEK_SET) != 0) {
+    print_error("Failed to seek a file: %s\n", strerror(errno));
+    return -1;
+  }
+  br->pos = pos->total_length;
+  return 0;
+}
+
+static int snzip_uncompress_range(FILE *infp, FILE *outfp, int skip_magic, uint64_t offset, uint64_t length)
 {
   snz_header_t header;
   work_buffer_t wb;
+  byte_range_t br;
+  snz_trailer_t pos = {0, }; /* current position */
+  crc_verifier_t *cv = NULL;
+  constant_block_t constant;
+  snz_filter_t filter = {0, };
+  int short_block = FALSE;
   int err = 1;
-  int outfd;
+  int outfd = -1;
 
   wb.c = NULL;
   wb.uc = NULL;
+  constant_block_init(&constant);
+  byte_range_init(&br, offset, length);
 
   if (skip_magic) {
+    header.version = snzip_format_version;
     header.block_size = snzip_format_block_size;
   } else {
     /* read header */
@@ -177,7 +468,7 @@ static int snzip_uncompress(FILE *infp, FILE *outfp, int skip_magic)
       goto cleanup;
     }
     /* check rest header */
-    if (header.version != SNZ_FILE_VERSION) {
+    if (header.version < 1 || header.version > SNZ_FILTER_VERSION) {
       print_error("Unknown snz version %d\n", header.version);
       goto cleanup;
     }
@@ -186,49 +477,105 @@ static int snzip_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     print_error("Invalid block size %d (max %d)\n", header.block_size, SNZ_MAX_BLOCK_SIZE);
     goto cleanup;
   }
+  pos.offset = sizeof(header);
+  if (header.version == SNZ_FILTER_VERSION) {
+    if (read_filter(infp, &filter) != 0) {
+      goto cleanup;
+    }
+    pos.offset += sizeof(filter);
+  }
 
-  /* Use a file descriptor 'outfd' instead of the stdio file pointer 'outfp'
-   * to reduce the number of write system calls.
-   */
-  fflush(outfp);
-  outfd = fileno(outfp);
+  if (header.version >= 2) {
+    if (br.start > 0) {
+      if (seek_block(infp, header.block_size, &br, &pos) < 0) {
+        goto cleanup;
+      }
+    }
+    /* Checksums are verified and uncompressed data are written by
+     * the crc verifier while the next block is uncompressed.
+     */
+    cv = crc_verifier_create(outfp, 1 << header.block_size);
+    if (cv == NULL) {
+      goto cleanup;
+    }
+  } else {
+    /* Use a file descriptor 'outfd' instead of the stdio file pointer 'outfp'
+     * to reduce the number of write system calls.
+     */
+    fflush(outfp);
+    outfd = fileno(outfp);
+  }
 
   /* read body */
   work_buffer_init(&wb, (1 << header.block_size));
-  for (;;) {
-    /* read the compressed length in a block */
-    size_t compressed_length = 0;
+  while (!byte_range_done(&br)) {
+    size_t compressed_length;
     size_t uncompressed_length = wb.uclen;
-    int idx;
+    size_t head_length = 0;
+    size_t write_offset;
+    size_t write_length;
+    unsigned int crc32c = 0;
+    char *uncompressed_data;
+    char *snappy_output; /* differs from uncompressed_data when filtered */
+    int len;
 
-    for (idx = 0; idx < VARINT_MAX; idx++) {
-      int chr = getc(infp);
-      if (chr == -1) {
-        print_error("Unexpected end of file.\n");
-        goto cleanup;
-      }
-      compressed_length |= ((chr & 127) << (idx * 7));
-      if ((chr & 128) == 0) {
-        break;
-      }
-    }
-    trace("read %d bytes (compressed_length = %ld)\n", idx + 1, (long)compressed_length);
-    if (idx == VARINT_MAX) {
-      print_error("Invalid format.\n");
+    /* read the compressed length in a block */
+    if (read_varint(infp, &compressed_length, &len) != 0) {
       goto cleanup;
     }
+    trace("read %d bytes (compressed_length = %ld)\n", len, (long)compressed_length);
     if (compressed_length == 0) {
       /* read all blocks */
-      err = 0;
-      goto cleanup;
+      pos.offset += len;
+      if (header.version >= 2 && check_footer(infp, &pos) != 0) {
+        goto cleanup;
+      }
+      break;
     }
     if (compressed_length > wb.clen) {
       print_error("Invalid data: too long compressed length\n");
       goto cleanup;
     }
 
-    /* read the compressed data */
-    if (fread(wb.c, compressed_length, 1, infp) != 1) {
+    /* check the uncompressed length */
+    if (header.version >= 2) {
+      char buf[4];
+      int len2;
+
+      if (read_varint(infp, &uncompressed_length, &len2) != 0) {
+        goto cleanup;
+      }
+      if (fread(buf, 4, 1, infp) != 1) {
+        print_error("Unexpected end of file\n");
+        goto cleanup;
+      }
+      crc32c = snz_get_le(buf, 4);
+      if (short_block) {
+        print_error("Invalid data: a short block is followed by another block\n");
+        goto cleanup;
+      }
+      short_block = (uncompressed_length != wb.uclen);
+      pos.offset += len + len2 + 4 + compressed_length;
+      pos.total_length += uncompressed_length;
+      pos.num_blocks++;
+    } else {
+      if (read_uncompressed_length(infp, wb.c, compressed_length, &head_length, &uncompressed_length) != 0) {
+        goto cleanup;
+      }
+    }
+    if (uncompressed_length > wb.uclen) {
+      print_error("Invalid data: too long uncompressed length\n");
+      goto cleanup;
+    }
+    if (byte_range_skip(&br, uncompressed_length)) {
+      if (skip_input(infp, compressed_length - head_length) != 0) {
+        goto cleanup;
+      }
+      continue;
+    }
+
+    /* read the rest of the compressed data */
+    if (compressed_length > head_length && fread(wb.c + head_length, compressed_length - head_length, 1, infp) != 1) {
       if (feof(infp)) {
         print_error("Unexpected end of file\n");
       } else {
@@ -238,29 +585,277 @@ static int snzip_uncompress(FILE *infp, FILE *outfp, int skip_magic)
     }
     trace("read %ld bytes.\n", (long)(compressed_length));
 
-    /* check the uncompressed length */
-    err = snappy_uncompressed_length(wb.c, compressed_length, &uncompressed_length);
-    if (err != 0) {
-      print_error("Invalid data: GetUncompressedLength failed %d\n", err);
+    /* uncompress and write */
+    uncompressed_data = cv ? crc_verifier_buffer(cv) : wb.uc;
+    snappy_output = filter.type ? wb.uc : uncompressed_data;
+    if (!uncompress_constant_block(&constant, wb.c, compressed_length, snappy_output, &uncompressed_length)) {
+      if (snappy_uncompress(wb.c, compressed_length, snappy_output, &uncompressed_length)) {
+        print_error("Invalid data: RawUncompress failed\n");
+        goto cleanup;
+      }
+      remember_constant_block(&constant, wb.c, compressed_length, snappy_output, uncompressed_length);
+    }
+    if (filter.type) {
+      unshuffle_block(uncompressed_data, wb.uc, uncompressed_length, filter.elem_size,
+                      filter.type == FILTER_SHUFFLE_DELTA);
+    }
+    write_length = byte_range_clip(&br, uncompressed_length, &write_offset);
+    if (cv != NULL) {
+      if (crc_verifier_submit(cv, uncompressed_data, uncompressed_length, crc32c, write_offset, write_length) != 0) {
+        goto cleanup;
+      }
+    } else if (write_full(outfd, uncompressed_data + write_offset, write_length) != write_length) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
       goto cleanup;
     }
+    trace("write %ld bytes\n", (long)write_length);
+  }
+  constant_block_report(&constant);
+  err = 0;
+ cleanup:
+  if (cv != NULL && crc_verifier_finish(cv) != 0) {
     err = 1;
-    if (uncompressed_length > wb.uclen) {
-      print_error("Invalid data: too long uncompressed length\n");
+  }
+  work_buffer_free(&wb);
+  constant_block_free(&constant);
+  return err;
+}
+
+static int snzip_uncompress(FILE *infp, FILE *outfp, int skip_magic)
+{
+  return snzip_uncompress_range(infp, outfp, skip_magic, 0, UINT64_MAX);
+}
+
+/*
+ * Writer used by --tee and --convert. In version 2, blocks except the
+ * last must be 'block_size' bytes, which must be power of two. In
+ * version 1, blocks may be shorter.
+ */
+typedef struct {
+  snz_trailer_t trailer;
+  uint64_t *block_offsets;
+  size_t max_blocks;
+  size_t block_size;
+  int short_block;
+  int version;
+} snz_writer_t;
+
+static int snzip_write_header(FILE *outfp, size_t block_size, void **state)
+{
+  snz_header_t header;
+  snz_writer_t *w;
+  int nshift = 0;
+
+  while (nshift < SNZ_MAX_BLOCK_SIZE && (1ul << nshift) < block_size) {
+    nshift++;
+  }
+  if ((1ul << nshift) < block_size
+      || (snzip_output_version >= SNZ_INDEX_VERSION && (1ul << nshift) != block_size)) {
+    print_error("The block size must be power of two up to %lu\n", 1ul << SNZ_MAX_BLOCK_SIZE);
+    return -1;
+  }
+  w = calloc(1, sizeof(*w));
+  if (w == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  memcpy(header.magic, SNZ_MAGIC, SNZ_MAGIC_LEN);
+  header.version = snzip_output_version;
+  header.block_size = nshift;
+  if (fwrite(&header, sizeof(header), 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    free(w);
+    return -1;
+  }
+  w->trailer.offset = sizeof(header);
+  w->block_size = 1ul << nshift;
+  w->version = snzip_output_version;
+  *state = w;
+  return 0;
+}
+
+static int snzip_write_block(FILE *outfp, void *state, const snappy_block_t *blk)
+{
+  snz_writer_t *w = (snz_writer_t *)state;
+  char buf[4];
+  int len;
+
+  if ((w->version >= SNZ_INDEX_VERSION && w->short_block) || blk->uncompressed_len > w->block_size || !blk->compressed) {
+    print_error("Invalid block for snzip format\n");
+    return -1;
+  }
+  if (w->version == SNZ_FILE_VERSION) {
+    write_varint(outfp, blk->len);
+    if (fwrite(blk->data, blk->len, 1, outfp) != 1) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
+      return -1;
+    }
+    return 0;
+  }
+  if (w->trailer.num_blocks == w->max_blocks) {
+    size_t new_max_blocks = w->max_blocks ? w->max_blocks * 2 : 1024;
+    uint64_t *tmp = realloc(w->block_offsets, new_max_blocks * sizeof(uint64_t));
+    if (tmp == NULL) {
+      print_error("out of memory\n");
+      return -1;
+    }
+    w->block_offsets = tmp;
+    w->max_blocks = new_max_blocks;
+  }
+  w->block_offsets[w->trailer.num_blocks++] = w->trailer.offset;
+  w->short_block = (blk->uncompressed_len != w->block_size);
+
+  len = write_varint(outfp, blk->len);
+  len += write_varint(outfp, blk->uncompressed_len);
+  snz_put_le(buf, blk->crc32c, 4);
+  fwrite(buf, 4, 1, outfp);
+  if (fwrite(blk->data, blk->len, 1, outfp) != 1) {
+    print_error("Failed to write a file: %s\n", strerror(errno));
+    return -1;
+  }
+  w->trailer.offset += len + 4 + blk->len;
+  w->trailer.total_length += blk->uncompressed_len;
+  return 0;
+}
+
+static int snzip_write_trailer(FILE *outfp, void *state, int abort)
+{
+  snz_writer_t *w = (snz_writer_t *)state;
+  int err = 0;
+
+  if (!abort) {
+    putc('\0', outfp);
+    w->trailer.offset++;
+    if (w->version >= SNZ_INDEX_VERSION) {
+      err = write_footer(outfp, w->block_offsets, &w->trailer);
+    }
+  }
+  free(w->block_offsets);
+  free(w);
+  return err;
+}
+
+/* The header of version 1 has the maximum block length, which must be
+ * known before blocks are passed. Blocks are up to the default size. */
+static const block_writer_t snzip_block_writer = {
+  1ul << SNZ_DEFAULT_BLOCK_SIZE,
+  1ul << SNZ_DEFAULT_BLOCK_SIZE,
+  (size_t)-1,
+  FALSE,
+  FALSE,
+  FALSE,
+  snzip_write_header,
+  snzip_write_block,
+  snzip_write_trailer,
+};
+
+static const block_writer_t snzip_v2_block_writer = {
+  1ul << SNZ_DEFAULT_BLOCK_SIZE,
+  1ul << SNZ_MAX_BLOCK_SIZE,
+  (size_t)-1,
+  FALSE,
+  TRUE,
+  TRUE,
+  snzip_write_header,
+  snzip_write_block,
+  snzip_write_trailer,
+};
+
+/* select the version written by compressors and block writers */
+void snzip_format_set_version(int version)
+{
+  snzip_output_version = version;
+  snzip_format.block_writer = (version >= SNZ_INDEX_VERSION) ? &snzip_v2_block_writer : &snzip_block_writer;
+}
+
+/*
+ * Blocks are read until the end-of-blocks mark. The footer of version 2
+ * isn't read.
+ */
+static int snzip_read_blocks(FILE *infp, int skip_magic, block_handler_t handler, void *ctx)
+{
+  snz_header_t header;
+  work_buffer_t wb;
+  int err = 1;
+
+  wb.c = NULL;
+  wb.uc = NULL;
+  if (skip_magic) {
+    header.version = snzip_format_version;
+    header.block_size = snzip_format_block_size;
+  } else {
+    if (fread(&header, sizeof(header), 1, infp) != 1) {
+      print_error("Failed to read a file: %s\n", strerror(errno));
+      goto cleanup;
+    }
+    if (memcmp(header.magic, SNZ_MAGIC, SNZ_MAGIC_LEN) != 0) {
+      print_error("This is not a snz file.\n");
+      goto cleanup;
+    }
+    if (header.version < 1 || header.version > SNZ_FILTER_VERSION) {
+      print_error("Unknown snz version %d\n", header.version);
+      goto cleanup;
+    }
+  }
+  if (header.version == SNZ_FILTER_VERSION) {
+    /* Compressed blocks of filtered data can't be passed to other formats. */
+    print_error("snz files compressed with --shuffle can't be converted\n");
+    goto cleanup;
+  }
+  if (header.block_size > SNZ_MAX_BLOCK_SIZE) {
+    print_error("Invalid block size %d (max %d)\n", header.block_size, SNZ_MAX_BLOCK_SIZE);
+    goto cleanup;
+  }
+
+  work_buffer_init(&wb, (1 << header.block_size));
+  for (;;) {
+    snappy_block_t blk;
+    int len;
+
+    if (read_varint(infp, &blk.len, &len) != 0) {
       goto cleanup;
     }
+    if (blk.len == 0) {
+      /* read all blocks */
+      break;
+    }
+    if (blk.len > wb.clen) {
+      print_error("Invalid data: too long compressed length\n");
+      goto cleanup;
+    }
+    blk.has_crc = FALSE;
+    blk.crc32c = 0;
+    if (header.version >= 2) {
+      char buf[4];
 
-    /* uncompress and write */
-    if (snappy_uncompress(wb.c, compressed_length, wb.uc, &uncompressed_length)) {
-      print_error("Invalid data: RawUncompress failed\n");
+      if (read_varint(infp, &blk.uncompressed_len, &len) != 0) {
+        goto cleanup;
+      }
+      if (fread(buf, 4, 1, infp) != 1) {
+        print_error("Unexpected end of file\n");
+        goto cleanup;
+      }
+      blk.has_crc = TRUE;
+      blk.crc32c = snz_get_le(buf, 4);
+    }
+    if (read_compressed_data(infp, &wb, blk.len) != 0) {
       goto cleanup;
     }
-    if (write_full(outfd, wb.uc, uncompressed_length) != uncompressed_length) {
-      print_error("Failed to write a file: %s\n", strerror(errno));
+    blk.data = wb.c;
+    blk.compressed = TRUE;
+    if (header.version < 2 && snappy_uncompressed_length(blk.data, blk.len, &blk.uncompressed_len) != SNAPPY_OK) {
+      print_error("Invalid data: GetUncompressedLength failed\n");
+      goto cleanup;
+    }
+    if (blk.uncompressed_len > wb.uclen) {
+      print_error("Invalid data: too long uncompressed length\n");
+      goto cleanup;
+    }
+    if (handler(ctx, &blk) != 0) {
       goto cleanup;
     }
-    trace("write %ld bytes\n", (long)uncompressed_length);
   }
+  err = 0;
  cleanup:
   work_buffer_free(&wb);
   return err;
@@ -272,4 +867,8 @@ stream_format_t snzip_format = {
   "snz",
   snzip_compress,
   snzip_uncompress,
+  snzip_uncompress_range,
+  NULL,
+  snzip_read_blocks,
+  &snzip_block_writer,
 };
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <sys/types.h>
@@ -58,11 +59,16 @@
 #define OPTIMIZE_SEQUENTIAL ""
 #endif
 #include "snzip.h"
+#include "crc32.h"
 #ifdef WIN32
 #define stat _stati64
 #define fstat _fstati64
+#define fseeko _fseeki64
+#define lseek _lseeki64
 #endif
-#ifndef HAVE_GETOPT
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#else
 #include "win32/ya_getopt.h"
 #endif
 
@@ -77,14 +83,94 @@
 #endif
 
 int64_t uncompressed_source_len = -1;
+int32_t snzip_format_version;
 int32_t snzip_format_block_size;
 uint32_t hadoop_snappy_source_length;
 uint32_t hadoop_snappy_compressed_length;
+uint32_t framing2_index_interval;
+uint32_t framing2_alignment;
+uint32_t framing2_align_interval = 1;
+uint32_t dedup_cache_blocks;
+FILE *hadoop_snappy_index_fp;
 
 static int trace_flag = FALSE;
 
+/* options without short names */
+enum {
+  OPT_SEEKABLE = 0x100,
+  OPT_OFFSET,
+  OPT_LENGTH,
+  OPT_INDEX,
+  OPT_BUILD_INDEX,
+  OPT_ALIGN,
+  OPT_ALIGN_CHUNKS,
+  OPT_CONCAT,
+  OPT_CONVERT,
+  OPT_TEE,
+  OPT_SPLIT_SIZE,
+  OPT_ARCHIVE,
+  OPT_LIST,
+  OPT_DEDUP,
+  OPT_RSYNCABLE,
+  OPT_ALIGN_RECORDS,
+  OPT_ADAPTIVE_BLOCKS,
+  OPT_SHUFFLE,
+  OPT_DELTA,
+  OPT_AUTOTUNE,
+  OPT_SNZ_VERSION,
+  OPT_ALWAYS_COMPRESS,
+};
+
+static const struct option long_options[] = {
+  {"seekable", optional_argument, NULL, OPT_SEEKABLE},
+  {"offset", required_argument, NULL, OPT_OFFSET},
+  {"length", required_argument, NULL, OPT_LENGTH},
+  {"index", no_argument, NULL, OPT_INDEX},
+  {"build-index", no_argument, NULL, OPT_BUILD_INDEX},
+  {"align", optional_argument, NULL, OPT_ALIGN},
+  {"align-chunks", required_argument, NULL, OPT_ALIGN_CHUNKS},
+  {"concat", no_argument, NULL, OPT_CONCAT},
+  {"convert", optional_argument, NULL, OPT_CONVERT},
+  {"tee", required_argument, NULL, OPT_TEE},
+  {"split-size", required_argument, NULL, OPT_SPLIT_SIZE},
+  {"archive", no_argument, NULL, OPT_ARCHIVE},
+  {"list", no_argument, NULL, OPT_LIST},
+  {"dedup", optional_argument, NULL, OPT_DEDUP},
+  {"rsyncable", no_argument, NULL, OPT_RSYNCABLE},
+  {"align-records", optional_argument, NULL, OPT_ALIGN_RECORDS},
+  {"adaptive-blocks", no_argument, NULL, OPT_ADAPTIVE_BLOCKS},
+  {"shuffle", required_argument, NULL, OPT_SHUFFLE},
+  {"delta", no_argument, NULL, OPT_DELTA},
+  {"autotune", optional_argument, NULL, OPT_AUTOTUNE},
+  {"snz-version", required_argument, NULL, OPT_SNZ_VERSION},
+  {"always-compress", no_argument, NULL, OPT_ALWAYS_COMPRESS},
+  {NULL, 0, NULL, 0},
+};
+
+#define DEFAULT_INDEX_INTERVAL 16 /* chunks per index entry */
+#define DEFAULT_ALIGNMENT 4096 /* page size */
+#define MAX_ALIGNMENT (1 << 20)
+#define DEFAULT_DEDUP_BLOCKS 256
+#define MAX_DELIMITER_LEN 16
+#define COPY_BUFFER_SIZE (1024 * 1024) /* used when copy_file_range isn't available */
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static int opt_range = FALSE;
+static uint64_t range_offset = 0;
+static uint64_t range_length = UINT64_MAX;
+
 static void copy_file_attributes(int infd, int outfd, const char *outfile);
 static void show_usage(const char *progname, int exit_code);
+static int uncompress_stream(stream_format_t *fmt, FILE *infp, FILE *outfp, int skip_magic);
+static int parse_size(const char *str, const char *name, uint64_t *size);
+static int parse_delimiter(const char *str, char *buf, size_t *len);
+static FILE *open_index_file(const char *file, char *idxfile, size_t size);
+static int build_index(const char *infile);
+static int concat_files(stream_format_t *fmt, const char *outfile, int num_files, char **files);
+static int tee_files(const char *spec, const char *infile, size_t block_size);
 
 static stream_format_t *stream_formats[] = {
   &framing2_format,
@@ -128,7 +214,7 @@ static stream_format_t *find_stream_format_by_file_header(FILE *fp)
   /*  framing        {0xff, 0x06, 0x00, 's',  'N',  'a',  'P',  'p',  'Y'}
    *  framing2       {0xff, 0x06, 0x00, 0x00, 's',  'N',  'a',  'P',  'p',  'Y'}
    *  hadoop-snappy  {--uncompressed length--,--compressed length--,
-   *  snzip          {'S',  'N',  'Z',  0x01, block_size}
+   *  snzip          {'S',  'N',  'Z',  0x01 or 0x02, block_size}
    *  snappy-java    {0x82, 'S',  'N',  'A',  'P',  'P',  'Y',  0x00}
    *  snappy-in-java {'s',  'n',  'a',  'p',  'p',  'y',  0x00}
    */
@@ -162,7 +248,11 @@ static stream_format_t *find_stream_format_by_file_header(FILE *fp)
     }
     break;
   case 'S':
-    CHK('N'); CHK('Z'); CHK(0x01);
+    CHK('N'); CHK('Z');
+    snzip_format_version = GETCHAR();
+    if (snzip_format_version < 0x01 || snzip_format_version > 0x03) {
+      goto error;
+    }
     snzip_format_block_size = GETCHAR();
     if (snzip_format_block_size <= 0) {
       goto error;
@@ -224,6 +314,18 @@ int main(int argc, char **argv)
   int opt_uncompress = FALSE;
   int opt_keep = FALSE;
   int opt_stdout = FALSE;
+  int opt_index = FALSE;
+  int opt_build_index = FALSE;
+  int opt_concat = FALSE;
+  int opt_convert = FALSE;
+  int opt_archive = FALSE;
+  int opt_list = FALSE;
+  const char *source_format_name = NULL;
+  const char *tee_spec = NULL;
+  uint64_t split_size = 0;
+  int snz_version = 0;
+  char delimiter[MAX_DELIMITER_LEN];
+  stream_format_t *source_fmt = NULL;
   int block_size = 0;
   size_t rsize = 0;
   size_t wsize = 0;
@@ -249,7 +351,7 @@ int main(int argc, char **argv)
     opt_keep = TRUE;
   }
 
-  while ((opt = getopt(argc, argv, "cdkt:hs:b:B:R:W:T")) != -1) {
+  while ((opt = getopt_long(argc, argv, "cdkt:hs:b:B:R:W:T", long_options, NULL)) != -1) {
     char *endptr;
 
     switch (opt) {
@@ -291,6 +393,129 @@ int main(int argc, char **argv)
     case 'T':
       trace_flag = TRUE;
       break;
+    case OPT_SEEKABLE:
+      framing2_index_interval = DEFAULT_INDEX_INTERVAL;
+      if (optarg != NULL) {
+        framing2_index_interval = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || framing2_index_interval == 0) {
+          fprintf(stderr, "Invalid --seekable format: %s\n", optarg);
+          return 1;
+        }
+      }
+      break;
+    case OPT_ALIGN:
+      framing2_alignment = DEFAULT_ALIGNMENT;
+      if (optarg != NULL) {
+        framing2_alignment = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || framing2_alignment < 16 || framing2_alignment > MAX_ALIGNMENT
+            || (framing2_alignment & (framing2_alignment - 1)) != 0) {
+          fprintf(stderr, "Invalid --align format: %s (power of two between 16 and %d)\n", optarg, MAX_ALIGNMENT);
+          return 1;
+        }
+      }
+      break;
+    case OPT_ALIGN_CHUNKS:
+      framing2_align_interval = strtoul(optarg, &endptr, 10);
+      if (*endptr != '\0' || framing2_align_interval == 0) {
+        fprintf(stderr, "Invalid --align-chunks format: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_OFFSET:
+      if (parse_size(optarg, "--offset", &range_offset) != 0) {
+        return 1;
+      }
+      opt_range = TRUE;
+      break;
+    case OPT_LENGTH:
+      if (parse_size(optarg, "--length", &range_length) != 0) {
+        return 1;
+      }
+      opt_range = TRUE;
+      break;
+    case OPT_INDEX:
+      opt_index = TRUE;
+      break;
+    case OPT_BUILD_INDEX:
+      opt_build_index = TRUE;
+      break;
+    case OPT_CONCAT:
+      opt_concat = TRUE;
+      break;
+    case OPT_CONVERT:
+      opt_convert = TRUE;
+      source_format_name = optarg;
+      break;
+    case OPT_TEE:
+      tee_spec = optarg;
+      break;
+    case OPT_ARCHIVE:
+      opt_archive = TRUE;
+      break;
+    case OPT_LIST:
+      opt_list = TRUE;
+      break;
+    case OPT_SPLIT_SIZE:
+      if (parse_size(optarg, "split size", &split_size) != 0) {
+        return 1;
+      }
+      if (split_size == 0) {
+        fprintf(stderr, "Invalid split size: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_DEDUP:
+      dedup_cache_blocks = DEFAULT_DEDUP_BLOCKS;
+      if (optarg != NULL) {
+        dedup_cache_blocks = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || dedup_cache_blocks == 0) {
+          fprintf(stderr, "Invalid --dedup format: %s\n", optarg);
+          return 1;
+        }
+      }
+      break;
+    case OPT_RSYNCABLE:
+      rsyncable = TRUE;
+      break;
+    case OPT_ALIGN_RECORDS:
+      if (parse_delimiter(optarg != NULL ? optarg : "\\n", delimiter, &record_delimiter_len) != 0) {
+        return 1;
+      }
+      record_delimiter = delimiter;
+      break;
+    case OPT_ADAPTIVE_BLOCKS:
+      adaptive_blocks = TRUE;
+      break;
+    case OPT_SHUFFLE:
+      shuffle_elem_size = strtol(optarg, &endptr, 10);
+      if (*endptr != '\0' || shuffle_elem_size < 1 || shuffle_elem_size > 255) {
+        fprintf(stderr, "Invalid --shuffle format: %s (1 to 255)\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_DELTA:
+      shuffle_delta = TRUE;
+      break;
+    case OPT_AUTOTUNE:
+      autotune_mode = AUTOTUNE_ENV;
+      if (optarg != NULL) {
+        if (strcmp(optarg, "calibrate") != 0) {
+          fprintf(stderr, "Invalid --autotune format: %s\n", optarg);
+          return 1;
+        }
+        autotune_mode = AUTOTUNE_CALIBRATE;
+      }
+      break;
+    case OPT_SNZ_VERSION:
+      snz_version = strtol(optarg, &endptr, 10);
+      if (*endptr != '\0' || snz_version < 1 || snz_version > 2) {
+        fprintf(stderr, "Invalid --snz-version format: %s (1 or 2)\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_ALWAYS_COMPRESS:
+      detect_incompressible = FALSE;
+      break;
     case '?':
       show_usage(progname, 1);
       break;
@@ -302,6 +527,10 @@ int main(int argc, char **argv)
   _setmode(1, _O_BINARY);
 #endif
 
+  /* no-op when it has already run as a constructor */
+  crc32c_init();
+  trace("crc32c kernel: %s\n", crc32c_kernel_name());
+
   if (format_name != NULL) {
     fmt = find_stream_format_by_name(format_name);
     if (fmt == NULL) {
@@ -309,10 +538,184 @@ int main(int argc, char **argv)
       return 1;
     }
   }
+  if (snz_version != 0 && opt_uncompress) {
+    fprintf(stderr, "--snz-version is available only when compressing\n");
+    return 1;
+  }
+  if (snz_version == 1 && shuffle_elem_size != 0) {
+    fprintf(stderr, "--shuffle requires snz version 2 or later\n");
+    return 1;
+  }
+  /* Version 1 is readable by all releases. Version 2 is written only on request. */
+  snzip_format_set_version((snz_version == 2 || shuffle_elem_size != 0) ? 2 : 1);
+  if (opt_convert) {
+    if (opt_uncompress || opt_concat || opt_build_index) {
+      fprintf(stderr, "--convert can't be used with -d, --concat or --build-index\n");
+      return 1;
+    }
+    if (source_format_name != NULL) {
+      source_fmt = find_stream_format_by_name(source_format_name);
+      if (source_fmt == NULL) {
+        fprintf(stderr, "Unknown file format name %s\n", source_format_name);
+        return 1;
+      }
+    }
+    if (fmt->block_writer == NULL || fmt->block_writer->fixed_size) {
+      fprintf(stderr, "--convert isn't supported to %s format\n", fmt->name);
+      return 1;
+    }
+  }
+  if (opt_range) {
+    if (!opt_uncompress) {
+      fprintf(stderr, "--offset and --length are available only with -d\n");
+      return 1;
+    }
+    /* Never remove input files after extracting a part of them. */
+    opt_keep = TRUE;
+  }
+  if (framing2_index_interval != 0 && (opt_uncompress || opt_convert || fmt != &framing2_format)) {
+    fprintf(stderr, "--seekable is available only when compressing as framing2 format\n");
+    return 1;
+  }
+  if (framing2_alignment != 0 && (opt_uncompress || opt_convert || fmt != &framing2_format)) {
+    fprintf(stderr, "--align is available only when compressing as framing2 format\n");
+    return 1;
+  }
+  if (dedup_cache_blocks != 0 && (opt_uncompress || opt_convert || opt_concat || tee_spec != NULL
+                                  || opt_archive || split_size != 0
+                                  || (fmt != &framing2_format && fmt != &framing_format && fmt != &snzip_format))) {
+    fprintf(stderr, "--dedup is available only when compressing as framing2, framing or snzip format\n"
+            "without --tee, --archive or --split-size\n");
+    return 1;
+  }
+  if (adaptive_blocks && (rsyncable || record_delimiter != NULL || opt_uncompress || opt_convert
+                          || tee_spec != NULL || opt_archive || split_size != 0
+                          || (fmt != &snappy_java_format && fmt != &hadoop_snappy_format
+                              && (fmt != &snzip_format || snzip_output_version != 1)))) {
+    fprintf(stderr, "--adaptive-blocks is available only when compressing as snappy-java, hadoop-snappy\n"
+            "or snzip version 1 format without --rsyncable, --align-records or --split-size\n");
+    return 1;
+  }
+  if (shuffle_delta && shuffle_elem_size == 0) {
+    fprintf(stderr, "--delta requires --shuffle\n");
+    return 1;
+  }
+  if (shuffle_elem_size != 0 && (opt_uncompress || opt_convert || opt_concat || tee_spec != NULL
+                                 || opt_archive || split_size != 0 || fmt != &snzip_format)) {
+    fprintf(stderr, "--shuffle is available only when compressing as snzip format\n");
+    return 1;
+  }
+  if (autotune_mode && (opt_concat || opt_build_index || tee_spec != NULL || opt_archive || split_size != 0)) {
+    fprintf(stderr, "--autotune can't be used with --concat, --build-index, --tee, --archive or --split-size\n");
+    return 1;
+  }
+  if (rsyncable && record_delimiter != NULL) {
+    fprintf(stderr, "--rsyncable and --align-records can't be used together\n");
+    return 1;
+  }
+  if ((rsyncable || record_delimiter != NULL)
+      && (opt_uncompress || opt_convert || tee_spec != NULL || opt_archive
+          || fmt->block_writer == NULL || fmt->block_writer->fixed_size)) {
+    fprintf(stderr, "%s is available only when compressing as framing2, framing, hadoop-snappy,\n"
+            "iwa, snappy-java, snappy-in-java or snzip version 1 format\n", rsyncable ? "--rsyncable" : "--align-records");
+    return 1;
+  }
+  if (opt_index && (opt_uncompress || opt_convert || opt_stdout || fmt != &hadoop_snappy_format)) {
+    fprintf(stderr, "--index is available only when compressing files as hadoop-snappy format\n");
+    return 1;
+  }
+
+  if (opt_concat) {
+    if (opt_uncompress || opt_stdout || opt_range || argc - optind < 2) {
+      fprintf(stderr, "Usage: %s --concat [-t name] outfile file ...\n", progname);
+      return 1;
+    }
+    return concat_files(format_name != NULL ? fmt : NULL, argv[optind], argc - optind - 1, argv + optind + 1);
+  }
+
+  if (split_size != 0) {
+    if (opt_uncompress || opt_convert || opt_stdout || opt_index || framing2_index_interval != 0 || framing2_alignment != 0) {
+      fprintf(stderr, "--split-size can't be used with -c, -d, --convert, --index, --seekable or --align\n");
+      return 1;
+    }
+    if (fmt->block_writer == NULL) {
+      fprintf(stderr, "--split-size isn't supported for %s format\n", fmt->name);
+      return 1;
+    }
+    if (optind == argc) {
+      fprintf(stderr, "--split-size is available only when compressing files\n");
+      return 1;
+    }
+  }
+  if (tee_spec != NULL) {
+    if (opt_uncompress || opt_concat || opt_convert || opt_build_index || opt_range || argc - optind > 1) {
+      fprintf(stderr, "Usage: %s --tee name:outfile[,name:outfile ...] [file]\n", progname);
+      return 1;
+    }
+    return tee_files(tee_spec, argc > optind ? argv[optind] : NULL, block_size);
+  }
+
+  if (opt_archive || opt_list) {
+    if (opt_concat || opt_convert || opt_build_index || opt_range || tee_spec != NULL || split_size != 0) {
+      fprintf(stderr, "--archive can't be used with --concat, --convert, --build-index, --offset, --length, --tee or --split-size\n");
+      return 1;
+    }
+    if (opt_list) {
+      if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s --list archive\n", progname);
+        return 1;
+      }
+      return archive_list(argv[optind]);
+    }
+    if (opt_uncompress) {
+      if (argc - optind < 1) {
+        fprintf(stderr, "Usage: %s -d [-c] --archive archive [member ...]\n", progname);
+        return 1;
+      }
+      return archive_extract(argv[optind], argc - optind - 1, argv + optind + 1, opt_stdout);
+    }
+    if (opt_stdout || argc - optind < 2) {
+      fprintf(stderr, "Usage: %s --archive archive file ...\n", progname);
+      return 1;
+    }
+    return archive_create(argv[optind], argc - optind - 1, argv + optind + 1);
+  }
+
+  if (opt_build_index) {
+    int err = 0;
+    if (optind == argc) {
+      return hadoop_snappy_build_index(stdin, stdout);
+    }
+    while (optind < argc) {
+      if (build_index(argv[optind++]) != 0) {
+        err = 1;
+      }
+    }
+    return err;
+  }
 
   if (optind == argc) {
     trace("no arguments are set.\n");
 
+    if (autotune_mode) {
+      if (rsize == 0) {
+        rsize = autotune_buffer_size(0, "stdin");
+      }
+      if (wsize == 0) {
+        wsize = autotune_buffer_size(1, "stdout");
+      }
+      if (!opt_uncompress && !opt_convert && block_size == 0 && !adaptive_blocks) {
+        block_size = autotune_block_size(fmt, 0);
+      }
+      autotune_print("stdin", block_size, rsize, wsize);
+      if (rsize != 0) {
+        setvbuf(stdin, NULL, _IOFBF, rsize);
+      }
+      if (wsize != 0) {
+        setvbuf(stdout, NULL, _IOFBF, wsize);
+      }
+    }
+
     if (opt_uncompress) {
       int skip_magic = 0;
       if (format_name == NULL) {
@@ -322,8 +725,22 @@ int main(int argc, char **argv)
         }
         skip_magic = 1;
       }
-      return fmt->uncompress(stdin, stdout, skip_magic);
+      return uncompress_stream(fmt, stdin, stdout, skip_magic);
+    } else if (opt_convert) {
+      int skip_magic = 0;
+      if (source_fmt == NULL) {
+        source_fmt = find_stream_format_by_file_header(stdin);
+        if (source_fmt == NULL) {
+          return 1;
+        }
+        skip_magic = 1;
+      }
+      return convert_stream(source_fmt, fmt, stdin, stdout, skip_magic);
     } else {
+      if (opt_index) {
+        fprintf(stderr, "--index is available only when compressing files\n");
+        return 1;
+      }
       if (isatty(1)) {
         /* stdout is a terminal */
         fprintf(stderr, "I won't write compressed data to a terminal.\n");
@@ -341,10 +758,14 @@ int main(int argc, char **argv)
     FILE *infp;
     FILE *outfp;
     int skip_magic = 0;
+    stream_format_t *from = source_fmt;
+    int file_block_size = block_size;
+    size_t file_rsize = rsize;
+    size_t file_wsize = wsize;
 
     /* check input file and open it. */
     const char *suffix = strrchr(infile, '.');
-    if (suffix != NULL) {
+    if (suffix != NULL && !opt_convert) {
       stream_format_t *fmt_tmp = find_stream_format_by_suffix(suffix + 1);
       if (fmt_tmp == NULL && opt_uncompress) {
         print_error("%s has unknown suffix.\n", infile);
@@ -361,14 +782,31 @@ int main(int argc, char **argv)
       print_error("Failed to open %s for read\n", infile);
       exit(1);
     }
-    if (rsize != 0) {
-      trace("setvbuf(infp, NULL, _IOFBF, %ld)\n", (long)rsize);
-      setvbuf(infp, NULL, _IOFBF, rsize);
+    if (file_rsize == 0 && autotune_mode) {
+      file_rsize = autotune_buffer_size(fileno(infp), infile);
+    }
+    if (file_rsize != 0) {
+      trace("setvbuf(infp, NULL, _IOFBF, %ld)\n", (long)file_rsize);
+      setvbuf(infp, NULL, _IOFBF, file_rsize);
     }
 #ifdef HAVE_POSIX_FADVISE
     posix_fadvise(fileno(infp), 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
+    if (split_size != 0) {
+      trace("split %s\n", infile);
+      if (split_stream(fmt, infp, infile, split_size, block_size) != 0) {
+        return 1;
+      }
+      fclose(infp);
+      if (!opt_keep) {
+        int rv = unlink(infile);
+        trace("unlink(\"%s\") => %d (errno = %d)\n",
+              infile, rv, rv ? errno : 0);
+      }
+      continue;
+    }
+
     /* determine the file format */
     if (opt_uncompress) {
       if (format_name == NULL) {
@@ -378,6 +816,12 @@ int main(int argc, char **argv)
       if (fmt == NULL) {
         exit(1);
       }
+    } else if (opt_convert && from == NULL) {
+      from = find_stream_format_by_file_header(infp);
+      skip_magic = 1;
+      if (from == NULL) {
+        exit(1);
+      }
     }
 
     /* check output file and open it. */
@@ -403,6 +847,19 @@ int main(int argc, char **argv)
                   progname, infile, infile);
           snprintf(outfile, sizeof(outfile), "%s.out", infile);
         }
+      } else if (opt_convert) {
+        /* replace the suffix */
+        const char *suffix = strrchr(infile, '.');
+        size_t baselen = (suffix != NULL && strcmp(suffix + 1, from->suffix) == 0) ? suffix - infile : infilelen;
+        if (baselen + suffixlen + 2 >= sizeof(outfile)) {
+          print_error("%s has too long file name.\n", infile);
+          exit(1);
+        }
+        sprintf(outfile, "%.*s.%s", (int)baselen, infile, fmt->suffix);
+        if (strcmp(outfile, infile) == 0) {
+          print_error("%s has the suffix of %s format. Use -c.\n", infile, fmt->name);
+          exit(1);
+        }
       } else {
         if (infilelen + suffixlen + 2 >= sizeof(outfile)) {
           print_error("%s has too long file name.\n", infile);
@@ -416,22 +873,60 @@ int main(int argc, char **argv)
         exit(1);
       }
     }
-    if (wsize != 0) {
-      trace("setvbuf(outfp, NULL, _IOFBF, %ld)\n", (long)wsize);
-      setvbuf(outfp, NULL, _IOFBF, wsize);
+    if (file_wsize == 0 && autotune_mode) {
+      file_wsize = autotune_buffer_size(fileno(outfp), outfile);
+    }
+    if (file_wsize != 0) {
+      trace("setvbuf(outfp, NULL, _IOFBF, %ld)\n", (long)file_wsize);
+      setvbuf(outfp, NULL, _IOFBF, file_wsize);
+    }
+    if (autotune_mode) {
+      if (!opt_uncompress && !opt_convert && file_block_size == 0 && !adaptive_blocks) {
+        file_block_size = autotune_block_size(fmt, fileno(infp));
+      }
+      autotune_print(infile, file_block_size, file_rsize, file_wsize);
     }
 
     if (opt_uncompress) {
       trace("uncompress %s\n", infile);
-      if (fmt->uncompress(infp, outfp, skip_magic) != 0) {
+      if (uncompress_stream(fmt, infp, outfp, skip_magic) != 0) {
+        if (outfp != stdout) {
+          unlink(outfile);
+        }
+        return 1;
+      }
+    } else if (opt_convert) {
+      trace("convert %s\n", infile);
+      if (convert_stream(from, fmt, infp, outfp, skip_magic) != 0) {
         if (outfp != stdout) {
           unlink(outfile);
         }
         return 1;
       }
     } else {
+      char idxfile[PATH_MAX];
+      int rv;
+
+      if (opt_index) {
+        hadoop_snappy_index_fp = open_index_file(outfile, idxfile, sizeof(idxfile));
+        if (hadoop_snappy_index_fp == NULL) {
+          unlink(outfile);
+          return 1;
+        }
+      }
       trace("compress %s\n", infile);
-      if (fmt->compress(infp, outfp, block_size) != 0) {
+      rv = fmt->compress(infp, outfp, file_block_size);
+      if (hadoop_snappy_index_fp != NULL) {
+        if (fclose(hadoop_snappy_index_fp) != 0 && rv == 0) {
+          print_error("Failed to write %s: %s\n", idxfile, strerror(errno));
+          rv = 1;
+        }
+        hadoop_snappy_index_fp = NULL;
+        if (rv != 0) {
+          unlink(idxfile);
+        }
+      }
+      if (rv != 0) {
         if (outfp != stdout) {
           unlink(outfile);
         }
@@ -458,6 +953,303 @@ int main(int argc, char **argv)
   return 0;
 }
 
+static int uncompress_stream(stream_format_t *fmt, FILE *infp, FILE *outfp, int skip_magic)
+{
+  if (!opt_range) {
+    return fmt->uncompress(infp, outfp, skip_magic);
+  }
+  if (fmt->uncompress_range == NULL) {
+    print_error("--offset and --length aren't supported by %s format\n", fmt->name);
+    return 1;
+  }
+  trace("uncompress %llu bytes from %llu\n", (unsigned long long)range_length, (unsigned long long)range_offset);
+  return fmt->uncompress_range(infp, outfp, skip_magic, range_offset, range_length);
+}
+
+static FILE *open_index_file(const char *file, char *idxfile, size_t size)
+{
+  FILE *fp;
+
+  if (snprintf(idxfile, size, "%s.idx", file) >= (int)size) {
+    print_error("Too long file name: %s\n", file);
+    return NULL;
+  }
+  fp = fopen(idxfile, "w");
+  if (fp == NULL) {
+    print_error("Failed to open %s for write: %s\n", idxfile, strerror(errno));
+  }
+  return fp;
+}
+
+static int build_index(const char *infile)
+{
+  char idxfile[PATH_MAX];
+  FILE *infp;
+  FILE *idxfp;
+  int rv;
+
+  infp = fopen(infile, "rb" OPTIMIZE_SEQUENTIAL);
+  if (infp == NULL) {
+    print_error("Failed to open %s for read: %s\n", infile, strerror(errno));
+    return 1;
+  }
+  idxfp = open_index_file(infile, idxfile, sizeof(idxfile));
+  if (idxfp == NULL) {
+    fclose(infp);
+    return 1;
+  }
+  trace("build index of %s\n", infile);
+  rv = hadoop_snappy_build_index(infp, idxfp);
+  fclose(infp);
+  if (fclose(idxfp) != 0 && rv == 0) {
+    print_error("Failed to write %s: %s\n", idxfile, strerror(errno));
+    rv = 1;
+  }
+  if (rv != 0) {
+    unlink(idxfile);
+  }
+  return rv;
+}
+
+/*
+ * Concatenate compressed files without recompression.
+ * The format is guessed by the first file unless it is specified.
+ */
+static int concat_files(stream_format_t *fmt, const char *outfile, int num_files, char **files)
+{
+  struct stat sbuf;
+  struct stat outbuf;
+  int outfd = -1;
+  int infd = -1;
+  int i;
+  int err = 1;
+
+  if (fmt == NULL) {
+    FILE *fp = fopen(files[0], "rb");
+    if (fp == NULL) {
+      print_error("Failed to open %s for read: %s\n", files[0], strerror(errno));
+      return 1;
+    }
+    fmt = find_stream_format_by_file_header(fp);
+    fclose(fp);
+    if (fmt == NULL) {
+      return 1;
+    }
+  }
+  if (fmt->concat == NULL) {
+    print_error("--concat isn't supported by %s format\n", fmt->name);
+    return 1;
+  }
+  if (stat(outfile, &outbuf) != 0) {
+    outbuf.st_ino = 0;
+  }
+  for (i = 0; i < num_files; i++) {
+    if (stat(files[i], &sbuf) != 0) {
+      print_error("Failed to stat %s: %s\n", files[i], strerror(errno));
+      return 1;
+    }
+    if ((sbuf.st_mode & S_IFMT) != S_IFREG) {
+      print_error("%s is not a regular file\n", files[i]);
+      return 1;
+    }
+    if (outbuf.st_ino != 0 && sbuf.st_dev == outbuf.st_dev && sbuf.st_ino == outbuf.st_ino) {
+      print_error("%s is also an input file\n", outfile);
+      return 1;
+    }
+  }
+
+  outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+  if (outfd == -1) {
+    print_error("Failed to open %s for write: %s\n", outfile, strerror(errno));
+    return 1;
+  }
+  for (i = 0; i < num_files; i++) {
+    infd = open(files[i], O_RDONLY | O_BINARY);
+    if (infd == -1 || fstat(infd, &sbuf) != 0) {
+      print_error("Failed to open %s for read: %s\n", files[i], strerror(errno));
+      goto cleanup;
+    }
+    trace("concat %s (%llu bytes)\n", files[i], (unsigned long long)sbuf.st_size);
+    if (fmt->concat(infd, outfd, sbuf.st_size, i == 0) != 0) {
+      print_error("Failed to concatenate %s as %s format\n", files[i], fmt->name);
+      goto cleanup;
+    }
+    close(infd);
+    infd = -1;
+  }
+  if (close(outfd) != 0) {
+    outfd = -1;
+    print_error("Failed to write %s: %s\n", outfile, strerror(errno));
+    goto cleanup;
+  }
+  outfd = -1;
+  err = 0;
+ cleanup:
+  if (infd != -1) {
+    close(infd);
+  }
+  if (outfd != -1) {
+    close(outfd);
+  }
+  if (err) {
+    unlink(outfile);
+  }
+  return err;
+}
+
+/*
+ * Compress a file once and write it in the formats listed in 'spec'.
+ * 'spec' is a comma separated list of 'name:outfile'.
+ */
+static int tee_files(const char *spec, const char *infile, size_t block_size)
+{
+  char *buf = strdup(spec);
+  char *filenames[NUM_OF_STREAM_FORMATS * 4];
+  tee_output_t outputs[NUM_OF_STREAM_FORMATS * 4];
+  int num_outputs = 0;
+  FILE *infp = NULL;
+  char *item;
+  char *next;
+  int i;
+  int err = 1;
+
+  if (buf == NULL) {
+    print_error("out of memory\n");
+    return 1;
+  }
+  for (item = buf; item != NULL; item = next) {
+    char *colon = strchr(item, ':');
+
+    next = strchr(item, ',');
+    if (next != NULL) {
+      *(next++) = '\0';
+    }
+    if (colon == NULL || colon[1] == '\0') {
+      print_error("Invalid --tee output '%s'. It must be 'name:outfile'.\n", item);
+      goto cleanup;
+    }
+    if (num_outputs == sizeof(outputs) / sizeof(outputs[0])) {
+      print_error("Too many --tee outputs\n");
+      goto cleanup;
+    }
+    *colon = '\0';
+    outputs[num_outputs].fmt = find_stream_format_by_name(item);
+    if (outputs[num_outputs].fmt == NULL) {
+      print_error("Unknown file format name %s\n", item);
+      goto cleanup;
+    }
+    if (outputs[num_outputs].fmt->block_writer == NULL) {
+      print_error("--tee isn't supported for %s format\n", item);
+      goto cleanup;
+    }
+    outputs[num_outputs].fp = NULL;
+    filenames[num_outputs] = colon + 1;
+    num_outputs++;
+  }
+
+  if (infile != NULL) {
+    infp = fopen(infile, "rb");
+    if (infp == NULL) {
+      print_error("Failed to open %s for read: %s\n", infile, strerror(errno));
+      goto cleanup;
+    }
+  } else {
+    infp = stdin;
+  }
+  for (i = 0; i < num_outputs; i++) {
+    outputs[i].fp = fopen(filenames[i], "wb");
+    if (outputs[i].fp == NULL) {
+      print_error("Failed to open %s for write: %s\n", filenames[i], strerror(errno));
+      goto cleanup;
+    }
+  }
+  if (tee_stream(infp, outputs, num_outputs, block_size) != 0) {
+    goto cleanup;
+  }
+  err = 0;
+ cleanup:
+  for (i = 0; i < num_outputs; i++) {
+    if (outputs[i].fp != NULL) {
+      if (fclose(outputs[i].fp) != 0 && !err) {
+        print_error("Failed to write %s: %s\n", filenames[i], strerror(errno));
+        err = 1;
+      }
+    }
+  }
+  if (err) {
+    for (i = 0; i < num_outputs; i++) {
+      if (outputs[i].fp != NULL) {
+        unlink(filenames[i]);
+      }
+    }
+  }
+  if (infp != NULL && infp != stdin) {
+    fclose(infp);
+  }
+  free(buf);
+  return err;
+}
+
+static int parse_size(const char *str, const char *name, uint64_t *size)
+{
+  char *endptr;
+
+  errno = 0;
+  *size = strtoull(str, &endptr, 10);
+  if (*str == '\0' || *str == '-' || *endptr != '\0' || errno != 0) {
+    fprintf(stderr, "Invalid %s format: %s\n", name, str);
+    return -1;
+  }
+  return 0;
+}
+
+static int hex_digit(int c)
+{
+  return isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10;
+}
+
+/* parse a delimiter with escape sequences \n, \r, \t, \0, \\ and \xHH */
+static int parse_delimiter(const char *str, char *buf, size_t *len)
+{
+  const char *s = str;
+  size_t n = 0;
+
+  while (*s != '\0') {
+    int c = (unsigned char)*s++;
+
+    if (c == '\\') {
+      switch (*s++) {
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case '0': c = '\0'; break;
+      case '\\': c = '\\'; break;
+      case 'x':
+        if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1])) {
+          goto error;
+        }
+        c = hex_digit(s[0]) * 16 + hex_digit(s[1]);
+        s += 2;
+        break;
+      default:
+        goto error;
+      }
+    }
+    if (n == MAX_DELIMITER_LEN) {
+      goto error;
+    }
+    buf[n++] = (char)c;
+  }
+  if (n == 0) {
+    goto error;
+  }
+  *len = n;
+  return 0;
+ error:
+  fprintf(stderr, "Invalid --align-records delimiter: %s\n", str);
+  return -1;
+}
+
 static void copy_file_attributes(int infd, int outfd, const char *outfile)
 {
 #ifdef WIN32
@@ -543,6 +1335,50 @@ static void show_usage(const char *progname, int exit_code)
           "   -t name  file format name. see below. The default format is %s.\n"
           "   -h       give this help\n"
           "\n"
+          "  random access options:\n"
+          "   --seekable[=num]  write a chunk index every 'num' chunks (default: %d)\n"
+          "                     when compressing as framing2 format.\n"
+          "   --offset num      uncompress data from 'num'-th byte\n"
+          "   --length num      uncompress 'num' bytes at most\n"
+          "   --align[=num]     start chunks at multiples of 'num' bytes (default: %d)\n"
+          "                     when compressing as framing2 format.\n"
+          "   --align-chunks=num  align every 'num'-th chunk only (default: 1)\n"
+          "\n"
+          "  hadoop-snappy options:\n"
+          "   --index           write block offsets to 'file.idx' when compressing\n"
+          "   --build-index     write block offsets of existing files to 'file.idx'\n"
+          "\n"
+          "  conversion:\n"
+          "   --convert[=name]  convert compressed files in 'name' format to the format\n"
+          "                     specified by -t without recompressing blocks when possible.\n"
+          "                     The source format is guessed by the file header by default.\n"
+          "\n"
+          "  splitting:\n"
+          "   --split-size num  write 'file.part0001.suffix', 'file.part0002.suffix', ...\n"
+          "                     starting a new part after 'num' compressed bytes,\n"
+          "                     and their uncompressed offsets to 'file.manifest'.\n"
+          "\n"
+          "  archives:\n"
+          "   --archive archive file ...\n"
+          "            pack files into one framing2 stream with a central directory.\n"
+          "            The files are kept.\n"
+          "   -d [-c] --archive archive [member ...]\n"
+          "            extract all or specified members in parallel.\n"
+          "   --list archive\n"
+          "            list members.\n"
+          "\n"
+          "  multiple outputs:\n"
+          "   --tee name:outfile[,name:outfile ...] [file]\n"
+          "            compress a file or standard input once and write it in\n"
+          "            several formats. Compressed blocks are shared by formats\n"
+          "            using the same block size.\n"
+          "\n"
+          "  concatenation:\n"
+          "   --concat outfile file ...\n"
+          "            concatenate compressed files without recompression.\n"
+          "            supported by framing, framing2, hadoop-snappy, iwa,\n"
+          "            snappy-java and snappy-in-java formats.\n"
+          "\n"
           "  raw_format option:\n"
           "   -s size  size of input data when compressing.\n"
           "            The default value is the file size if available.\n"
@@ -552,10 +1388,33 @@ static void show_usage(const char *progname, int exit_code)
           "   -B num   internal block size. 'num'-th power of two.\n"
           "   -R num   size of read buffer in bytes\n"
           "   -W num   size of write buffer in bytes\n"
+          "   --dedup[=num]  reuse compressed data of duplicated blocks among the last\n"
+          "            'num' blocks (default: %d) when compressing as framing2,\n"
+          "            framing or snzip format.\n"
+          "   --rsyncable  end blocks at boundaries determined by contents so that\n"
+          "            local changes don't change following compressed data.\n"
+          "   --align-records[=delim]  end blocks at the last record delimiter\n"
+          "            (default: \\n) so that every block starts at a record.\n"
+          "   --adaptive-blocks  change the block size by measured speed and ratio\n"
+          "            when compressing as snappy-java, hadoop-snappy or snzip format.\n"
+          "   --autotune[=calibrate]  choose -b, -R and -W by file types and CPU\n"
+          "            cache sizes, or by compressing the head of the input with\n"
+          "            'calibrate', and print them.\n"
+          "   --shuffle=size  group bytes of 'size'-byte elements by position before\n"
+          "            compressing as snzip format.\n"
+          "   --delta  store differences of shuffled bytes. used with --shuffle.\n"
+          "   --always-compress  compress every block by snappy. By default, blocks\n"
+          "            following incompressible blocks are stored without\n"
+          "            compression when compressing samples of them doesn't\n"
+          "            shrink them, in framing2, framing, comment-43 and\n"
+          "            snappy-in-java formats.\n"
+          "   --snz-version=num  write snzip format version 'num' (default: 1).\n"
+          "            Version 2 adds checksums and an index for --offset, and\n"
+          "            is written by --shuffle. Old releases read only version 1.\n"
           "   -T       trace for debug\n"
           "\n"
           "  supported formats:\n",
-          progname, DEFAULT_FORMAT.name);
+          progname, DEFAULT_FORMAT.name, DEFAULT_INDEX_INTERVAL, DEFAULT_ALIGNMENT, DEFAULT_DEDUP_BLOCKS);
 
   max_name_len = strlen("name");
   max_suffix_len = strlen("suffix");
@@ -622,6 +1481,26 @@ void work_buffer_resize(work_buffer_t *wb, size_t clen, size_t uclen)
   }
 }
 
+/*
+ * Read 'len' bytes of compressed data into 'wb->c'.
+ * The buffer is extended when it is too short.
+ */
+int read_compressed_data(FILE *fp, work_buffer_t *wb, size_t len)
+{
+  if (len > wb->clen) {
+    work_buffer_resize(wb, len, 0);
+  }
+  if (len > 0 && fread(wb->c, len, 1, fp) != 1) {
+    if (feof(fp)) {
+      print_error("Unexpected end of file\n");
+    } else {
+      print_error("Failed to read a file: %s\n", strerror(errno));
+    }
+    return -1;
+  }
+  return 0;
+}
+
 int write_full(int fd, const void *buf, size_t count)
 {
   const char *ptr = (const char *)buf;
@@ -639,3 +1518,248 @@ int write_full(int fd, const void *buf, size_t count)
   }
   return (ptr - (const char *)buf);
 }
+
+int pread_full(int fd, void *buf, size_t count, uint64_t offset)
+{
+  char *ptr = (char *)buf;
+
+#ifdef WIN32
+  if (_lseeki64(fd, offset, SEEK_SET) == -1) {
+    print_error("Failed to seek a file: %s\n", strerror(errno));
+    return -1;
+  }
+#endif
+  while (count > 0) {
+#ifdef WIN32
+    int rv = read(fd, ptr, count);
+#else
+    ssize_t rv = pread(fd, ptr, count, offset);
+#endif
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      print_error("Failed to read a file: %s\n", strerror(errno));
+      return -1;
+    }
+    if (rv == 0) {
+      print_error("Unexpected end of file\n");
+      return -1;
+    }
+    ptr += rv;
+    count -= rv;
+    offset += rv;
+  }
+  return 0;
+}
+
+/*
+ * Copy data from 'offset' to 'end' in 'infd' to the current position
+ * of 'outfd'. This uses copy_file_range() when possible so that data
+ * are copied in the kernel or by reflinks.
+ */
+int copy_data(int outfd, int infd, uint64_t offset, uint64_t end)
+{
+  char *buf;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while (offset < end) {
+    off_t off_in = offset;
+    size_t len = (end - offset < (1u << 30)) ? (size_t)(end - offset) : (1u << 30);
+    ssize_t rv = copy_file_range(infd, &off_in, outfd, NULL, len, 0);
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+        /* fall back to read and write */
+        trace("copy_file_range => %s\n", strerror(errno));
+        break;
+      }
+      print_error("Failed to copy a file: %s\n", strerror(errno));
+      return -1;
+    }
+    if (rv == 0) {
+      print_error("Unexpected end of file\n");
+      return -1;
+    }
+    offset += rv;
+  }
+  if (offset == end) {
+    return 0;
+  }
+#endif
+  buf = malloc(COPY_BUFFER_SIZE);
+  if (buf == NULL) {
+    print_error("out of memory\n");
+    return -1;
+  }
+  while (offset < end) {
+    size_t len = (end - offset < COPY_BUFFER_SIZE) ? (size_t)(end - offset) : COPY_BUFFER_SIZE;
+    if (pread_full(infd, buf, len, offset) != 0) {
+      goto error;
+    }
+    if (write_full(outfd, buf, len) == -1) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
+      goto error;
+    }
+    offset += len;
+  }
+  free(buf);
+  return 0;
+ error:
+  free(buf);
+  return -1;
+}
+
+/*
+ * Skip input data. This seeks the file when possible and fails when
+ * the data end before 'len' bytes.
+ */
+int skip_input(FILE *fp, uint64_t len)
+{
+  char buf[4096];
+  struct stat sbuf;
+
+  if (len == 0) {
+    return 0;
+  }
+  if (lseek(fileno(fp), 0, SEEK_CUR) != -1 && fseeko(fp, len, SEEK_CUR) == 0) {
+    trace("skip %llu bytes by seek\n", (unsigned long long)len);
+    /* seeking past the end succeeds. */
+    if (fstat(fileno(fp), &sbuf) == 0 && S_ISREG(sbuf.st_mode) && ftello(fp) > sbuf.st_size) {
+      print_error("Unexpected end of file\n");
+      return -1;
+    }
+    return 0;
+  }
+  while (len > 0) {
+    size_t n = (len < sizeof(buf)) ? (size_t)len : sizeof(buf);
+    if (fread(buf, n, 1, fp) != 1) {
+      if (feof(fp)) {
+        print_error("Unexpected end of file\n");
+      } else {
+        print_error("Failed to read a file: %s\n", strerror(errno));
+      }
+      return -1;
+    }
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Read the head of snappy compressed data to get the uncompressed length
+ * without reading the whole data. The number of read bytes, which is
+ * at most 5, is set to 'head_len'.
+ */
+int read_uncompressed_length(FILE *fp, char *buf, size_t compressed_len, size_t *head_len, size_t *uncompressed_len)
+{
+  size_t len = (compressed_len < 5) ? compressed_len : 5;
+  snappy_status status;
+
+  if (len > 0 && fread(buf, len, 1, fp) != 1) {
+    if (feof(fp)) {
+      print_error("Unexpected end of file\n");
+    } else {
+      print_error("Failed to read a file: %s\n", strerror(errno));
+    }
+    return -1;
+  }
+  status = snappy_uncompressed_length(buf, len, uncompressed_len);
+  if (status != SNAPPY_OK) {
+    print_error("Invalid data: GetUncompressedLength failed %d\n", status);
+    return -1;
+  }
+  *head_len = len;
+  return 0;
+}
+
+void byte_range_init(byte_range_t *br, uint64_t offset, uint64_t length)
+{
+  br->start = offset;
+  br->end = (length < UINT64_MAX - offset) ? offset + length : UINT64_MAX;
+  br->pos = 0;
+}
+
+/*
+ * Skip a block of 'len' bytes at the current position when the whole
+ * block is before the range.
+ */
+int byte_range_skip(byte_range_t *br, size_t len)
+{
+  if (br->pos + len <= br->start) {
+    br->pos += len;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * Get the part of a block of 'len' bytes at the current position
+ * overlapping the range. This returns the length of the part and sets
+ * the offset in the block to 'offset'.
+ */
+size_t byte_range_clip(byte_range_t *br, size_t len, size_t *offset)
+{
+  uint64_t from = (br->pos < br->start) ? br->start - br->pos : 0;
+  uint64_t to = len;
+
+  if (br->pos >= br->end) {
+    to = 0;
+  } else if (br->end - br->pos < len) {
+    to = br->end - br->pos;
+  }
+  br->pos += len;
+  if (to <= from) {
+    *offset = 0;
+    return 0;
+  }
+  *offset = from;
+  return to - from;
+}
+
+#define MAX_THREADS_ENV 256
+
+/* SNZIP_THREADS overrides the number to test threaded code anywhere. */
+int num_cpus(void)
+{
+  const char *env = getenv("SNZIP_THREADS");
+  char *endptr;
+  long n;
+#ifdef WIN32
+  SYSTEM_INFO si;
+#endif
+
+  if (env != NULL && *env != '\0') {
+    n = strtol(env, &endptr, 10);
+    if (*endptr == '\0' && n > 0) {
+      return n < MAX_THREADS_ENV ? (int)n : MAX_THREADS_ENV;
+    }
+    fprintf(stderr, "SNZIP_THREADS: invalid number '%s'\n", env);
+  }
+#ifdef WIN32
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors;
+#elif defined _SC_NPROCESSORS_ONLN
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#else
+  return 1;
+#endif
+}
+
+/* wall-clock time in seconds */
+double current_time(void)
+{
+#ifdef WIN32
+  LARGE_INTEGER freq, cnt;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  return (double)cnt.QuadPart / freq.QuadPart;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
@@ -120,6 +120,25 @@
 #define SNZ_FROM_BE32(x)  SNZ_BSWAP32(x)
 #endif
 
+/* little endian integers of any length up to 8 bytes */
+static inline void snz_put_le(char *buf, uint64_t val, int len)
+{
+  int i;
+  for (i = 0; i < len; i++) {
+    buf[i] = (char)(val >> (i * 8));
+  }
+}
+
+static inline uint64_t snz_get_le(const char *buf, int len)
+{
+  uint64_t val = 0;
+  int i;
+  for (i = len - 1; i >= 0; i--) {
+    val = (val << 8) | (unsigned char)buf[i];
+  }
+  return val;
+}
+
 /* logging functions */
 extern int trc_lineno;
 extern const char *trc_filename;
@@ -141,6 +160,52 @@ void work_buffer_free(work_buffer_t *wb);
 void work_buffer_resize(work_buffer_t *wb, size_t clen, size_t uclen);
 
 int write_full(int fd, const void *buf, size_t count);
+int pread_full(int fd, void *buf, size_t count, uint64_t offset);
+int copy_data(int outfd, int infd, uint64_t offset, uint64_t end);
+int skip_input(FILE *fp, uint64_t len);
+int read_uncompressed_length(FILE *fp, char *buf, size_t compressed_len, size_t *head_len, size_t *uncompressed_len);
+
+/* byte range of uncompressed data to be written */
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+  uint64_t pos; /* uncompressed offset of the next block */
+} byte_range_t;
+
+void byte_range_init(byte_range_t *br, uint64_t offset, uint64_t length);
+int byte_range_skip(byte_range_t *br, size_t len);
+size_t byte_range_clip(byte_range_t *br, size_t len, size_t *offset);
+#define byte_range_done(br) ((br)->pos >= (br)->end)
+int num_cpus(void);
+double current_time(void);
+
+/* a snappy block passed between formats by --convert */
+typedef struct {
+  const char *data; /* compressed data, or uncompressed data when 'compressed' is false */
+  size_t len;
+  size_t uncompressed_len;
+  int compressed;
+  int has_crc;
+  unsigned int crc32c; /* masked crc32c of uncompressed data when 'has_crc' is true */
+} snappy_block_t;
+
+typedef int (*block_handler_t)(void *ctx, const snappy_block_t *blk);
+
+typedef struct {
+  size_t block_size; /* default uncompressed length of a block */
+  size_t max_uncompressed_len; /* maximum uncompressed length of a block */
+  size_t max_len; /* maximum length of data in a block */
+  int store; /* TRUE when incompressible data may be stored uncompressed */
+  int need_crc; /* TRUE when blocks have checksums */
+  int fixed_size; /* TRUE when all blocks except the last must be 'block_size' bytes */
+  /* write the file header. 'state' is passed to write() and end(). */
+  int (*begin)(FILE *outfp, size_t block_size, void **state);
+  int (*write)(FILE *outfp, void *state, const snappy_block_t *blk);
+  /* write the trailer unless 'abort' is true and release 'state'. */
+  int (*end)(FILE *outfp, void *state, int abort);
+} block_writer_t;
+
+int read_compressed_data(FILE *fp, work_buffer_t *wb, size_t len);
 
 /* */
 typedef struct {
@@ -149,12 +214,29 @@ typedef struct {
   const char *suffix;
   int (*compress)(FILE *infp, FILE *outfp, size_t block_size);
   int (*uncompress)(FILE *infp, FILE *outfp, int skip_magic);
+  /* uncompress 'length' bytes from 'offset'. NULL when not supported. */
+  int (*uncompress_range)(FILE *infp, FILE *outfp, int skip_magic, uint64_t offset, uint64_t length);
+  /* append compressed data in 'infd' of 'size' bytes to 'outfd' without
+   * recompression. 'first' is false for the second and later files.
+   * NULL when not supported. */
+  int (*concat)(int infd, int outfd, uint64_t size, int first);
+  /* pass snappy blocks to 'handler' for --convert. NULL when not supported. */
+  int (*read_blocks)(FILE *infp, int skip_magic, block_handler_t handler, void *ctx);
+  /* write snappy blocks for --convert. NULL when not supported. */
+  const block_writer_t *block_writer;
 } stream_format_t;
 
 extern int64_t uncompressed_source_len;
+extern int32_t snzip_format_version;
 extern int32_t snzip_format_block_size;
 extern uint32_t hadoop_snappy_source_length;
 extern uint32_t hadoop_snappy_compressed_length;
+extern uint32_t framing2_index_interval;
+extern uint32_t framing2_alignment;
+extern uint32_t framing2_align_interval;
+extern uint32_t dedup_cache_blocks;
+extern FILE *hadoop_snappy_index_fp;
+extern int snzip_output_version; /* 1 or 2 */
 
 extern stream_format_t snzip_format;
 extern stream_format_t framing_format;
@@ -166,7 +248,176 @@ extern stream_format_t raw_format;
 extern stream_format_t hadoop_snappy_format;
 extern stream_format_t iwa_format;
 
+/* snzip-format.c */
+void snzip_format_set_version(int version);
+
 /* hadoop-snapp-format.c */
 size_t hadoop_snappy_max_input_size(size_t block_size);
+int hadoop_snappy_build_index(FILE *infp, FILE *idxfp);
+
+/* convert.c */
+int convert_stream(stream_format_t *from, stream_format_t *to, FILE *infp, FILE *outfp, int skip_magic);
+
+/* tee.c */
+typedef struct {
+  stream_format_t *fmt;
+  FILE *fp;
+} tee_output_t;
+
+size_t writer_block_size(const block_writer_t *w, size_t block_size);
+int tee_stream(FILE *infp, tee_output_t *outputs, int num_outputs, size_t block_size);
+
+/* split.c */
+int split_stream(stream_format_t *fmt, FILE *infp, const char *name, uint64_t split_size, size_t block_size);
+
+/* archive.c */
+int archive_create(const char *archive, int num_files, char **files);
+int archive_list(const char *archive);
+int archive_extract(const char *archive, int num_names, char **names, int to_stdout);
+
+/* incompressible.c */
+#define DETECTOR_SAMPLE_LEN 4096
+
+extern int detect_incompressible; /* FALSE with --always-compress */
+
+typedef struct {
+  int run; /* blocks stored uncompressed in a row */
+  uint64_t num_guessed; /* blocks whose samples are incompressible in runs */
+  uint64_t num_blocks;
+  uint64_t num_stored;
+  uint64_t num_verified;
+  char sample[DETECTOR_SAMPLE_LEN];
+  char compressed_sample[32 + DETECTOR_SAMPLE_LEN + DETECTOR_SAMPLE_LEN / 6]; /* snappy_max_compressed_length() */
+} incompressible_detector_t;
+
+void incompressible_detector_init(incompressible_detector_t *det);
+int is_incompressible(incompressible_detector_t *det, const char *data, size_t len);
+/* pass the result of snappy_compress() or the length of a stored block */
+void incompressible_detector_update(incompressible_detector_t *det, size_t len, size_t compressed_len);
+void incompressible_detector_report(const incompressible_detector_t *det);
+
+/* chunker.c */
+typedef struct {
+  size_t carry_offset; /* offset of bytes after the last boundary in the buffer */
+  size_t carry_len;
+  uint64_t num_blocks;
+  uint64_t num_cuts; /* blocks cut by content */
+  /* --adaptive-blocks */
+  size_t block_len; /* current block length. zero before the first block */
+  size_t min_len;
+  size_t max_len;
+  size_t best_len; /* zero when the best length must be measured again */
+  double best_cost; /* seconds per uncompressed byte */
+  double best_ratio;
+  int direction; /* 1 to try longer blocks, -1 to try shorter ones */
+  int turned; /* TRUE after the direction is reversed */
+  int improved; /* TRUE after a move in the direction is better */
+  int stable; /* windows to keep the current length */
+  double start; /* time when the last block was returned */
+  double window_time;
+  uint64_t window_in;
+  uint64_t window_out;
+} chunker_t;
+
+extern int rsyncable;
+extern const char *record_delimiter; /* NULL unless --align-records */
+extern size_t record_delimiter_len;
+extern int adaptive_blocks;
+
+void chunker_init(chunker_t *ch);
+void chunker_report(const chunker_t *ch);
+/* read a block of 'size' bytes at most. used instead of fread(buf, 1, size, fp). */
+size_t chunker_read(chunker_t *ch, char *buf, size_t size, FILE *fp);
+/* tell the compressed length of the last block to --adaptive-blocks */
+void chunker_add_output(chunker_t *ch, size_t compressed_len);
+
+/* constant_block.c */
+typedef struct {
+  int byte; /* byte value of the template or -1 */
+  size_t len; /* uncompressed length */
+  unsigned int crc32c;
+  char *compressed;
+  size_t compressed_len;
+  size_t max_compressed_len;
+  uint64_t num_hits;
+} constant_block_t;
+
+void constant_block_init(constant_block_t *cb);
+void constant_block_free(constant_block_t *cb);
+void constant_block_report(const constant_block_t *cb);
+/* return the template when all bytes in 'data' are same, otherwise NULL */
+const constant_block_t *find_constant_block(constant_block_t *cb, const char *data, size_t len);
+/* memset() 'uncompressed' and return TRUE when 'compressed' is same with the template */
+int uncompress_constant_block(constant_block_t *cb, const char *compressed, size_t compressed_len,
+                              char *uncompressed, size_t *uncompressed_len);
+/* keep 'compressed' as the template when 'uncompressed' is constant */
+void remember_constant_block(constant_block_t *cb, const char *compressed, size_t compressed_len,
+                             const char *uncompressed, size_t uncompressed_len);
+
+/* dedup_cache.c */
+typedef struct dedup_entry dedup_entry_t;
+
+typedef struct {
+  size_t max_entries; /* zero when disabled */
+  size_t num_entries;
+  size_t mask; /* number of hash buckets - 1 */
+  dedup_entry_t **buckets;
+  dedup_entry_t *head; /* most recently used */
+  dedup_entry_t *tail; /* least recently used */
+  uint64_t num_lookups;
+  uint64_t num_hits;
+  uint64_t saved_bytes;
+} dedup_cache_t;
+
+void dedup_cache_init(dedup_cache_t *dc, size_t max_entries);
+void dedup_cache_free(dedup_cache_t *dc);
+void dedup_cache_report(const dedup_cache_t *dc);
+/* set compressed data of the same block compressed before and return TRUE if found */
+int dedup_cache_find(dedup_cache_t *dc, unsigned int crc32c, const char *data, size_t len,
+                     const char **compressed, size_t *compressed_len);
+void dedup_cache_add(dedup_cache_t *dc, unsigned int crc32c, const char *data, size_t len,
+                     const char *compressed, size_t compressed_len);
+
+/* filter.c */
+#define FILTER_SHUFFLE 1
+#define FILTER_SHUFFLE_DELTA 2
+
+extern int shuffle_elem_size; /* zero unless --shuffle */
+extern int shuffle_delta;
+
+void shuffle_block(char *out, const char *in, size_t len, int elem_size, int delta);
+/* 'in' is modified when 'delta' is true */
+void unshuffle_block(char *out, char *in, size_t len, int elem_size, int delta);
+
+#ifdef HAVE_AVX2
+/* filter_avx2.c */
+size_t shuffle4_avx2(char *out, const char *in, size_t n);
+size_t shuffle8_avx2(char *out, const char *in, size_t n);
+size_t unshuffle4_avx2(char *out, const char *in, size_t n);
+size_t unshuffle8_avx2(char *out, const char *in, size_t n);
+#endif
+
+/* autotune.c */
+#define AUTOTUNE_ENV 1 /* by file types and cache sizes */
+#define AUTOTUNE_CALIBRATE 2 /* by compressing the head of the input */
+
+extern int autotune_mode; /* zero unless --autotune */
+
+/* stdio buffer size for 'fd' or zero to keep the default */
+size_t autotune_buffer_size(int fd, const char *name);
+/* block size passed to fmt->compress() or zero to keep the default */
+size_t autotune_block_size(const stream_format_t *fmt, int infd);
+void autotune_print(const char *name, size_t block_size, size_t rsize, size_t wsize);
+
+/* crc_verifier.c */
+typedef struct crc_verifier crc_verifier_t;
+
+crc_verifier_t *crc_verifier_create(FILE *outfp, size_t bufsize);
+char *crc_verifier_buffer(crc_verifier_t *cv);
+int crc_verifier_submit(crc_verifier_t *cv, const char *data, size_t len, unsigned int expected_crc32c,
+                        size_t write_offset, size_t write_len);
+int crc_verifier_write(crc_verifier_t *cv, const char *data, size_t len, unsigned int expected_crc32c,
+                       size_t write_offset, size_t write_len);
+int crc_verifier_finish(crc_verifier_t *cv);
 
 #endif /* SNZIP_H */
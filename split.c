@@ -0,0 +1,231 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <snappy-c.h>
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#ifndef PATH_MAX
+#define PATH_MAX MAX_PATH
+#endif
+#define PATH_DELIMITER '\\'
+#define ftello _ftelli64
+#else
+#include <unistd.h>
+#define PATH_DELIMITER '/'
+#endif
+#include "snzip.h"
+#include "crc32.h"
+
+/*
+ * Compress a file into parts which are complete streams.
+ *
+ * A part is closed at a block boundary once 'split_size' bytes are
+ * written to it. The parts are named 'name.part0001.suffix',
+ * 'name.part0002.suffix' and so on. Uncompressed offsets and lengths
+ * of the parts are written to 'name.manifest' so that the parts can be
+ * uncompressed separately and put together.
+ */
+typedef struct {
+  const block_writer_t *writer;
+  const char *name;
+  const char *suffix;
+  FILE *outfp;
+  void *state;
+  FILE *manifest_fp;
+  char partfile[PATH_MAX];
+  int num_parts;
+  uint64_t part_offset; /* uncompressed offset of the current part */
+} splitter_t;
+
+static int open_part(splitter_t *sp, size_t block_size, uint64_t offset)
+{
+  sp->num_parts++;
+  if (snprintf(sp->partfile, sizeof(sp->partfile), "%s.part%04d.%s", sp->name, sp->num_parts, sp->suffix) >= sizeof(sp->partfile)) {
+    print_error("%s has too long file name.\n", sp->name);
+    return -1;
+  }
+  sp->outfp = fopen(sp->partfile, "wb");
+  if (sp->outfp == NULL) {
+    print_error("Failed to open %s for write: %s\n", sp->partfile, strerror(errno));
+    return -1;
+  }
+  sp->part_offset = offset;
+  if (sp->writer->begin != NULL && sp->writer->begin(sp->outfp, block_size, &sp->state) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int close_part(splitter_t *sp, uint64_t offset)
+{
+  const char *partname = strrchr(sp->partfile, PATH_DELIMITER);
+  FILE *outfp = sp->outfp;
+  uint64_t size;
+
+  if (sp->writer->end != NULL) {
+    void *state = sp->state;
+    sp->state = NULL;
+    if (sp->writer->end(outfp, state, FALSE) != 0) {
+      return -1;
+    }
+  }
+  size = ftello(outfp);
+  sp->outfp = NULL;
+  if (ferror(outfp) || fclose(outfp) != 0) {
+    print_error("Failed to write %s: %s\n", sp->partfile, strerror(errno));
+    return -1;
+  }
+  trace("%s: %llu bytes for %llu bytes from %llu\n", sp->partfile, (unsigned long long)size,
+        (unsigned long long)(offset - sp->part_offset), (unsigned long long)sp->part_offset);
+  fprintf(sp->manifest_fp, "%s %llu %llu\n", partname != NULL ? partname + 1 : sp->partfile,
+          (unsigned long long)sp->part_offset, (unsigned long long)(offset - sp->part_offset));
+  return 0;
+}
+
+int split_stream(stream_format_t *fmt, FILE *infp, const char *name, uint64_t split_size, size_t block_size)
+{
+  splitter_t sp = {0, };
+  const block_writer_t *w = fmt->block_writer;
+  char manifest[PATH_MAX];
+  size_t max_compressed_len;
+  char *uncompressed_data = NULL;
+  char *compressed_data = NULL;
+  size_t len;
+  uint64_t offset = 0;
+  chunker_t chunker;
+  int i;
+  int err = 1;
+
+  if (w == NULL) {
+    print_error("--split-size isn't supported for %s format\n", fmt->name);
+    return 1;
+  }
+  block_size = writer_block_size(w, block_size);
+  max_compressed_len = snappy_max_compressed_length(block_size);
+  sp.writer = w;
+  sp.name = name;
+  sp.suffix = fmt->suffix;
+
+  if (snprintf(manifest, sizeof(manifest), "%s.manifest", name) >= sizeof(manifest)) {
+    print_error("%s has too long file name.\n", name);
+    return 1;
+  }
+  sp.manifest_fp = fopen(manifest, "w");
+  if (sp.manifest_fp == NULL) {
+    print_error("Failed to open %s for write: %s\n", manifest, strerror(errno));
+    return 1;
+  }
+  fprintf(sp.manifest_fp, "# snzip split manifest: file uncompressed_offset uncompressed_length\n");
+
+  uncompressed_data = malloc(block_size);
+  compressed_data = malloc(max_compressed_len);
+  if (uncompressed_data == NULL || compressed_data == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+
+  chunker_init(&chunker);
+  while ((len = chunker_read(&chunker, uncompressed_data, block_size, infp)) > 0) {
+    snappy_block_t blk;
+    size_t compressed_len = max_compressed_len;
+
+    if (sp.outfp == NULL && open_part(&sp, block_size, offset) != 0) {
+      goto cleanup;
+    }
+    snappy_compress(uncompressed_data, len, compressed_data, &compressed_len);
+    blk.uncompressed_len = len;
+    blk.has_crc = w->need_crc;
+    blk.crc32c = w->need_crc ? masked_crc32c(uncompressed_data, len) : 0;
+    if (w->store && (compressed_len >= len - (len / 8) || compressed_len > w->max_len)) {
+      blk.data = uncompressed_data;
+      blk.len = len;
+      blk.compressed = FALSE;
+    } else {
+      blk.data = compressed_data;
+      blk.len = compressed_len;
+      blk.compressed = TRUE;
+    }
+    if (blk.len > w->max_len) {
+      print_error("Too long compressed data %lu\n", (unsigned long)blk.len);
+      goto cleanup;
+    }
+    if (w->write(sp.outfp, sp.state, &blk) != 0) {
+      goto cleanup;
+    }
+    offset += len;
+    if ((uint64_t)ftello(sp.outfp) >= split_size && close_part(&sp, offset) != 0) {
+      goto cleanup;
+    }
+  }
+  if (ferror(infp)) {
+    print_error("Failed to read a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  chunker_report(&chunker);
+  if (sp.num_parts == 0 && open_part(&sp, block_size, offset) != 0) {
+    /* write an empty stream for an empty file */
+    goto cleanup;
+  }
+  if (sp.outfp != NULL && close_part(&sp, offset) != 0) {
+    goto cleanup;
+  }
+  fprintf(sp.manifest_fp, "# total %llu\n", (unsigned long long)offset);
+  trace("%d parts\n", sp.num_parts);
+  err = 0;
+ cleanup:
+  if (sp.outfp != NULL) {
+    if (sp.state != NULL) {
+      w->end(sp.outfp, sp.state, TRUE);
+    }
+    fclose(sp.outfp);
+  }
+  if (fclose(sp.manifest_fp) != 0 && !err) {
+    print_error("Failed to write %s: %s\n", manifest, strerror(errno));
+    err = 1;
+  }
+  if (err) {
+    for (i = 1; i <= sp.num_parts; i++) {
+      snprintf(sp.partfile, sizeof(sp.partfile), "%s.part%04d.%s", name, i, fmt->suffix);
+      unlink(sp.partfile);
+    }
+    unlink(manifest);
+  }
+  free(uncompressed_data);
+  free(compressed_data);
+  return err;
+}
@@ -0,0 +1,249 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <snappy-c.h>
+#include "snzip.h"
+#include "crc32.h"
+
+#define TEE_READ_SIZE (64 * 1024)
+
+/*
+ * Compress data once and write it in more than one format.
+ *
+ * Outputs are grouped by their block sizes. Each block is compressed
+ * once per group and the compressed data and the checksum are shared
+ * by all outputs in the group.
+ */
+typedef struct {
+  size_t block_size;
+  char *data; /* uncompressed data of the current block */
+  size_t len;
+  char *compressed_data;
+  size_t max_compressed_len;
+  int need_crc;
+} block_group_t;
+
+typedef struct {
+  const block_writer_t *writer;
+  FILE *fp;
+  void *state;
+  block_group_t *group;
+} tee_writer_t;
+
+/* block size used for 'w' when -b or -B specifies 'block_size' (0: default) */
+size_t writer_block_size(const block_writer_t *w, size_t block_size)
+{
+  size_t size = block_size ? block_size : w->block_size;
+
+  if (size > w->max_uncompressed_len) {
+    size = w->max_uncompressed_len;
+  }
+  if (w->fixed_size) {
+    /* round down to power of two */
+    while (size & (size - 1)) {
+      size &= size - 1;
+    }
+  }
+  return size;
+}
+
+static int flush_group(block_group_t *group, tee_writer_t *writers, int num_writers, uint64_t *num_written)
+{
+  size_t compressed_len = group->max_compressed_len;
+  unsigned int crc32c = 0;
+  int i;
+
+  snappy_compress(group->data, group->len, group->compressed_data, &compressed_len);
+  if (group->need_crc) {
+    crc32c = masked_crc32c(group->data, group->len);
+  }
+  for (i = 0; i < num_writers; i++) {
+    tee_writer_t *tw = &writers[i];
+    const block_writer_t *w = tw->writer;
+    snappy_block_t blk;
+
+    if (tw->group != group) {
+      continue;
+    }
+    blk.uncompressed_len = group->len;
+    blk.has_crc = w->need_crc;
+    blk.crc32c = crc32c;
+    if (w->store && (compressed_len >= group->len - (group->len / 8) || compressed_len > w->max_len)) {
+      blk.data = group->data;
+      blk.len = group->len;
+      blk.compressed = FALSE;
+    } else {
+      blk.data = group->compressed_data;
+      blk.len = compressed_len;
+      blk.compressed = TRUE;
+    }
+    if (blk.len > w->max_len) {
+      print_error("Too long compressed data %lu\n", (unsigned long)blk.len);
+      return -1;
+    }
+    if (w->write(tw->fp, tw->state, &blk) != 0) {
+      return -1;
+    }
+    if (ferror(tw->fp)) {
+      print_error("Failed to write a file: %s\n", strerror(errno));
+      return -1;
+    }
+    (*num_written)++;
+  }
+  group->len = 0;
+  return 0;
+}
+
+int tee_stream(FILE *infp, tee_output_t *outputs, int num_outputs, size_t block_size)
+{
+  block_group_t *groups = calloc(num_outputs, sizeof(block_group_t));
+  tee_writer_t *writers = calloc(num_outputs, sizeof(tee_writer_t));
+  char *buf = malloc(TEE_READ_SIZE);
+  int num_groups = 0;
+  uint64_t num_compressed = 0;
+  uint64_t num_written = 0;
+  size_t len;
+  int i, j;
+  int err = 1;
+
+  if (groups == NULL || writers == NULL || buf == NULL) {
+    print_error("out of memory\n");
+    goto cleanup;
+  }
+  for (i = 0; i < num_outputs; i++) {
+    const block_writer_t *w = outputs[i].fmt->block_writer;
+    size_t size;
+
+    if (w == NULL) {
+      print_error("--tee isn't supported for %s format\n", outputs[i].fmt->name);
+      goto cleanup;
+    }
+    size = writer_block_size(w, block_size);
+    for (j = 0; j < num_groups; j++) {
+      if (groups[j].block_size == size) {
+        break;
+      }
+    }
+    if (j == num_groups) {
+      groups[j].block_size = size;
+      groups[j].max_compressed_len = snappy_max_compressed_length(size);
+      groups[j].data = malloc(size);
+      groups[j].compressed_data = malloc(groups[j].max_compressed_len);
+      if (groups[j].data == NULL || groups[j].compressed_data == NULL) {
+        print_error("out of memory\n");
+        goto cleanup;
+      }
+      num_groups++;
+    }
+    if (w->need_crc) {
+      groups[j].need_crc = TRUE;
+    }
+    writers[i].writer = w;
+    writers[i].fp = outputs[i].fp;
+    writers[i].group = &groups[j];
+    trace("%s: block size %lu\n", outputs[i].fmt->name, (unsigned long)size);
+    if (w->begin != NULL && w->begin(writers[i].fp, size, &writers[i].state) != 0) {
+      goto cleanup;
+    }
+  }
+
+  while ((len = fread(buf, 1, TEE_READ_SIZE, infp)) > 0) {
+    for (i = 0; i < num_groups; i++) {
+      block_group_t *group = &groups[i];
+      const char *p = buf;
+      size_t rest = len;
+
+      while (rest > 0) {
+        size_t n = group->block_size - group->len;
+        if (n > rest) {
+          n = rest;
+        }
+        memcpy(group->data + group->len, p, n);
+        group->len += n;
+        p += n;
+        rest -= n;
+        if (group->len == group->block_size) {
+          if (flush_group(group, writers, num_outputs, &num_written) != 0) {
+            goto cleanup;
+          }
+          num_compressed++;
+        }
+      }
+    }
+  }
+  if (ferror(infp)) {
+    print_error("Failed to read a file: %s\n", strerror(errno));
+    goto cleanup;
+  }
+  for (i = 0; i < num_groups; i++) {
+    if (groups[i].len > 0) {
+      if (flush_group(&groups[i], writers, num_outputs, &num_written) != 0) {
+        goto cleanup;
+      }
+      num_compressed++;
+    }
+  }
+  for (i = 0; i < num_outputs; i++) {
+    if (writers[i].writer->end != NULL) {
+      void *state = writers[i].state;
+      writers[i].state = NULL;
+      if (writers[i].writer->end(writers[i].fp, state, FALSE) != 0) {
+        goto cleanup;
+      }
+    }
+  }
+  trace("%llu blocks compressed for %llu blocks written\n",
+        (unsigned long long)num_compressed, (unsigned long long)num_written);
+  err = 0;
+ cleanup:
+  if (writers != NULL) {
+    for (i = 0; i < num_outputs; i++) {
+      if (writers[i].state != NULL) {
+        writers[i].writer->end(writers[i].fp, writers[i].state, TRUE);
+      }
+    }
+  }
+  if (groups != NULL) {
+    for (i = 0; i < num_groups; i++) {
+      free(groups[i].data);
+      free(groups[i].compressed_data);
+    }
+  }
+  free(groups);
+  free(writers);
+  free(buf);
+  return err;
+}
@@ -81,4 +81,351 @@ cmp $TESTDIR/alice29.txt.snappy.out $TESTDIR/plain/alice29.txt
 rm $TESTDIR/alice29.txt.snappy.out
 echo ""
 
+echo uncompress a range of a seekable framing2 file
+$SNZIP --seekable=2 -c $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.sz
+$SNZIP -dc $TESTDIR/alice29.txt.tmp.sz | cmp - $TESTDIR/plain/alice29.txt
+for range in "0 100" "70000 200000" "131071 2" "150000 1000000" "200000 10"; do
+    set -- $range
+    $SNZIP -dc --offset $1 --length $2 $TESTDIR/alice29.txt.tmp.sz > $TESTDIR/alice29.txt.tmp
+    tail -c +`expr $1 + 1` $TESTDIR/plain/alice29.txt | head -c $2 | cmp - $TESTDIR/alice29.txt.tmp
+done
+echo uncompress a range of concatenated framing2 files
+$SNZIP -c $TESTDIR/plain/alice29.txt | cat - $TESTDIR/alice29.txt.tmp.sz > $TESTDIR/alice29.txt.tmp.cat.sz
+cat $TESTDIR/plain/alice29.txt $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.plain
+for range in "0 100" "150000 5000" "200000 100" "300000 10000"; do
+    set -- $range
+    $SNZIP -dc --offset $1 --length $2 $TESTDIR/alice29.txt.tmp.cat.sz > $TESTDIR/alice29.txt.tmp
+    tail -c +`expr $1 + 1` $TESTDIR/alice29.txt.tmp.plain | head -c $2 | cmp - $TESTDIR/alice29.txt.tmp
+done
+rm $TESTDIR/alice29.txt.tmp.sz $TESTDIR/alice29.txt.tmp $TESTDIR/alice29.txt.tmp.cat.sz $TESTDIR/alice29.txt.tmp.plain
+echo ""
+
+for format in framing framing2 hadoop-snappy snappy-java snzip; do
+    echo uncompress a range of $format file without index
+    $SNZIP -t $format -b 16384 -c $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.$format
+    for range in "0 100" "70000 200000" "131071 2" "150000 1000000" "200000 10"; do
+        set -- $range
+        $SNZIP -dc --offset $1 --length $2 < $TESTDIR/alice29.txt.tmp.$format > $TESTDIR/alice29.txt.tmp
+        tail -c +`expr $1 + 1` $TESTDIR/plain/alice29.txt | head -c $2 | cmp - $TESTDIR/alice29.txt.tmp
+        cat $TESTDIR/alice29.txt.tmp.$format | $SNZIP -dc --offset $1 --length $2 > $TESTDIR/alice29.txt.tmp
+        tail -c +`expr $1 + 1` $TESTDIR/plain/alice29.txt | head -c $2 | cmp - $TESTDIR/alice29.txt.tmp
+    done
+    rm $TESTDIR/alice29.txt.tmp.$format $TESTDIR/alice29.txt.tmp
+done
+echo ""
+
+echo uncompress a range of truncated files
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do cat $TESTDIR/plain/alice29.txt; done > $TESTDIR/alice29.txt.tmp
+for format in framing framing2 hadoop-snappy snappy-java snzip; do
+    $SNZIP -t $format -c < $TESTDIR/alice29.txt.tmp > $TESTDIR/alice29.txt.tmp.1
+    size=`wc -c < $TESTDIR/alice29.txt.tmp.1`
+    head -c `expr $size / 2` $TESTDIR/alice29.txt.tmp.1 > $TESTDIR/alice29.txt.tmp.$format
+    if $SNZIP -t $format -dc --offset 2500000 --length 1000 < $TESTDIR/alice29.txt.tmp.$format > /dev/null 2>&1; then
+        echo "a range after the end of truncated $format file was uncompressed without errors"
+        exit 1
+    fi
+    rm $TESTDIR/alice29.txt.tmp.1 $TESTDIR/alice29.txt.tmp.$format
+done
+rm $TESTDIR/alice29.txt.tmp
+echo ""
+
+echo compress with page-aligned chunks
+for args in "--align" "--align=64 --align-chunks=3 --seekable=3"; do
+    $SNZIP $args -c $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.sz
+    $SNZIP -dc $TESTDIR/alice29.txt.tmp.sz | cmp - $TESTDIR/plain/alice29.txt
+    $SNZIP -dc --offset 70000 --length 200000 $TESTDIR/alice29.txt.tmp.sz > $TESTDIR/alice29.txt.tmp
+    tail -c +70001 $TESTDIR/plain/alice29.txt | head -c 200000 | cmp - $TESTDIR/alice29.txt.tmp
+done
+rm $TESTDIR/alice29.txt.tmp.sz $TESTDIR/alice29.txt.tmp
+echo ""
+
+for format in framing framing2 hadoop-snappy iwa snappy-java snappy-in-java; do
+    echo concatenate $format files
+    $SNZIP -t $format -c $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.1
+    if test $format = framing2; then
+        $SNZIP --seekable -c $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.2
+    else
+        cp $TESTDIR/alice29.txt.tmp.1 $TESTDIR/alice29.txt.tmp.2
+    fi
+    $SNZIP -t $format --concat $TESTDIR/alice29.txt.tmp.sz $TESTDIR/alice29.txt.tmp.1 $TESTDIR/alice29.txt.tmp.2
+    cat $TESTDIR/plain/alice29.txt $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp
+    $SNZIP -t $format -dc < $TESTDIR/alice29.txt.tmp.sz | cmp - $TESTDIR/alice29.txt.tmp
+    rm $TESTDIR/alice29.txt.tmp.1 $TESTDIR/alice29.txt.tmp.2 $TESTDIR/alice29.txt.tmp.sz $TESTDIR/alice29.txt.tmp
+done
+echo ""
+
+for from in framing2 hadoop-snappy snappy-java snappy-in-java snzip; do
+    for to in framing2 hadoop-snappy iwa snappy-java snappy-in-java snzip; do
+        echo convert $from to $to
+        $SNZIP -t $from -c $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.txt.tmp.1
+        $SNZIP --convert -t $to -c $TESTDIR/alice29.txt.tmp.1 > $TESTDIR/alice29.txt.tmp.2
+        $SNZIP -t $to -dc < $TESTDIR/alice29.txt.tmp.2 | cmp - $TESTDIR/plain/alice29.txt
+    done
+done
+rm $TESTDIR/alice29.txt.tmp.1 $TESTDIR/alice29.txt.tmp.2
+echo ""
+
+for format in framing2 snzip snappy-java; do
+    echo split into $format parts
+    cp $TESTDIR/plain/alice29.txt $TESTDIR/alice29.tmp
+    $SNZIP -t $format -b 16384 --split-size 20000 $TESTDIR/alice29.tmp
+    for part in $TESTDIR/alice29.tmp.part*; do
+        $SNZIP -t $format -dc < $part
+    done | cmp - $TESTDIR/plain/alice29.txt
+    test `grep -c part $TESTDIR/alice29.tmp.manifest` = `ls $TESTDIR/alice29.tmp.part* | wc -l`
+    rm $TESTDIR/alice29.tmp.part* $TESTDIR/alice29.tmp.manifest
+done
+echo ""
+
+echo pack files into an archive
+TOPDIR=`cd $TESTDIR/.. && pwd`
+mkdir $TESTDIR/archive.tmp
+(cd $TESTDIR/plain && $TOPDIR/snzip --archive ../archive.tmp/a.snza alice29.txt house.jpg)
+$SNZIP --list $TESTDIR/archive.tmp/a.snza > /dev/null
+cat $TESTDIR/plain/alice29.txt $TESTDIR/plain/house.jpg > $TESTDIR/archive.tmp/all
+$SNZIP -dc < $TESTDIR/archive.tmp/a.snza | cmp - $TESTDIR/archive.tmp/all
+$SNZIP -dc --archive $TESTDIR/archive.tmp/a.snza house.jpg | cmp - $TESTDIR/plain/house.jpg
+for threads in 1 2; do
+    (cd $TESTDIR/archive.tmp && SNZIP_THREADS=$threads $TOPDIR/snzip -d --archive a.snza)
+    cmp $TESTDIR/archive.tmp/alice29.txt $TESTDIR/plain/alice29.txt
+    cmp $TESTDIR/archive.tmp/house.jpg $TESTDIR/plain/house.jpg
+    rm $TESTDIR/archive.tmp/alice29.txt $TESTDIR/archive.tmp/house.jpg
+done
+rm -rf $TESTDIR/archive.tmp
+echo ""
+
+echo compress in several formats at once
+$SNZIP --tee framing2:$TESTDIR/alice29.tmp.sz,hadoop-snappy:$TESTDIR/alice29.tmp.snappy,snzip:$TESTDIR/alice29.tmp.snz,snappy-in-java:$TESTDIR/alice29.tmp.sij $TESTDIR/plain/alice29.txt
+$SNZIP -dc < $TESTDIR/alice29.tmp.sz | cmp - $TESTDIR/plain/alice29.txt
+$SNZIP -dc < $TESTDIR/alice29.tmp.snappy | cmp - $TESTDIR/plain/alice29.txt
+$SNZIP -dc < $TESTDIR/alice29.tmp.snz | cmp - $TESTDIR/plain/alice29.txt
+$SNZIP -dc < $TESTDIR/alice29.tmp.sij | cmp - $TESTDIR/plain/alice29.txt
+rm $TESTDIR/alice29.tmp.sz $TESTDIR/alice29.tmp.snappy $TESTDIR/alice29.tmp.snz $TESTDIR/alice29.tmp.sij
+echo ""
+
+echo compress with content-defined block boundaries
+for fmt in framing2 hadoop-snappy snappy-java snzip; do
+    $SNZIP -c -t $fmt -b 8192 --rsyncable < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp
+    $SNZIP -dc -t $fmt < $TESTDIR/alice29.tmp | cmp - $TESTDIR/plain/alice29.txt
+done
+# print the checksum of each compressed block of a hadoop-snappy file except the last one
+block_checksums() {
+    prev=
+    $SNZIP --build-index < $1 | sed 1d | while read offset uoffset; do
+        if test -n "$prev"; then
+            tail -c +`expr $prev + 1` $1 | head -c `expr $offset - $prev` | cksum
+        fi
+        prev=$offset
+    done
+}
+# insert a byte near the head and count unchanged blocks
+(head -c 100 $TESTDIR/plain/alice29.txt; echo; tail -c +101 $TESTDIR/plain/alice29.txt) > $TESTDIR/alice29.tmp
+for opt in --rsyncable ""; do
+    $SNZIP -c -t hadoop-snappy -b 8192 $opt < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp.1
+    $SNZIP -c -t hadoop-snappy -b 8192 $opt < $TESTDIR/alice29.tmp > $TESTDIR/alice29.tmp.2
+    block_checksums $TESTDIR/alice29.tmp.1 | sort > $TESTDIR/alice29.tmp.3
+    block_checksums $TESTDIR/alice29.tmp.2 | sort > $TESTDIR/alice29.tmp.4
+    total=`wc -l < $TESTDIR/alice29.tmp.3`
+    shared=`comm -12 $TESTDIR/alice29.tmp.3 $TESTDIR/alice29.tmp.4 | wc -l`
+    echo "$shared of $total blocks are unchanged with ${opt:-fixed-size blocks}"
+    if test -n "$opt"; then
+        # all except the block including the change
+        test `expr $shared + 1` -ge $total
+    else
+        test $shared -eq 0
+    fi
+done
+rm $TESTDIR/alice29.tmp $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.2 $TESTDIR/alice29.tmp.3 $TESTDIR/alice29.tmp.4
+echo ""
+
+echo compress with blocks starting at records
+for fmt in framing2 hadoop-snappy snzip; do
+    $SNZIP -c -t $fmt -b 4096 --align-records < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp
+    $SNZIP -dc -t $fmt < $TESTDIR/alice29.tmp | cmp - $TESTDIR/plain/alice29.txt
+    $SNZIP -c -t $fmt -b 4096 --align-records='\x2e\r\n' < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp
+    $SNZIP -dc -t $fmt < $TESTDIR/alice29.tmp | cmp - $TESTDIR/plain/alice29.txt
+done
+rm $TESTDIR/alice29.tmp
+echo ""
+
+echo compress with adaptive block sizes
+cat $TESTDIR/plain/* $TESTDIR/plain/* > $TESTDIR/plain.tmp
+for fmt in snappy-java hadoop-snappy snzip; do
+    $SNZIP -c -t $fmt --adaptive-blocks < $TESTDIR/plain.tmp > $TESTDIR/plain.tmp.$fmt
+    $SNZIP -dc -t $fmt < $TESTDIR/plain.tmp.$fmt | cmp - $TESTDIR/plain.tmp
+    rm $TESTDIR/plain.tmp.$fmt
+done
+rm $TESTDIR/plain.tmp
+echo ""
+
+echo reuse compressed data of duplicated blocks
+(head -c 65536 $TESTDIR/plain/alice29.txt; head -c 65536 $TESTDIR/plain/alice29.txt; cat $TESTDIR/plain/alice29.txt) > $TESTDIR/alice29.tmp
+for fmt in framing2 framing snzip; do
+    $SNZIP -c -t $fmt < $TESTDIR/alice29.tmp > $TESTDIR/alice29.tmp.1
+    $SNZIP -c -t $fmt -b 16384 --dedup=4 < $TESTDIR/alice29.tmp > $TESTDIR/alice29.tmp.2
+    $SNZIP -c -t $fmt --dedup < $TESTDIR/alice29.tmp | cmp - $TESTDIR/alice29.tmp.1
+    $SNZIP -dc -t $fmt < $TESTDIR/alice29.tmp.2 | cmp - $TESTDIR/alice29.tmp
+done
+# a compressible block made of 20 KiB of JPEG data among JPEG blocks
+tail -c 20480 $TESTDIR/plain/house.jpg > $TESTDIR/alice29.tmp.1
+cat $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.1 | head -c 65536 > $TESTDIR/alice29.tmp.2
+cat $TESTDIR/plain/house.jpg $TESTDIR/plain/house.jpg $TESTDIR/plain/house.jpg | head -c 327680 > $TESTDIR/alice29.tmp.1
+for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+    cat $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.2
+done > $TESTDIR/alice29.tmp
+for fmt in framing2 framing; do
+    $SNZIP -c -t $fmt < $TESTDIR/alice29.tmp > $TESTDIR/alice29.tmp.1
+    $SNZIP -c -t $fmt --dedup < $TESTDIR/alice29.tmp | cmp - $TESTDIR/alice29.tmp.1
+done
+for args in "--tee snzip:$TESTDIR/alice29.tmp.1" "--split-size 20000" "--archive $TESTDIR/alice29.tmp.1"; do
+    if $SNZIP -c --dedup $args $TESTDIR/alice29.tmp > /dev/null 2>&1; then
+        echo "--dedup $args was accepted"
+        exit 1
+    fi
+done
+rm $TESTDIR/alice29.tmp $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.2
+echo ""
+
+echo choose block and buffer sizes by --autotune
+cp $TESTDIR/plain/alice29.txt $TESTDIR/alice29.tmp
+for fmt in snzip snappy-java framing2; do
+    $SNZIP -c -t $fmt --autotune $TESTDIR/alice29.tmp > $TESTDIR/alice29.tmp.1
+    $SNZIP -dc --autotune < $TESTDIR/alice29.tmp.1 | cmp - $TESTDIR/alice29.tmp
+    $SNZIP -c -t $fmt --autotune=calibrate < $TESTDIR/alice29.tmp | $SNZIP -dc -t $fmt | cmp - $TESTDIR/alice29.tmp
+done
+rm $TESTDIR/alice29.tmp $TESTDIR/alice29.tmp.1
+echo ""
+
+echo shuffle bytes of elements before compression
+for opt in "--shuffle=4" "--shuffle=8 --delta" "--shuffle=3 --delta"; do
+    $SNZIP -c -t snzip -b 16384 $opt < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp.1
+    SNZIP_SHUFFLE=scalar $SNZIP -c -t snzip -b 16384 $opt < $TESTDIR/plain/alice29.txt | cmp - $TESTDIR/alice29.tmp.1
+    $SNZIP -dc < $TESTDIR/alice29.tmp.1 | cmp - $TESTDIR/plain/alice29.txt
+    SNZIP_SHUFFLE=scalar $SNZIP -dc < $TESTDIR/alice29.tmp.1 | cmp - $TESTDIR/plain/alice29.txt
+done
+rm $TESTDIR/alice29.tmp.1
+echo ""
+
+echo write large hadoop-snappy blocks as subblocks
+cat $TESTDIR/plain/alice29.txt $TESTDIR/plain/alice29.txt $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp
+SNZIP_THREADS=1 $SNZIP -c -t hadoop-snappy -b 1048576 < $TESTDIR/alice29.tmp > $TESTDIR/alice29.tmp.1
+SNZIP_THREADS=4 $SNZIP -c -t hadoop-snappy -b 1048576 < $TESTDIR/alice29.tmp | cmp - $TESTDIR/alice29.tmp.1
+$SNZIP -dc < $TESTDIR/alice29.tmp.1 | cmp - $TESTDIR/alice29.tmp
+$SNZIP -c -t hadoop-snappy -b 1048576 < $TESTDIR/plain/alice29.txt | $SNZIP -dc | cmp - $TESTDIR/plain/alice29.txt
+rm $TESTDIR/alice29.tmp $TESTDIR/alice29.tmp.1
+echo ""
+
+echo compress and uncompress raw data longer than 1 MiB
+if $SNZIP -h 2>&1 | grep ' raw ' > /dev/null; then
+  for i in 1 2 3 4 5 6 7 8; do cat $TESTDIR/plain/alice29.txt; done > $TESTDIR/alice29.tmp
+  size=`wc -c < $TESTDIR/alice29.tmp`
+  # SNZIP_THREADS=1 uses snappy::Compress.
+  cat $TESTDIR/alice29.tmp | SNZIP_THREADS=1 $SNZIP -c -t raw -s $size > $TESTDIR/alice29.tmp.1
+  $SNZIP -dc -t raw < $TESTDIR/alice29.tmp.1 | cmp - $TESTDIR/alice29.tmp
+  SNZIP_THREADS=4 $SNZIP -c -t raw < $TESTDIR/alice29.tmp | cmp - $TESTDIR/alice29.tmp.1
+  rm $TESTDIR/alice29.tmp $TESTDIR/alice29.tmp.1
+  for testfile in alice29.txt house.jpg; do
+    SNZIP_THREADS=1 $SNZIP -c -t raw < $TESTDIR/plain/$testfile > $TESTDIR/$testfile.tmp.raw
+    SNZIP_THREADS=4 $SNZIP -c -t raw < $TESTDIR/plain/$testfile | cmp - $TESTDIR/$testfile.tmp.raw
+    # snappy 1.1.4 and later compress incompressible data differently.
+    if cmp -s $TESTDIR/$testfile.tmp.raw $TESTDIR/raw/$testfile.raw; then
+      SNZIP_THREADS=4 $SNZIP -c -t raw < $TESTDIR/plain/$testfile | cmp - $TESTDIR/raw/$testfile.raw
+    else
+      echo "snappy doesn't reproduce raw/$testfile.raw. Skip comparing with it."
+    fi
+    rm $TESTDIR/$testfile.tmp.raw
+  done
+  # an uncompressed length of 2^35 - 1 followed by a one-byte literal
+  if printf '\377\377\377\377\177\000a' | $SNZIP -dc -t raw > /dev/null 2> $TESTDIR/alice29.tmp; then
+    echo "an uncompressed length longer than 32 bits was accepted"
+    exit 1
+  fi
+  # rejected in the preamble, not at the end of data
+  grep 'broken uncompressed length' $TESTDIR/alice29.tmp > /dev/null
+  rm $TESTDIR/alice29.tmp
+else
+  echo 'Skip raw format tests'
+fi
+echo ""
+
+echo reuse constant blocks
+(head -c 1000000 /dev/zero; cat $TESTDIR/plain/alice29.txt; head -c 500000 /dev/zero | tr '\000' 'a'; head -c 70000 /dev/zero) > $TESTDIR/constant.tmp
+for args in "-t framing2" "-t hadoop-snappy" "-t snzip" "-t hadoop-snappy -b 1048576"; do
+    SNZIP_THREADS=4 $SNZIP -c $args < $TESTDIR/constant.tmp > $TESTDIR/constant.tmp.1
+    $SNZIP -dc -T $args < $TESTDIR/constant.tmp.1 2> $TESTDIR/constant.tmp.log | cmp - $TESTDIR/constant.tmp
+    grep 'constant blocks: [1-9]' $TESTDIR/constant.tmp.log > /dev/null
+done
+rm $TESTDIR/constant.tmp $TESTDIR/constant.tmp.1 $TESTDIR/constant.tmp.log
+echo ""
+
+echo stop at a chunk with a wrong checksum
+$SNZIP -c -t framing2 -b 65536 < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp.sz
+# the CRC of the second chunk after the stream identifier and the first chunk
+set -- `od -An -tu1 -j 11 -N 3 $TESTDIR/alice29.tmp.sz`
+offset=`expr 10 + 4 + $1 + $2 \* 256 + $3 \* 65536 + 4`
+dd if=$TESTDIR/alice29.tmp.sz bs=1 skip=$offset count=1 2> /dev/null | LC_ALL=C tr '\000-\377' '\001-\377\000' | \
+    dd of=$TESTDIR/alice29.tmp.sz bs=1 seek=$offset conv=notrunc 2> /dev/null
+for threads in 1 4; do
+    if SNZIP_THREADS=$threads $SNZIP -t framing2 -dc $TESTDIR/alice29.tmp.sz > $TESTDIR/alice29.tmp 2> /dev/null; then
+        echo "corrupted data was uncompressed without errors"
+        exit 1
+    fi
+    head -c 65536 $TESTDIR/plain/alice29.txt | cmp - $TESTDIR/alice29.tmp
+done
+rm $TESTDIR/alice29.tmp.sz $TESTDIR/alice29.tmp
+echo ""
+
+echo store incompressible blocks without changing the output
+# 20 KiB of JPEG data repeated, which compresses only in whole blocks
+head -c 20480 $TESTDIR/plain/house.jpg > $TESTDIR/house.tmp
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+    cat $TESTDIR/house.tmp $TESTDIR/house.tmp $TESTDIR/house.tmp
+done > $TESTDIR/periodic.tmp
+# 40 blocks of JPEG data followed by 40 text blocks ending in JPEG data
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21; do
+    cat $TESTDIR/plain/house.jpg
+done | head -c 2621440 > $TESTDIR/mixed.tmp
+tail -c 1024 $TESTDIR/plain/house.jpg > $TESTDIR/house.tmp
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+    head -c 64512 $TESTDIR/plain/alice29.txt
+    cat $TESTDIR/house.tmp
+    head -c 64512 $TESTDIR/plain/alice29.txt
+    cat $TESTDIR/house.tmp
+done >> $TESTDIR/mixed.tmp
+for fmt in framing2 framing comment-43 snappy-in-java; do
+    for file in $TESTDIR/periodic.tmp $TESTDIR/mixed.tmp; do
+        $SNZIP -c -t $fmt --always-compress < $file > $TESTDIR/house.tmp
+        $SNZIP -c -t $fmt < $file | cmp - $TESTDIR/house.tmp
+    done
+done
+$SNZIP -c -t framing2 < $TESTDIR/mixed.tmp | $SNZIP -dc -t framing2 | cmp - $TESTDIR/mixed.tmp
+rm $TESTDIR/house.tmp $TESTDIR/periodic.tmp $TESTDIR/mixed.tmp
+echo ""
+
+echo write snzip format version 1 by default
+$SNZIP -c -t snzip < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp.1
+test `od -An -tu1 -j 3 -N 1 $TESTDIR/alice29.tmp.1` = 1
+$SNZIP -c -t snzip --snz-version=2 < $TESTDIR/plain/alice29.txt > $TESTDIR/alice29.tmp.2
+test `od -An -tu1 -j 3 -N 1 $TESTDIR/alice29.tmp.2` = 2
+$SNZIP -dc < $TESTDIR/alice29.tmp.2 | cmp - $TESTDIR/plain/alice29.txt
+$SNZIP -dc --offset 70000 --length 200000 < $TESTDIR/alice29.tmp.2 > $TESTDIR/alice29.tmp
+tail -c +70001 $TESTDIR/plain/alice29.txt | head -c 200000 | cmp - $TESTDIR/alice29.tmp
+$SNZIP --convert -t framing2 -c $TESTDIR/alice29.tmp.2 | $SNZIP -dc | cmp - $TESTDIR/plain/alice29.txt
+if $SNZIP -c -t snzip --snz-version=2 --rsyncable < $TESTDIR/plain/alice29.txt > /dev/null 2>&1; then
+    echo "--rsyncable was accepted for snzip version 2"
+    exit 1
+fi
+rm $TESTDIR/alice29.tmp.1 $TESTDIR/alice29.tmp.2 $TESTDIR/alice29.tmp
+echo ""
+
+echo write a split index of a hadoop-snappy file
+cp $TESTDIR/plain/alice29.txt $TESTDIR/alice29.tmp
+$SNZIP -t hadoop-snappy -b 16384 --index $TESTDIR/alice29.tmp
+$SNZIP --build-index < $TESTDIR/alice29.tmp.snappy | cmp - $TESTDIR/alice29.tmp.snappy.idx
+mv $TESTDIR/alice29.tmp.snappy.idx $TESTDIR/alice29.tmp.idx
+$SNZIP --build-index $TESTDIR/alice29.tmp.snappy
+cmp $TESTDIR/alice29.tmp.idx $TESTDIR/alice29.tmp.snappy.idx
+rm $TESTDIR/alice29.tmp.snappy $TESTDIR/alice29.tmp.snappy.idx $TESTDIR/alice29.tmp.idx
+echo ""
+
 echo Success
@@ -0,0 +1,100 @@
+/* -*- indent-tabs-mode: nil -*-
+ *
+ * Copyright 2026 Kubo Takehiro <kubo@jiubao.org>
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of the authors.
+ *
+ */
+#ifndef THREAD_H
+#define THREAD_H 1
+
+/* thin wrappers of pthreads and Windows threads */
+#if defined HAVE_PTHREAD
+#include <pthread.h>
+#define SNZ_HAVE_THREAD 1
+
+typedef pthread_t snz_thread_t;
+typedef pthread_mutex_t snz_mutex_t;
+typedef pthread_cond_t snz_cond_t;
+
+#define SNZ_THREAD_FUNC(name, arg) void *name(void *arg)
+#define SNZ_THREAD_RETURN return NULL
+typedef void *(*snz_thread_func_t)(void *);
+
+static inline int snz_thread_create(snz_thread_t *thread, snz_thread_func_t func, void *arg)
+{
+  return pthread_create(thread, NULL, func, arg);
+}
+
+static inline void snz_thread_join(snz_thread_t thread)
+{
+  pthread_join(thread, NULL);
+}
+
+#define snz_mutex_init(mutex) pthread_mutex_init((mutex), NULL)
+#define snz_mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+#define snz_mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define snz_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+#define snz_cond_init(cond) pthread_cond_init((cond), NULL)
+#define snz_cond_destroy(cond) pthread_cond_destroy(cond)
+#define snz_cond_wait(cond, mutex) pthread_cond_wait((cond), (mutex))
+#define snz_cond_broadcast(cond) pthread_cond_broadcast(cond)
+
+#elif defined WIN32
+#include <windows.h>
+#include <process.h>
+#define SNZ_HAVE_THREAD 1
+
+typedef HANDLE snz_thread_t;
+typedef CRITICAL_SECTION snz_mutex_t;
+typedef CONDITION_VARIABLE snz_cond_t;
+
+#define SNZ_THREAD_FUNC(name, arg) unsigned __stdcall name(void *arg)
+#define SNZ_THREAD_RETURN return 0
+typedef unsigned (__stdcall *snz_thread_func_t)(void *);
+
+static inline int snz_thread_create(snz_thread_t *thread, snz_thread_func_t func, void *arg)
+{
+  *thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+  return *thread ? 0 : -1;
+}
+
+static inline void snz_thread_join(snz_thread_t thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+#define snz_mutex_init(mutex) InitializeCriticalSection(mutex)
+#define snz_mutex_destroy(mutex) DeleteCriticalSection(mutex)
+#define snz_mutex_lock(mutex) EnterCriticalSection(mutex)
+#define snz_mutex_unlock(mutex) LeaveCriticalSection(mutex)
+#define snz_cond_init(cond) InitializeConditionVariable(cond)
+#define snz_cond_destroy(cond) ((void)0)
+#define snz_cond_wait(cond, mutex) SleepConditionVariableCS((cond), (mutex), INFINITE)
+#define snz_cond_broadcast(cond) WakeAllConditionVariable(cond)
+#endif
+
+#endif /* THREAD_H */